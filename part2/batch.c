@@ -0,0 +1,364 @@
+//
+// Created by stevehb on 19-Oct-26.
+//
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+#include "types.h"
+#include "batch.h"
+#include "common_funcs.h"
+#include "dispatch.h"
+#include "haversine.h"
+#include "json_parser.h"
+#include "pairs_bin.h"
+#include "tempo.h"
+
+#define BATCH_COORDS_SUFFIX "-coords."
+#define BATCH_DIST_SUFFIX "-dist.f64"
+
+typedef struct {
+    BatchJob** order;
+    u64 jobCount;
+    _Atomic u64 nextJob;
+    bool verifyBinary;
+} BatchShared;
+
+/// Per-worker state. The pair columns and distance buffer keep their capacity from file to file.
+typedef struct {
+    BatchShared* shared;
+    u32 workerIdx;
+    PairArrays pairs;
+    f64* dists;
+    u64 distCapacity;
+    u64 fileCount;
+    u64 busyTicks;
+} BatchWorker;
+
+static bool batch_hasExtension(const char* filename, const char* ext) {
+    u64 len = strlen(filename);
+    u64 extLen = strlen(ext);
+    return len > extLen && strcmp(filename + len - extLen, ext) == 0;
+}
+
+static void batch_findDistFile(BatchJob* job) {
+    job->distFilename[0] = '\0';
+    const char* suffix = strstr(job->filename, BATCH_COORDS_SUFFIX);
+    if (suffix == NULL) return;
+    const char* next;
+    while ((next = strstr(suffix + 1, BATCH_COORDS_SUFFIX)) != NULL) {
+        suffix = next;  // Use the last one, directory names may contain it too
+    }
+    int prefixLen = (int) (suffix - job->filename);
+    char candidate[FILENAME_LEN] = { 0 };
+    int written = snprintf(candidate, FILENAME_LEN, "%.*s%s", prefixLen, job->filename, BATCH_DIST_SUFFIX);
+    if (written < 0 || written >= FILENAME_LEN) return;
+    FILE* file = fopen(candidate, "rb");
+    if (file == NULL) return;
+    fclose(file);
+    memcpy(job->distFilename, candidate, FILENAME_LEN);
+}
+
+void batch_addFile(BatchList* list, const char* filename) {
+    if (strlen(filename) >= FILENAME_LEN) {
+        fprintf(stderr, "WARNING: Skipping %s, the path is longer than %d characters\n", filename, FILENAME_LEN - 1);
+        return;
+    }
+    if (list->count + 1 > list->capacity) {
+        u64 newCapacity = list->capacity == 0 ? 32 : (list->capacity * 2);
+        BatchJob* newJobs = realloc(list->jobs, newCapacity * sizeof(BatchJob));
+        if (newJobs == NULL) {
+            fprintf(stderr, "ERROR: Memory re-alloc failed for %llu batch jobs\n", newCapacity);
+            exit(1);
+        }
+        list->jobs = newJobs;
+        list->capacity = newCapacity;
+    }
+    BatchJob* job = &list->jobs[list->count++];
+    memset(job, 0, sizeof(*job));
+    snprintf(job->filename, FILENAME_LEN, "%s", filename);
+    job->fileSize = getFileSize(filename);
+    job->isBinary = pairsBin_isBinaryFile(filename);
+    batch_findDistFile(job);
+}
+
+static int batch_compareNames(const void* a, const void* b) {
+    return strcmp(*(const char* const*) a, *(const char* const*) b);
+}
+
+void batch_addDirectory(BatchList* list, const char* dirname) {
+    char** names = NULL;
+    u64 nameCount = 0;
+    u64 nameCapacity = 0;
+#ifdef _WIN32
+    char pattern[FILENAME_LEN] = { 0 };
+    snprintf(pattern, FILENAME_LEN, "%s\\*", dirname);
+    WIN32_FIND_DATAA found;
+    HANDLE finder = FindFirstFileA(pattern, &found);
+    if (finder == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "ERROR: Failed to open directory %s\n", dirname);
+        exit(1);
+    }
+    do {
+        if (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+        const char* entryName = found.cFileName;
+#else
+    DIR* dir = opendir(dirname);
+    if (dir == NULL) {
+        fprintf(stderr, "ERROR: Failed to open directory %s\n", dirname);
+        exit(1);
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char* entryName = entry->d_name;
+#endif
+        if (!batch_hasExtension(entryName, ".json") && !batch_hasExtension(entryName, ".bin")) continue;
+        if (nameCount + 1 > nameCapacity) {
+            nameCapacity = nameCapacity == 0 ? 32 : (nameCapacity * 2);
+            names = realloc(names, nameCapacity * sizeof(char*));
+            if (names == NULL) {
+                fprintf(stderr, "ERROR: Memory re-alloc failed for %llu directory entries\n", nameCapacity);
+                exit(1);
+            }
+        }
+        names[nameCount++] = strdup(entryName);
+#ifdef _WIN32
+    } while (FindNextFileA(finder, &found));
+    FindClose(finder);
+#else
+    }
+    closedir(dir);
+#endif
+
+    // Directory order is arbitrary, sorting keeps the report stable between runs
+    qsort(names, nameCount, sizeof(char*), batch_compareNames);
+    for (u64 i = 0; i < nameCount; i++) {
+        char path[FILENAME_LEN * 2] = { 0 };
+        snprintf(path, sizeof(path), "%s/%s", dirname, names[i]);
+        bool isPairs = !batch_hasExtension(path, ".bin") || pairsBin_isBinaryFile(path);
+        if (isPairs) {
+            batch_addFile(list, path);
+        }
+        free(names[i]);
+    }
+    free(names);
+}
+
+void batch_addListFile(BatchList* list, const char* listFilename) {
+    FILE* file = fopen(listFilename, "r");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR: Failed to open file list %s\n", listFilename);
+        exit(1);
+    }
+    char line[FILENAME_LEN * 2];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        u64 len = strcspn(line, "\r\n");
+        line[len] = '\0';
+        if (len == 0 || line[0] == '#') continue;
+        batch_addFile(list, line);
+    }
+    fclose(file);
+}
+
+void batch_free(BatchList* list) {
+    free(list->jobs);
+    *list = (BatchList){ 0 };
+}
+
+static void batch_onPair(void* ctx, f64 lng0, f64 lat0, f64 lng1, f64 lat1) {
+    pairs_append((PairArrays*) ctx, lng0, lat0, lng1, lat1);
+}
+
+static void batch_processFile(BatchWorker* worker, BatchJob* job) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    job->workerIdx = worker->workerIdx;
+
+    // A bad file fails on its own, the rest of the batch carries on
+    if (job->fileSize == 0) {
+        snprintf(job->error, BATCH_ERROR_LEN, "File is empty or missing");
+        return;
+    }
+    FileState input = { 0 };
+    if (!tryMmapFile(job->filename, &input)) {
+        snprintf(job->error, BATCH_ERROR_LEN, "Failed to memory-map file");
+        return;
+    }
+    PairArrays pairs = { 0 };
+    if (job->isBinary) {
+        if (!pairsBin_tryView(&input, worker->shared->verifyBinary, &pairs, job->error, BATCH_ERROR_LEN)) {
+            munmapFile(&input);
+            return;
+        }
+    } else {
+        worker->pairs.count = 0;
+        JsonStreamResult stream = json_streamPairsBuffer(input.data, input.size, batch_onPair, &worker->pairs);
+        if (stream.error[0] != '\0') {
+            snprintf(job->error, BATCH_ERROR_LEN, "%s", stream.error);
+            munmapFile(&input);
+            return;
+        }
+        pairs = worker->pairs;
+    }
+
+    if (pairs.count > worker->distCapacity) {
+        free(worker->dists);
+        worker->distCapacity = pairs.count;
+        worker->dists = malloc(worker->distCapacity * sizeof(f64));
+        if (worker->dists == NULL) {
+            fprintf(stderr, "ERROR: Memory alloc failed for %llu distances\n", worker->distCapacity);
+            exit(1);
+        }
+    }
+    haversine_reference(pairs.lng0, pairs.lat0, pairs.lng1, pairs.lat1, worker->dists, pairs.count);
+    BlockedSum sum = { 0 };
+    for (u64 i = 0; i < pairs.count; i++) {
+        blockedSum_add(&sum, worker->dists[i]);
+    }
+    job->pairCount = pairs.count;
+    job->average = blockedSum_result(sum, pairs.count);
+
+    if (job->distFilename[0] != '\0') {
+        FileState distFile = { 0 };
+        if (!tryMmapFile(job->distFilename, &distFile)) {
+            fprintf(stderr, "WARNING: Failed to memory-map %s, not checking %s\n", job->distFilename, job->filename);
+        } else {
+            u64 knownCount = distFile.size >= sizeof(f64) ? (distFile.size / sizeof(f64)) - 1 : 0;  // Last entry is the average
+            if (knownCount < pairs.count) {
+                fprintf(stderr, "WARNING: %s has fewer entries (%llu) than %s has pairs, not checking it\n",
+                    job->distFilename, knownCount, job->filename);
+            } else {
+                const f64* knownDists = (const f64*) distFile.data;
+                validate_range(&job->report, &pairs, worker->dists, knownDists, 0, pairs.count, 0);
+                memcpy(&job->checkedAverage, distFile.data + knownCount * sizeof(f64), sizeof(f64));
+                job->isChecked = true;
+            }
+            munmapFile(&distFile);
+        }
+    }
+    munmapFile(&input);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    job->elapsedMs = getElapsedMillis(start, end);
+}
+
+static void batch_workerMain(void* arg) {
+    BatchWorker* worker = arg;
+    BatchShared* shared = worker->shared;
+    if (worker->workerIdx > 0) {
+        char threadLabel[TEMPO_THREAD_LABEL_LEN] = { 0 };
+        snprintf(threadLabel, sizeof(threadLabel), "batch[%u]", worker->workerIdx);
+        tempo_nameThread(threadLabel);
+    }
+    u64 startTicks = tempo_readTicks();
+    for (;;) {
+        u64 orderIdx = atomic_fetch_add_explicit(&shared->nextJob, 1, memory_order_relaxed);
+        if (orderIdx >= shared->jobCount) break;
+        tempo_startBlock("batch_file");
+        batch_processFile(worker, shared->order[orderIdx]);
+        tempo_countBytes(shared->order[orderIdx]->fileSize);
+        tempo_countItems(shared->order[orderIdx]->pairCount);
+        tempo_stopBlock("batch_file");
+        worker->fileCount++;
+    }
+    worker->busyTicks = tempo_readTicks() - startTicks;
+}
+
+static int batch_compareSizeDesc(const void* a, const void* b) {
+    const BatchJob* jobA = *(const BatchJob* const*) a;
+    const BatchJob* jobB = *(const BatchJob* const*) b;
+    if (jobA->fileSize != jobB->fileSize) {
+        return jobA->fileSize < jobB->fileSize ? 1 : -1;
+    }
+    return jobA < jobB ? -1 : (jobA > jobB);
+}
+
+u64 batch_run(BatchList* list, u32 workerCount, bool verifyBinary) {
+    tempo_startFunc;
+    if (list->count == 0) {
+        printf("Batch: no input files\n");
+        tempo_stopFunc;
+        return 0;
+    }
+    workerCount = (u32) MAX(1, MIN(workerCount, list->count));
+    BatchShared shared = { 0 };
+    shared.order = malloc(list->count * sizeof(BatchJob*));
+    BatchWorker* workers = calloc(workerCount, sizeof(BatchWorker));
+    ThreadHandle* threads = malloc(workerCount * sizeof(ThreadHandle));
+    if (shared.order == NULL || workers == NULL || threads == NULL) {
+        fprintf(stderr, "ERROR: Memory alloc failed for %llu batch jobs\n", list->count);
+        exit(1);
+    }
+    // Largest first, so a big file picked up late cannot leave the other workers idle at the end
+    for (u64 i = 0; i < list->count; i++) {
+        shared.order[i] = &list->jobs[i];
+    }
+    qsort(shared.order, list->count, sizeof(BatchJob*), batch_compareSizeDesc);
+    shared.jobCount = list->count;
+    shared.verifyBinary = verifyBinary;
+    atomic_init(&shared.nextJob, 0);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (u32 w = 0; w < workerCount; w++) {
+        workers[w].shared = &shared;
+        workers[w].workerIdx = w;
+    }
+    // The calling thread works too
+    for (u32 w = 1; w < workerCount; w++) {
+        threads[w] = thread_start(batch_workerMain, &workers[w]);
+    }
+    batch_workerMain(&workers[0]);
+    for (u32 w = 1; w < workerCount; w++) {
+        thread_join(&threads[w]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    f64 wallMs = getElapsedMillis(start, end);
+
+    u64 totalBytes = 0;
+    u64 totalPairs = 0;
+    u64 failedCount = 0;
+    for (u64 i = 0; i < list->count; i++) {
+        BatchJob* job = &list->jobs[i];
+        if (job->error[0] != '\0') {
+            printf("%s: FAILED: %s, on worker %u\n", job->filename, job->error, job->workerIdx);
+            failedCount++;
+            continue;
+        }
+        totalBytes += job->fileSize;
+        totalPairs += job->pairCount;
+        printf("%s: %llu pairs, average %.16f", job->filename, job->pairCount, job->average);
+        if (job->isChecked) {
+            printf(", checked %.16f, max error %E (%llu over epsilon)", job->checkedAverage, job->report.maxAbsError, job->report.overEpsCount);
+        }
+        printf(", %.3fms on worker %u\n", job->elapsedMs, job->workerIdx);
+    }
+    for (u32 w = 0; w < workerCount; w++) {
+        char label[TEMPO_STAGE_LABEL_LEN] = { 0 };
+        snprintf(label, sizeof(label), "batch[%u]", w);
+        tempo_addStage(label, workers[w].busyTicks, 0, workers[w].fileCount);
+        pairs_free(&workers[w].pairs);
+        free(workers[w].dists);
+    }
+
+    f64 wallSec = wallMs / 1000.0;
+    printf("Batch: %llu files (%llu failed), %llu pairs, %llu bytes in %.3fms on %u workers\n",
+        list->count, failedCount, totalPairs, totalBytes, wallMs, workerCount);
+    printf("Batch throughput: %.1f files/s, %.3f GB/s, %.0f pairs/s\n",
+        (f64) (list->count - failedCount) / wallSec, ((f64) totalBytes / (1024.0 * 1024.0 * 1024.0)) / wallSec, (f64) totalPairs / wallSec);
+
+    free(threads);
+    free(workers);
+    free(shared.order);
+    tempo_stopFunc;
+    return failedCount;
+}
@@ -0,0 +1,49 @@
+//
+// Created by stevehb on 19-Oct-26.
+//
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+
+#include "types.h"
+#include "common_funcs.h"
+#include "validate.h"
+
+#define BATCH_ERROR_LEN 192
+
+typedef struct BatchJob {
+    char filename[FILENAME_LEN];
+    char distFilename[FILENAME_LEN];  // Sibling `X-dist.f64` of `X-coords.json`, empty if there is none
+    u64 fileSize;
+    bool isBinary;
+
+    // Filled by the worker that takes the job
+    u64 pairCount;
+    f64 average;
+    f64 checkedAverage;
+    bool isChecked;
+    ValidateReport report;
+    f64 elapsedMs;
+    u32 workerIdx;
+    char error[BATCH_ERROR_LEN];  // Why the file was not processed, empty when it was
+} BatchJob;
+
+typedef struct BatchList {
+    BatchJob* jobs;
+    u64 count;
+    u64 capacity;
+} BatchList;
+
+void batch_addFile(BatchList* list, const char* filename);
+/// Adds every `.json` and binary `.bin` pairs file directly inside `dirname`, in name order
+void batch_addDirectory(BatchList* list, const char* dirname);
+/// Adds the files named in a text file, one per line. Blank lines and lines starting with '#' are skipped.
+void batch_addListFile(BatchList* list, const char* listFilename);
+/// Processes all jobs on `workerCount` threads, largest files first, then prints per-file and aggregate results.
+/// A file that cannot be mapped or parsed is reported and skipped. Returns how many were.
+u64 batch_run(BatchList* list, u32 workerCount, bool verifyBinary);
+void batch_free(BatchList* list);
+
+#endif //BATCH_H
@@ -10,10 +10,12 @@
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#include <io.h>
 #else
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sched.h>
 #include <unistd.h>
 #endif
 
@@ -34,9 +36,15 @@ const char* basename(const char* path) {
     return last ? last + 1 : path;
 }
 
-void makeFilenames(char* jsonFilename, char* distFilename, u32 buffSize, u64 pairCount, u32 clusterCount) {
-    snprintf(jsonFilename, buffSize, "data-%llu-%u-coords.json", pairCount, clusterCount);
-    snprintf(distFilename, buffSize, "data-%llu-%u-dist.f64", pairCount, clusterCount);
+/// `binFilename` may be NULL
+void makeFilenames(char* jsonFilename, char* distFilename, char* binFilename, u32 buffSize, u64 pairCount, u32 clusterCount, const char* label) {
+    const char* sep = (label != NULL && label[0] != '\0') ? "-" : "";
+    label = label != NULL ? label : "";
+    snprintf(jsonFilename, buffSize, "data-%llu-%u%s%s-coords.json", pairCount, clusterCount, sep, label);
+    snprintf(distFilename, buffSize, "data-%llu-%u%s%s-dist.f64", pairCount, clusterCount, sep, label);
+    if (binFilename != NULL) {
+        snprintf(binFilename, buffSize, "data-%llu-%u%s%s-coords.bin", pairCount, clusterCount, sep, label);
+    }
 }
 
 void sleep_ms(u64 ms) {
@@ -55,6 +63,25 @@ bool getParamValue_str(int argc, char** argv, u32 position, char* buff, u32 buff
     return true;
 }
 
+bool getParamValue_namedStr(int argc, char** argv, const char* name, char* buff, u32 buffSize) {
+    for (int argIdx = 1; argIdx + 1 < argc; argIdx++) {
+        if (strcmp(argv[argIdx], name) == 0) {
+            snprintf(buff, buffSize, "%s", argv[argIdx + 1]);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool getParamFlag(int argc, char** argv, const char* name) {
+    for (int argIdx = 1; argIdx < argc; argIdx++) {
+        if (strcmp(argv[argIdx], name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool getParamValue_u32(int argc, char** argv, const char* name, u32* out_value) {
     for (int argIdx = 1; argIdx < argc; argIdx++) {
         const char* arg = argv[argIdx];
@@ -95,6 +122,26 @@ bool getParamValue_u64(int argc, char** argv, const char* name, u64* out_value)
     return false;
 }
 
+/// Reads the `count` values following `name`, as in `-query 51.5 -0.1 25`
+bool getParamValues_f64(int argc, char** argv, const char* name, f64* out_values, u32 count) {
+    for (int argIdx = 1; argIdx < argc; argIdx++) {
+        if (strcmp(argv[argIdx], name) == 0) {
+            if (argIdx + (int) count >= argc) {
+                fprintf(stderr, "ERROR: `%s` expects %u numbers\n", name, count);
+                exit(1);
+            }
+            for (u32 i = 0; i < count; i++) {
+                const char* valueStr = argv[argIdx + 1 + i];
+                if (sscanf(valueStr, "%lf", &out_values[i]) != 1) {
+                    fprintf(stderr, "ERROR: the parameter value for `%s %s` does not parse to a number\n", name, valueStr);
+                    exit(1);
+                }
+            }
+            return true;
+        }
+    }
+    return false;
+}
 
 static f64 sqr(f64 f) {
     return f * f;
@@ -106,12 +153,58 @@ f64 referenceHaversineDistance(f64 lng0, f64 lat0, f64 lng1, f64 lat1, f64 rad)
     lat0 = DEG2RAD(lat0);
     lat1 = DEG2RAD(lat1);
     f64 a = sqr(sin(dLat / 2.0)) + cos(lat0) * cos(lat1) * sqr(sin(dLng / 2.0));
+    a = MIN(a, 1.0);  // Rounding can carry near-antipodal pairs just past 1, out of asin's domain
     f64 c = 2.0 * asin(sqrt(a));
     return rad * c;
 }
 
+u64 getFileSize(const char* filename) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA attrs;
+    if (!GetFileAttributesEx(filename, GetFileExInfoStandard, &attrs)) return 0;
+    return ((u64) attrs.nFileSizeHigh << 32) | attrs.nFileSizeLow;
+#else
+    struct stat st = { 0 };
+    if (stat(filename, &st) < 0) return 0;
+    return st.st_size;
+#endif
+}
+
+int fileSeek(FILE* file, u64 offset) {
+#ifdef _WIN32
+    return _fseeki64(file, (s64) offset, SEEK_SET);
+#else
+    return fseeko(file, (off_t) offset, SEEK_SET);
+#endif
+}
+
+bool fileReserve(FILE* file, u64 size) {
+#ifdef _WIN32
+    return _chsize_s(_fileno(file), (s64) size) == 0;
+#else
+    return posix_fallocate(fileno(file), 0, (off_t) size) == 0;
+#endif
+}
+
+bool fileTrim(FILE* file, u64 size) {
+    fflush(file);
+#ifdef _WIN32
+    return _chsize_s(_fileno(file), (s64) size) == 0;
+#else
+    return ftruncate(fileno(file), (off_t) size) == 0;
+#endif
+}
+
 FileState mmapFile(const char* filename) {
     FileState state = { 0 };
+    if (!tryMmapFile(filename, &state)) {
+        fprintf(stderr, "ERROR: Failed to memory-map file %s\n", filename);
+        exit(1);
+    }
+    return state;
+}
+bool tryMmapFile(const char* filename, FileState* out_state) {
+    FileState state = { 0 };
 #ifdef _WIN32
     state.file = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
     if (state.file == INVALID_HANDLE_VALUE) goto error;
@@ -131,12 +224,12 @@ FileState mmapFile(const char* filename) {
     state.data = mmap(NULL, state.size, PROT_READ, MAP_PRIVATE, state.fd, 0);
     if (state.data == MAP_FAILED) goto error;
 #endif
-    return state;
+    *out_state = state;
+    return true;
 
     error:
-        fprintf(stderr, "ERROR: Failed to memory-map file %s\n", filename);
     munmapFile(&state);
-    exit(1);
+    return false;
 }
 void munmapFile(FileState* state) {
     if (state == NULL) return;
@@ -161,4 +254,129 @@ void munmapFile(FileState* state) {
 #endif
 }
 
+FileState mmapFileWrite(const char* filename, u64 size) {
+    FileState state = { 0 };
+    state.size = MAX(size, 1);  // Zero-length mappings are not allowed
+#ifdef _WIN32
+    state.file = CreateFile(filename, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (state.file == INVALID_HANDLE_VALUE) goto error;
+    // Mapping past the end extends the file, which reserves the space up front
+    state.mapping = CreateFileMapping(state.file, NULL, PAGE_READWRITE, (DWORD) (state.size >> 32), (DWORD) state.size, NULL);
+    if (!state.mapping) goto error;
+    state.data = MapViewOfFile(state.mapping, FILE_MAP_WRITE, 0, 0, 0);
+    if (!state.data) goto error;
+#else
+    state.fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (state.fd < 0) goto error;
+    // Reserve the blocks now so page faults while writing never have to allocate on disk.
+    // Some filesystems cannot, a plain resize is still correct there.
+    if (posix_fallocate(state.fd, 0, (off_t) state.size) != 0 && ftruncate(state.fd, (off_t) state.size) != 0) goto error;
+    state.data = mmap(NULL, state.size, PROT_READ | PROT_WRITE, MAP_SHARED, state.fd, 0);
+    if (state.data == MAP_FAILED) goto error;
+#endif
+    return state;
+
+    error:
+        fprintf(stderr, "ERROR: Failed to create and map output file %s (%llu bytes)\n", filename, state.size);
+    munmapFile(&state);
+    exit(1);
+}
+void munmapFileWrite(FileState* state, u64 finalSize) {
+    if (state == NULL) return;
+#ifdef _WIN32
+    if (state->data) {
+        FlushViewOfFile(state->data, 0);
+        UnmapViewOfFile(state->data);
+    }
+    if (state->mapping) {
+        CloseHandle(state->mapping);
+    }
+    if (state->file) {
+        LARGE_INTEGER end;
+        end.QuadPart = (LONGLONG) finalSize;
+        if (!SetFilePointerEx(state->file, end, NULL, FILE_BEGIN) || !SetEndOfFile(state->file)) {
+            fprintf(stderr, "WARNING: Failed to trim output file to %llu bytes\n", finalSize);
+        }
+        CloseHandle(state->file);
+    }
+#else
+    if (state->data && state->data != MAP_FAILED) {
+        munmap(state->data, state->size);
+    }
+    if (state->fd >= 0) {
+        if (ftruncate(state->fd, (off_t) finalSize) != 0) {
+            fprintf(stderr, "WARNING: Failed to trim output file to %llu bytes\n", finalSize);
+        }
+        close(state->fd);
+    }
+#endif
+    *state = (FileState){ 0 };
+}
 
+
+typedef struct {
+    ThreadFunc func;
+    void* arg;
+} ThreadStartInfo;
+
+#ifdef _WIN32
+static DWORD WINAPI thread_trampoline(LPVOID param) {
+#else
+static void* thread_trampoline(void* param) {
+#endif
+    ThreadStartInfo info = *(ThreadStartInfo*) param;
+    free(param);
+    info.func(info.arg);
+    return 0;
+}
+
+ThreadHandle thread_start(ThreadFunc func, void* arg) {
+    ThreadHandle thread = { 0 };
+    ThreadStartInfo* info = malloc(sizeof(ThreadStartInfo));
+    if (info == NULL) {
+        fprintf(stderr, "ERROR: Memory alloc failed for thread start info\n");
+        exit(1);
+    }
+    info->func = func;
+    info->arg = arg;
+#ifdef _WIN32
+    thread.handle = CreateThread(NULL, 0, thread_trampoline, info, 0, NULL);
+    if (thread.handle == NULL) goto error;
+#else
+    if (pthread_create(&thread.handle, NULL, thread_trampoline, info) != 0) goto error;
+#endif
+    return thread;
+
+    error:
+        fprintf(stderr, "ERROR: Failed to start thread\n");
+    free(info);
+    exit(1);
+}
+void thread_join(ThreadHandle* thread) {
+#ifdef _WIN32
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+    thread->handle = NULL;
+#else
+    pthread_join(thread->handle, NULL);
+#endif
+}
+
+void thread_yield(void) {
+#ifdef _WIN32
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+u32 getCpuCount(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (u32) count : 1;
+#endif
+}
@@ -6,12 +6,15 @@
 #define COMMON_FUNCS_H
 
 #include <stdbool.h>
+#include <stdio.h>
 #include <time.h>
 
 #include "types.h"
 
 #ifdef _WIN32
 typedef void* HANDLE;  // Pre-define handle so we don't need windows.h here
+#else
+#include <pthread.h>
 #endif
 
 typedef struct {
@@ -27,6 +30,16 @@ typedef struct {
     u64 position;
 } FileState;
 
+typedef void (*ThreadFunc)(void* arg);
+
+typedef struct {
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+} ThreadHandle;
+
 extern const f64 EARTH_RAD;
 
 #define FILENAME_LEN    256
@@ -43,13 +56,33 @@ extern const f64 EARTH_RAD;
 f64 getElapsedMillis(struct timespec start, struct timespec end);
 
 const char* basename(const char* path);
-void makeFilenames(char* jsonFilename, char* distFilename, u32 buffSize, u64 pairCount, u32 clusterCount);
+/// "data-PAIRS-CLUSTERS[-label]-coords.json" and friends, the label naming a non-default shape of the data
+void makeFilenames(char* jsonFilename, char* distFilename, char* binFilename, u32 buffSize, u64 pairCount, u32 clusterCount, const char* label);
 void sleep_ms(u64 ms);
 bool getParamValue_str(int argc, char** argv, u32 position, char* buff, u32 buffSize);
+bool getParamValue_namedStr(int argc, char** argv, const char* name, char* buff, u32 buffSize);
+bool getParamFlag(int argc, char** argv, const char* name);
 bool getParamValue_u32(int argc, char** argv, const char* name, u32* out_value);
 bool getParamValue_u64(int argc, char** argv, const char* name, u64* out_value);
+bool getParamValues_f64(int argc, char** argv, const char* name, f64* out_values, u32 count);
 f64 referenceHaversineDistance(f64 lng0, f64 lat0, f64 lng1, f64 lat1, f64 rad);
+u64 getFileSize(const char* filename);
+int fileSeek(FILE* file, u64 offset);
+/// Allocates `size` bytes on disk up front, so sequential writes never wait on block allocation.
+/// The file reports that size until it is written past or trimmed.
+bool fileReserve(FILE* file, u64 size);
+bool fileTrim(FILE* file, u64 size);
 FileState mmapFile(const char* filename);
+/// Same mapping, but returns false instead of exiting when the file cannot be opened or mapped
+bool tryMmapFile(const char* filename, FileState* out_state);
 void munmapFile(FileState* state);
+/// Creates or truncates `filename`, reserves `size` bytes for it on disk and maps it writable
+FileState mmapFileWrite(const char* filename, u64 size);
+/// Unmaps and cuts the file down to `finalSize`, which may be less than the mapped size
+void munmapFileWrite(FileState* state, u64 finalSize);
+ThreadHandle thread_start(ThreadFunc func, void* arg);
+void thread_join(ThreadHandle* thread);
+void thread_yield(void);
+u32 getCpuCount(void);
 
 #endif //COMMON_FUNCS_H
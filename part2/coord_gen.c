@@ -4,6 +4,8 @@
 
 #include <errno.h>
 #include <locale.h>
+#include <math.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,7 +14,12 @@
 
 #include "types.h"
 #include "common_funcs.h"
+#include "coord_shape.h"
+#include "haversine.h"
+#include "number_format.h"
+#include "pairs_bin.h"
 #include "random_number_generator.h"
+#include "work_queue.h"
 
 const f64 MIN_LNG = -180.0;
 const f64 MAX_LNG = 180.0;
@@ -31,75 +38,588 @@ f64 clampLat(f64 f) {
 }
 
 
+// Pairs are generated in fixed chunks, chunk N drawing from lanes seeded off the cluster stream jumped N + 1 times. Which
+// pairs a chunk holds and which numbers it draws never depend on the thread count, so neither does the output.
+#define COORD_CHUNK_PAIRS 32768
+// Chunks are whole reduction blocks, so the average is summed in the same blocks dist_processor uses
+#define COORD_CHUNK_BLOCKS (COORD_CHUNK_PAIRS / HAVERSINE_SUM_BLOCK_PAIRS)
+_Static_assert(COORD_CHUNK_PAIRS % HAVERSINE_SUM_BLOCK_PAIRS == 0, "Chunks must hold whole reduction blocks");
+// Longest possible default pair line: 4 numbers of at most 22 characters ("-1xx." and 16 digits), keys and punctuation.
+// A chunk of it fits a 4 MB buffer, other shapes size theirs from shape_lineMax.
+#define COORD_JSON_LINE_MAX 125
+// Buffers beyond one per worker, so the writer always has one to drain while every worker fills another
+#define COORD_EXTRA_SLOTS 2
+// Pairs drawn per bulk fill of the lane generator
+#define COORD_RAND_BLOCK_PAIRS 1024
+#define COORD_SPIN_LIMIT 64
 
+// Roads through each cluster for the road distribution, and how far a point strays from its road
+#define COORD_ROAD_COUNT 4
+#define COORD_ROAD_JITTER 0.002
+// Near-antipodal pairs miss the exact antipode by 10^-12 to 10^-1 degrees
+#define COORD_ANTIPODE_MIN_EXP -12.0
+#define COORD_ANTIPODE_MAX_EXP -1.0
+
+#define COORD_DISTRIBUTIONS(X) \
+    X(COORD_DIST_BOXES, "boxes") \
+    X(COORD_DIST_SPHERE, "sphere") \
+    X(COORD_DIST_GAUSSIAN, "gaussian") \
+    X(COORD_DIST_ROADS, "roads") \
+    X(COORD_DIST_ANTIPODAL, "antipodal") \
+    X(COORD_DIST_IDENTICAL, "identical") \
+    X(COORD_DIST_SEAM, "seam")
+
+#define ENUM_ENTRY(name, str) name,
+typedef enum {
+    COORD_DISTRIBUTIONS(ENUM_ENTRY)
+    COORD_DIST_COUNT
+} CoordDistribution;
+#undef ENUM_ENTRY
+#define STRING_ENTRY(name, str) str,
+static const char* COORD_DIST_STRS[] = {
+    COORD_DISTRIBUTIONS(STRING_ENTRY)
+};
+#undef STRING_ENTRY
+#undef COORD_DISTRIBUTIONS
+
+#define COORD_SELFCHECK_COUNT 10000000
+#define COORD_SELFCHECK_PRINT 10
+
+typedef struct {
+    u64 firstPair;
+    f64 minLng, maxLng;
+    f64 minLat, maxLat;
+    f64 centerLng, centerLat;
+    f64 rad;
+    f64 roadAngles[COORD_ROAD_COUNT];
+} CoordCluster;
+
+/// One chunk's output on its way from a worker to the writer
+typedef struct {
+    u64 chunkIdx;
+    u64 pairCount;
+    char* json;
+    u64 jsonLen;
+    f64* dists;
+    PairArrays pairs;  // Binary output only
+    NeumaierSum blockSums[COORD_CHUNK_BLOCKS];
+} CoordSlot;
+
+typedef struct {
+    CoordCluster* clusters;
+    u32 clusterCount;
+    Xoshiro128* chunkStates;
+    u64 chunkCount;
+    u64 pairCount;
+    bool isBin;
+    CoordDistribution dist;
+    CoordShape shape;
+    bool isDefaultShape;
+    atomic_ullong nextChunk;
+    WorkQueue freeSlots;
+    // Finished chunk N waits in ready[N % slotCount]. A worker holds a slot before it claims a chunk, so at
+    // most slotCount chunks are past the writer and no two of them share a ring entry.
+    _Atomic(CoordSlot*)* ready;
+    u64 slotCount;
+} CoordShared;
+
+typedef struct {
+    CoordShared* shared;
+    u64 chunkCount;
+} CoordWorker;
+
+typedef struct {
+    CoordShared* shared;
+    FILE* jsonF;
+    FILE* distF;
+    PairsBinWriter* binWriter;
+    u64 jsonBytes;
+    NeumaierSum total;
+    u64 stallCount;
+} CoordWriter;
+
+/// Same bytes as "  {\"lng0\":%21.16f,\"lat0\":%21.16f,\"lng1\":%21.16f,\"lat1\":%21.16f}%c\n"
+static u32 coord_formatLine(char* out, f64 lng0, f64 lat0, f64 lng1, f64 lat1, char commaChr) {
+    char* p = out;
+    memcpy(p, "  {\"lng0\":", 10);
+    p += 10;
+    p += format_f64Fixed16(p, lng0, 21);
+    memcpy(p, ",\"lat0\":", 8);
+    p += 8;
+    p += format_f64Fixed16(p, lat0, 21);
+    memcpy(p, ",\"lng1\":", 8);
+    p += 8;
+    p += format_f64Fixed16(p, lng1, 21);
+    memcpy(p, ",\"lat1\":", 8);
+    p += 8;
+    p += format_f64Fixed16(p, lat1, 21);
+    *p++ = '}';
+    *p++ = commaChr;
+    *p++ = '\n';
+    return (u32) (p - out);
+}
+
+/// Compares format_f64Fixed16 with snprintf on coordinate-range values, raw bit patterns, exact
+/// rounding ties and neighbours of 16-digit decimals. Returns the mismatch count.
+static u64 coord_selfCheck(u64 count, u32 seed) {
+    Xoshiro128 rng = { 0 };
+    xoshiro_seedState(&rng, seed);
+    u64 mismatchCount = 0;
+    char expected[512];
+    char got[512];
+    for (u64 i = 0; i < count; i++) {
+        f64 value = 0.0;
+        switch (i % 5) {
+            case 0: value = xoshiro_randF64(&rng, -200.0, 200.0); break;
+            case 1: {
+                // Any bit pattern, most of them past the fast path limit
+                u64 bits = xoshiro_randU64(&rng);
+                memcpy(&value, &bits, sizeof(value));
+                break;
+            }
+            case 2: value = xoshiro_randF64(&rng, -1.0, 1.0) * __builtin_exp2(xoshiro_randF64(&rng, -80.0, 10.0)); break;
+            case 3: {
+                // odd / 2^17 times 10^16 ends in exactly .5
+                s64 odd = 2 * (s64) xoshiro_randF64(&rng, -65536.0 * 1024.0, 65536.0 * 1024.0) + 1;
+                value = (f64) odd / 131072.0;
+                break;
+            }
+            case 4: {
+                f64 decimal = __builtin_round(xoshiro_randF64(&rng, -200.0, 200.0) * 1e8) / 1e8;
+                value = xoshiro_randF64(&rng, 0.0, 1.0) < 0.5 ? __builtin_nextafter(decimal, 1000.0) : __builtin_nextafter(decimal, -1000.0);
+                break;
+            }
+        }
+        if (i == 0) value = -0.0;
+        int expectedLen = snprintf(expected, sizeof(expected), "%21.16f", value);
+        u32 gotLen = format_f64Fixed16(got, value, 21);
+        got[gotLen] = '\0';
+        if ((u32) expectedLen != gotLen || memcmp(expected, got, gotLen) != 0) {
+            if (mismatchCount < COORD_SELFCHECK_PRINT) {
+                printf("  MISMATCH: %a expected '%s' got '%s'\n", value, expected, got);
+            }
+            mismatchCount++;
+        }
+    }
+    return mismatchCount;
+}
+
+static f64 coord_sphereLat(f64 unit) {
+    return RAD2DEG(asin(2.0 * unit - 1.0));
+}
+
+/// Two standard normals from two uniforms, Box-Muller
+static void coord_normals(f64 unitA, f64 unitB, f64* out_a, f64* out_b) {
+    f64 r = sqrt(-2.0 * log(1.0 - unitA));
+    *out_a = r * cos(2.0 * M_PI * unitB);
+    *out_b = r * sin(2.0 * M_PI * unitB);
+}
+
+/// A point `along` degrees down one of the cluster's roads and `across` degrees off it
+static void coord_roadPoint(const CoordCluster* cluster, u32 road, f64 along, f64 across, f64* out_lng, f64* out_lat) {
+    f64 angle = cluster->roadAngles[road];
+    f64 lat = cluster->centerLat + along * sin(angle) + across * cos(angle);
+    f64 lngScale = 1.0 / MAX(cos(DEG2RAD(cluster->centerLat)), 0.1);
+    *out_lng = wrapLng(cluster->centerLng + (along * cos(angle) - across * sin(angle)) * lngScale);
+    *out_lat = clampLat(lat);
+}
+
+/// Turns the four uniforms drawn for a pair into its coordinates. Every distribution takes exactly four, so
+/// switching distribution never shifts which numbers later pairs get.
+static void coord_placePair(CoordDistribution dist, const CoordCluster* cluster, const f64* unit, f64* out_coords) {
+    f64 lng0 = 0.0, lat0 = 0.0, lng1 = 0.0, lat1 = 0.0;
+    switch (dist) {
+        case COORD_DIST_SPHERE: {
+            // Uniform by area, so the poles are no denser than the equator
+            lng0 = MIN_LNG + unit[0] * (MAX_LNG - MIN_LNG);
+            lat0 = coord_sphereLat(unit[1]);
+            lng1 = MIN_LNG + unit[2] * (MAX_LNG - MIN_LNG);
+            lat1 = coord_sphereLat(unit[3]);
+        } break;
+        case COORD_DIST_GAUSSIAN: {
+            f64 sigma = cluster->rad / 3.0;
+            f64 lngScale = 1.0 / MAX(cos(DEG2RAD(cluster->centerLat)), 0.1);
+            f64 n0, n1, n2, n3;
+            coord_normals(unit[0], unit[1], &n0, &n1);
+            coord_normals(unit[2], unit[3], &n2, &n3);
+            lng0 = wrapLng(cluster->centerLng + n0 * sigma * lngScale);
+            lat0 = clampLat(cluster->centerLat + n1 * sigma);
+            lng1 = wrapLng(cluster->centerLng + n2 * sigma * lngScale);
+            lat1 = clampLat(cluster->centerLat + n3 * sigma);
+        } break;
+        case COORD_DIST_ROADS: {
+            // Both ends on the same road, the first uniform picking the road with its top bits
+            f64 roadPick = unit[0] * COORD_ROAD_COUNT;
+            u32 road = MIN((u32) roadPick, COORD_ROAD_COUNT - 1);
+            f64 jitter = cluster->rad * COORD_ROAD_JITTER;
+            coord_roadPoint(cluster, road, (2.0 * (roadPick - road) - 1.0) * cluster->rad, (unit[1] - 0.5) * jitter, &lng0, &lat0);
+            coord_roadPoint(cluster, road, (2.0 * unit[2] - 1.0) * cluster->rad, (unit[3] - 0.5) * jitter, &lng1, &lat1);
+        } break;
+        case COORD_DIST_ANTIPODAL: {
+            // The asin argument sits right at 1, where the formula loses the most precision
+            lng0 = MIN_LNG + unit[0] * (MAX_LNG - MIN_LNG);
+            lat0 = coord_sphereLat(unit[1]);
+            f64 miss = pow(10.0, COORD_ANTIPODE_MIN_EXP + unit[2] * (COORD_ANTIPODE_MAX_EXP - COORD_ANTIPODE_MIN_EXP));
+            f64 direction = 2.0 * M_PI * unit[3];
+            lng1 = wrapLng(lng0 + 180.0 + miss * cos(direction));
+            lat1 = clampLat(-lat0 + miss * sin(direction));
+        } break;
+        case COORD_DIST_IDENTICAL: {
+            lng0 = lng1 = MIN_LNG + unit[0] * (MAX_LNG - MIN_LNG);
+            lat0 = lat1 = coord_sphereLat(unit[1]);
+        } break;
+        case COORD_DIST_SEAM: {
+            // One end just east of the antimeridian, the other just west, so a naive longitude delta is ~360
+            lng0 = MAX_LNG - unit[0] * cluster->rad;
+            lat0 = clampLat(cluster->centerLat + (2.0 * unit[1] - 1.0) * cluster->rad);
+            lng1 = MIN_LNG + unit[2] * cluster->rad;
+            lat1 = clampLat(cluster->centerLat + (2.0 * unit[3] - 1.0) * cluster->rad);
+        } break;
+        default: {
+            lng0 = cluster->minLng + unit[0] * (cluster->maxLng - cluster->minLng);
+            lat0 = cluster->minLat + unit[1] * (cluster->maxLat - cluster->minLat);
+            lng1 = cluster->minLng + unit[2] * (cluster->maxLng - cluster->minLng);
+            lat1 = cluster->minLat + unit[3] * (cluster->maxLat - cluster->minLat);
+        } break;
+    }
+    out_coords[0] = lng0;
+    out_coords[1] = lat0;
+    out_coords[2] = lng1;
+    out_coords[3] = lat1;
+}
+
+static void coord_generateChunk(CoordShared* shared, CoordSlot* slot, u64 chunkIdx) {
+    XoshiroLanes lanes;
+    xoshiroLanes_seed(&lanes, &shared->chunkStates[chunkIdx]);
+    f64 units[COORD_RAND_BLOCK_PAIRS * 4];
+    u64 first = chunkIdx * COORD_CHUNK_PAIRS;
+    u64 end = MIN(first + COORD_CHUNK_PAIRS, shared->pairCount);
+    u32 clusterIdx = 0;
+    while (clusterIdx + 1 < shared->clusterCount && shared->clusters[clusterIdx + 1].firstPair <= first) {
+        clusterIdx++;
+    }
+
+    char* jsonBuff = slot->json;
+    for (u64 b = 0; b < COORD_CHUNK_BLOCKS; b++) {
+        slot->blockSums[b] = (NeumaierSum){ 0 };
+    }
+    for (u64 pairIdx = first; pairIdx < end; pairIdx++) {
+        u64 localIdx = pairIdx - first;
+        u64 unitIdx = localIdx % COORD_RAND_BLOCK_PAIRS;
+        if (unitIdx == 0) {
+            // Always whole blocks, so the numbers a pair gets do not depend on where the chunk ends
+            xoshiroLanes_fillF64(&lanes, units, COORD_RAND_BLOCK_PAIRS * 4, 0.0, 1.0);
+        }
+        while (clusterIdx + 1 < shared->clusterCount && shared->clusters[clusterIdx + 1].firstPair <= pairIdx) {
+            clusterIdx++;
+        }
+        const CoordCluster* cluster = &shared->clusters[clusterIdx];
+        f64 coords[4];
+        coord_placePair(shared->dist, cluster, &units[unitIdx * 4], coords);
+        f64 lng0 = coords[0], lat0 = coords[1], lng1 = coords[2], lat1 = coords[3];
+        f64 dist = referenceHaversineDistance(lng0, lat0, lng1, lat1, EARTH_RAD);
+        if (shared->isBin) {
+            slot->pairs.lng0[localIdx] = lng0;
+            slot->pairs.lat0[localIdx] = lat0;
+            slot->pairs.lng1[localIdx] = lng1;
+            slot->pairs.lat1[localIdx] = lat1;
+        } else if (shared->isDefaultShape) {
+            char commaChr = (pairIdx == shared->pairCount - 1) ? ' ' : ',';
+            jsonBuff += coord_formatLine(jsonBuff, lng0, lat0, lng1, lat1, commaChr);
+        } else {
+            jsonBuff += shape_formatPair(&shared->shape, jsonBuff, pairIdx, lng0, lat0, lng1, lat1, pairIdx == shared->pairCount - 1);
+        }
+        slot->dists[localIdx] = dist;
+        neumaier_add(&slot->blockSums[localIdx / HAVERSINE_SUM_BLOCK_PAIRS], dist);
+    }
+    slot->chunkIdx = chunkIdx;
+    slot->pairCount = end - first;
+    slot->jsonLen = shared->isBin ? 0 : (u64) (jsonBuff - slot->json);
+}
+
+static void coord_workerMain(void* arg) {
+    CoordWorker* worker = arg;
+    CoordShared* shared = worker->shared;
+    for (;;) {
+        void* item = NULL;
+        for (u32 spins = 1; !workQueue_tryPop(&shared->freeSlots, &item); spins++) {
+            if (spins >= COORD_SPIN_LIMIT) {
+                thread_yield();
+            }
+        }
+        CoordSlot* slot = item;
+        u64 chunkIdx = atomic_fetch_add_explicit(&shared->nextChunk, 1, memory_order_relaxed);
+        if (chunkIdx >= shared->chunkCount) {
+            workQueue_tryPush(&shared->freeSlots, slot);
+            break;
+        }
+        coord_generateChunk(shared, slot, chunkIdx);
+        atomic_store_explicit(&shared->ready[chunkIdx % shared->slotCount], slot, memory_order_release);
+        worker->chunkCount++;
+    }
+}
+
+/// Drains finished chunks in chunk order, so both outputs are written front to back and the sum is
+/// combined the same way for any thread count
+static void coord_writerMain(void* arg) {
+    CoordWriter* writer = arg;
+    CoordShared* shared = writer->shared;
+    for (u64 chunkIdx = 0; chunkIdx < shared->chunkCount; chunkIdx++) {
+        _Atomic(CoordSlot*)* entry = &shared->ready[chunkIdx % shared->slotCount];
+        CoordSlot* slot = atomic_load_explicit(entry, memory_order_acquire);
+        if (slot == NULL) {
+            writer->stallCount++;
+        }
+        for (u32 spins = 1; slot == NULL; spins++) {
+            if (spins >= COORD_SPIN_LIMIT) {
+                thread_yield();
+            }
+            slot = atomic_load_explicit(entry, memory_order_acquire);
+        }
+        atomic_store_explicit(entry, NULL, memory_order_relaxed);
+
+        if (shared->isBin) {
+            pairsBin_appendColumns(writer->binWriter, slot->pairs.lng0, slot->pairs.lat0, slot->pairs.lng1, slot->pairs.lat1, slot->pairCount);
+        } else if (fwrite(slot->json, 1, slot->jsonLen, writer->jsonF) != slot->jsonLen) {
+            fprintf(stderr, "ERROR: Failed writing JSON for chunk %llu\n", chunkIdx);
+            exit(1);
+        }
+        writer->jsonBytes += slot->jsonLen;
+        if (fwrite(slot->dists, sizeof(f64), slot->pairCount, writer->distF) != slot->pairCount) {
+            fprintf(stderr, "ERROR: Failed writing distances for chunk %llu\n", chunkIdx);
+            exit(1);
+        }
+        u64 blockCount = (slot->pairCount + HAVERSINE_SUM_BLOCK_PAIRS - 1) / HAVERSINE_SUM_BLOCK_PAIRS;
+        for (u64 b = 0; b < blockCount; b++) {
+            neumaier_addPartial(&writer->total, slot->blockSums[b]);
+        }
+        workQueue_tryPush(&shared->freeSlots, slot);  // Never full, every slot has exactly one place to be
+    }
+}
 
 int main(int argc, char** argv) {
     u32 seed = 1000;
     u64 pairCount = 5;
     u32 clusterCount = 4;
-    char jsonFilename[FILENAME_LEN] = { 0 }, distFilename[FILENAME_LEN] = { 0 };
+    u32 threadCount = getCpuCount();
+    char jsonFilename[FILENAME_LEN] = { 0 }, distFilename[FILENAME_LEN] = { 0 }, binFilename[FILENAME_LEN] = { 0 };
 
     getParamValue_u32(argc, argv, "-seed", &seed);
     getParamValue_u64(argc, argv, "-pairs", &pairCount);
     getParamValue_u32(argc, argv, "-clusters", &clusterCount);
+    getParamValue_u32(argc, argv, "-threads", &threadCount);
+    bool isBin = getParamFlag(argc, argv, "-bin");
+    clusterCount = MAX(1, clusterCount);
+    CoordDistribution dist = COORD_DIST_BOXES;
+    char distName[32] = { 0 };
+    if (getParamValue_namedStr(argc, argv, "-dist", distName, sizeof(distName))) {
+        dist = COORD_DIST_COUNT;
+        for (u32 i = 0; i < COORD_DIST_COUNT; i++) {
+            if (strcmp(distName, COORD_DIST_STRS[i]) == 0) dist = i;
+        }
+        if (dist == COORD_DIST_COUNT) {
+            fprintf(stderr, "ERROR: Unknown -dist '%s', expected boxes, sphere, gaussian, roads, antipodal, identical or seam\n", distName);
+            exit(1);
+        }
+    }
 
-    xoshiro_seed(seed);
-    makeFilenames(jsonFilename, distFilename, FILENAME_LEN, pairCount, clusterCount);
+    if (getParamFlag(argc, argv, "-selfcheck")) {
+        u64 checkCount = COORD_SELFCHECK_COUNT;
+        getParamValue_u64(argc, argv, "-checks", &checkCount);
+        struct timespec checkStart, checkEnd;
+        clock_gettime(CLOCK_MONOTONIC, &checkStart);
+        u64 mismatchCount = coord_selfCheck(checkCount, seed);
+        clock_gettime(CLOCK_MONOTONIC, &checkEnd);
+        printf("SELFCHECK: %llu of %llu values formatted differently from snprintf %%21.16f (%.3f ms)\n",
+            mismatchCount, checkCount, getElapsedMillis(checkStart, checkEnd));
+        return mismatchCount == 0 ? 0 : 1;
+    }
+
+    // The shape only changes how the JSON is written, so the same seed gives the same pairs and distances in every shape
+    CoordShape shape = shape_fromArgs(argc, argv, seed);
+    bool isDefaultShape = shape_isDefault(&shape);
+    if (isBin && !isDefaultShape) {
+        printf("NOTE: -bin has no text to shape, the shape options are ignored\n");
+        shape = shape_fromArgs(0, NULL, seed);
+        isDefaultShape = true;
+    }
+    // Default boxes keep the old filenames, anything else leads the label
+    char shapeLabel[SHAPE_LABEL_LEN] = { 0 };
+    shape_label(&shape, shapeLabel, sizeof(shapeLabel));
+    char label[SHAPE_LABEL_LEN + 32] = { 0 };
+    snprintf(label, sizeof(label), "%s%s%s", dist == COORD_DIST_BOXES ? "" : COORD_DIST_STRS[dist],
+        (dist != COORD_DIST_BOXES && shapeLabel[0] != '\0') ? "-" : "", shapeLabel);
+    u64 jsonLineMax = isDefaultShape ? COORD_JSON_LINE_MAX : shape_lineMax(&shape);
+    u64 jsonBuffBytes = COORD_CHUNK_PAIRS * jsonLineMax;
+    const char* jsonHeader = shape_header(&shape);
+    const char* jsonFooter = shape_footer(&shape);
+    makeFilenames(jsonFilename, distFilename, binFilename, FILENAME_LEN, pairCount, clusterCount, label);
 
     printf("SEED: %u\n", seed);
-    printf("FILENAMES: '%s' and '%s'\n", jsonFilename, distFilename);
+    printf("DISTRIBUTION: %s\n", COORD_DIST_STRS[dist]);
+    if (!isDefaultShape) {
+        printf("SHAPE: %s\n", shapeLabel);
+    }
+    printf("FILENAMES: '%s' and '%s'\n", isBin ? binFilename : jsonFilename, distFilename);
 
     struct timespec start, end;
     clock_gettime(CLOCK_MONOTONIC, &start);
-    FILE* jsonF = fopen(jsonFilename, "w");
-    FILE* distF = fopen(distFilename, "wb");
-    fprintf(jsonF, "{\"pairs\":[\n");
+    CoordShared shared = { 0 };
+    shared.pairCount = pairCount;
+    shared.clusterCount = clusterCount;
+    shared.isBin = isBin;
+    shared.dist = dist;
+    shared.shape = shape;
+    shared.isDefaultShape = isDefaultShape;
+    shared.chunkCount = (pairCount + COORD_CHUNK_PAIRS - 1) / COORD_CHUNK_PAIRS;
+    shared.clusters = malloc(clusterCount * sizeof(CoordCluster));
+    shared.chunkStates = malloc(MAX(1, shared.chunkCount) * sizeof(Xoshiro128));
+    if (shared.clusters == NULL || shared.chunkStates == NULL) {
+        fprintf(stderr, "ERROR: Memory alloc failed for %u clusters and %llu chunks\n", clusterCount, shared.chunkCount);
+        exit(1);
+    }
+
+    // Clusters come from the seeded stream itself, then every chunk gets its own jump ahead of it
+    Xoshiro128 rng = { 0 };
+    xoshiro_seedState(&rng, seed);
     u64 basePairCountPerCluster = pairCount / clusterCount;
     u64 clustersWithRemainder = pairCount % clusterCount;
-    f64 accumCoef = 1.0 / (f64)pairCount;
-    f64 accum = 0.0;
-    u64 total = 0;
+    u64 firstPair = 0;
+    for (u32 clusterIdx = 0; clusterIdx < clusterCount; clusterIdx++) {
+        f64 clusterRad = xoshiro_randF64(&rng, 5.0, 20.0);
+        f64 clusterLng = xoshiro_randF64(&rng, MIN_LNG, MAX_LNG);
+        f64 clusterLat = xoshiro_randF64(&rng, MIN_LAT, MAX_LAT);
+        CoordCluster* cluster = &shared.clusters[clusterIdx];
+        cluster->firstPair = firstPair;
+        cluster->minLng = clusterLng - clusterRad;
+        cluster->maxLng = clusterLng + clusterRad;
+        cluster->minLat = clusterLat - clusterRad;
+        cluster->maxLat = clusterLat + clusterRad;
+        cluster->centerLng = clusterLng;
+        cluster->centerLat = clusterLat;
+        cluster->rad = clusterRad;
+        firstPair += basePairCountPerCluster + ((clusterIdx < clustersWithRemainder) ? 1 : 0);
+    }
+    for (u64 chunkIdx = 0; chunkIdx < shared.chunkCount; chunkIdx++) {
+        xoshiro_jump(&rng);
+        shared.chunkStates[chunkIdx] = rng;
+    }
+    // Road directions come from one more jump past the last chunk, leaving every other draw where it was
+    xoshiro_jump(&rng);
     for (u32 clusterIdx = 0; clusterIdx < clusterCount; clusterIdx++) {
-        bool isLastCluster = clusterIdx == clusterCount - 1;
-        u64 clusterPairCount = basePairCountPerCluster + ((clusterIdx < clustersWithRemainder) ? 1 : 0);
-        total += clusterPairCount;
-        f64 clusterRad = rand_f64(5.0, 20.0);
-        f64 clusterLng = rand_f64(MIN_LNG, MAX_LNG);
-        f64 clusterLat = rand_f64(MIN_LAT, MAX_LAT);
-        f64 minLng = clusterLng - clusterRad;
-        f64 maxLng = clusterLng + clusterRad;
-        f64 minLat = clusterLat - clusterRad;
-        f64 maxLat = clusterLat + clusterRad;
-        char* jsonBuffStart = malloc(clusterPairCount * 128);  // Approx
-        char* jsonBuff = jsonBuffStart;
-        f64* distBuff = malloc(clusterPairCount * sizeof(f64));
-        for (u64 pairIdx = 0; pairIdx < clusterPairCount; pairIdx++) {
-            bool isLastPair = pairIdx == clusterPairCount - 1;
-            f64 lng0 = rand_f64(minLng, maxLng);
-            f64 lat0 = rand_f64(minLat, maxLat);
-            f64 lng1 = rand_f64(minLng, maxLng);
-            f64 lat1 = rand_f64(minLat, maxLat);
-            char commaChr = (isLastCluster && isLastPair) ? ' ' : ',';
-            f64 dist = referenceHaversineDistance(lng0, lat0, lng1, lat1, EARTH_RAD);
-            jsonBuff += snprintf(jsonBuff, 128, "  {\"lng0\":%21.16f,\"lat0\":%21.16f,\"lng1\":%21.16f,\"lat1\":%21.16f}%c\n", lng0, lat0, lng1, lat1, commaChr);
-            distBuff[pairIdx] = dist;
-            accum += (accumCoef * dist);
-        }
-        fwrite(jsonBuffStart, jsonBuff-jsonBuffStart, 1, jsonF);
-        free(jsonBuffStart);
-        fwrite(distBuff, sizeof(f64), clusterPairCount, distF);
-        free(distBuff);
-    }
-    fprintf(jsonF, "]}\n");
+        for (u32 road = 0; road < COORD_ROAD_COUNT; road++) {
+            shared.clusters[clusterIdx].roadAngles[road] = xoshiro_randF64(&rng, 0.0, M_PI);
+        }
+    }
+
+    // Both outputs are written front to back by the writer thread into space reserved up front. The JSON
+    // reservation assumes the longest lines and is trimmed at the end.
+    FILE* jsonF = NULL;
+    PairsBinWriter binWriter = { 0 };
+    if (isBin) {
+        pairsBin_openWriter(&binWriter, binFilename, pairCount);
+    } else {
+        jsonF = fopen(jsonFilename, "wb");
+        if (jsonF == NULL) {
+            fprintf(stderr, "ERROR: Failed to open %s for writing\n", jsonFilename);
+            exit(1);
+        }
+        fileReserve(jsonF, strlen(jsonHeader) + pairCount * jsonLineMax + strlen(jsonFooter));
+        fputs(jsonHeader, jsonF);
+    }
+    FILE* distF = fopen(distFilename, "wb");
+    if (distF == NULL) {
+        fprintf(stderr, "ERROR: Failed to open %s for writing\n", distFilename);
+        exit(1);
+    }
+    fileReserve(distF, (pairCount + 1) * sizeof(f64));
+
+    threadCount = (u32) MAX(1, MIN(threadCount, shared.chunkCount));
+    shared.slotCount = threadCount + COORD_EXTRA_SLOTS;
+    CoordSlot* slots = calloc(shared.slotCount, sizeof(CoordSlot));
+    shared.ready = calloc(shared.slotCount, sizeof(*shared.ready));
+    CoordWorker* workers = calloc(threadCount, sizeof(CoordWorker));
+    ThreadHandle* threads = malloc(threadCount * sizeof(ThreadHandle));
+    if (slots == NULL || shared.ready == NULL || workers == NULL || threads == NULL) {
+        fprintf(stderr, "ERROR: Memory alloc failed for %u workers\n", threadCount);
+        exit(1);
+    }
+    workQueue_init(&shared.freeSlots, shared.slotCount);
+    for (u64 slotIdx = 0; slotIdx < shared.slotCount; slotIdx++) {
+        CoordSlot* slot = &slots[slotIdx];
+        slot->dists = malloc(COORD_CHUNK_PAIRS * sizeof(f64));
+        if (isBin) {
+            slot->pairs.lng0 = malloc(COORD_CHUNK_PAIRS * sizeof(f64));
+            slot->pairs.lat0 = malloc(COORD_CHUNK_PAIRS * sizeof(f64));
+            slot->pairs.lng1 = malloc(COORD_CHUNK_PAIRS * sizeof(f64));
+            slot->pairs.lat1 = malloc(COORD_CHUNK_PAIRS * sizeof(f64));
+            slot->pairs.capacity = COORD_CHUNK_PAIRS;
+        } else {
+            slot->json = malloc(jsonBuffBytes);
+        }
+        bool hasBinColumns = slot->pairs.lng0 != NULL && slot->pairs.lat0 != NULL && slot->pairs.lng1 != NULL && slot->pairs.lat1 != NULL;
+        if (slot->dists == NULL || (isBin ? !hasBinColumns : slot->json == NULL)) {
+            fprintf(stderr, "ERROR: Memory alloc failed for %llu chunk buffers\n", shared.slotCount);
+            exit(1);
+        }
+        atomic_init(&shared.ready[slotIdx], NULL);
+        workQueue_tryPush(&shared.freeSlots, slot);
+    }
+    atomic_init(&shared.nextChunk, 0);
+
+    CoordWriter writer = { 0 };
+    writer.shared = &shared;
+    writer.jsonF = jsonF;
+    writer.distF = distF;
+    writer.binWriter = &binWriter;
+    ThreadHandle writerThread = thread_start(coord_writerMain, &writer);
+    for (u32 w = 0; w < threadCount; w++) {
+        workers[w].shared = &shared;
+    }
+    // The calling thread works too
+    for (u32 w = 1; w < threadCount; w++) {
+        threads[w] = thread_start(coord_workerMain, &workers[w]);
+    }
+    coord_workerMain(&workers[0]);
+    for (u32 w = 1; w < threadCount; w++) {
+        thread_join(&threads[w]);
+    }
+    thread_join(&writerThread);
+
+    f64 accum = pairCount > 0 ? neumaier_result(writer.total) / (f64) pairCount : 0.0;
     fwrite(&accum, sizeof(accum), 1, distF);
     fclose(distF);
-    fclose(jsonF);
+    if (isBin) {
+        pairsBin_closeWriter(&binWriter);
+    } else {
+        fputs(jsonFooter, jsonF);
+        u64 jsonSize = strlen(jsonHeader) + writer.jsonBytes + strlen(jsonFooter);
+        if (!fileTrim(jsonF, jsonSize)) {
+            fprintf(stderr, "WARNING: Failed to trim %s to %llu bytes\n", jsonFilename, jsonSize);
+        }
+        fclose(jsonF);
+    }
+    for (u64 slotIdx = 0; slotIdx < shared.slotCount; slotIdx++) {
+        free(slots[slotIdx].dists);
+        free(slots[slotIdx].json);
+        pairs_free(&slots[slotIdx].pairs);
+    }
+    workQueue_free(&shared.freeSlots);
+    free(slots);
+    free((void*) shared.ready);
+    free(threads);
+    free(workers);
+    free(shared.chunkStates);
+    free(shared.clusters);
 
     clock_gettime(CLOCK_MONOTONIC, &end);
     f64 elapsed = getElapsedMillis(start, end);
 
     fflush(stdout);
     fflush(stderr);
+    printf("THREADS: %u workers and a writer, %llu chunks of %d pairs\n", threadCount, shared.chunkCount, COORD_CHUNK_PAIRS);
+    printf("BUFFERS: %llu of %.1f MB, writer waited on %llu chunks\n", shared.slotCount,
+        (f64) (isBin ? COORD_CHUNK_PAIRS * 5 * sizeof(f64) : jsonBuffBytes + COORD_CHUNK_PAIRS * sizeof(f64)) / (1024.0 * 1024.0), writer.stallCount);
     printf("ELAPSED: %.3f ms\n", elapsed);
     printf("AVG DISTANCE: %.4f\n", accum);
     fflush(stdout);
@@ -0,0 +1,282 @@
+//
+// Created by stevehb on 19-Oct-26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "common_funcs.h"
+#include "coord_shape.h"
+#include "number_format.h"
+
+#define SHAPE_NUMBER_MAX_LEN 32
+#define SHAPE_VALUE_MAX_LEN 48      // Widest extra value, the array of three u32
+#define SHAPE_FIELD_OVERHEAD 26     // Separator, quoted key of up to 9 characters and the colon with its padding
+#define SHAPE_LINE_OVERHEAD 32      // Braces, trailing comma and newlines around the fields
+#define SHAPE_ESCAPE_EVERY 32
+#define SHAPE_COORD_FIELDS 4
+#define SHAPE_EXTRA_TYPES 6
+#define SHAPE_MAX_FIELDS (SHAPE_COORD_FIELDS + SHAPE_MAX_EXTRA + 2)
+
+static const char* SHAPE_COORD_NAMES[SHAPE_COORD_FIELDS] = { "lng0", "lat0", "lng1", "lat1" };
+// One name per extra type, in the order the types cycle
+static const char* SHAPE_EXTRA_NAMES[SHAPE_EXTRA_TYPES] = { "id", "weight", "active", "parent", "tag", "offsets" };
+static const char SHAPE_STR_CHARS[65] = "abcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789.";
+static const char* SHAPE_STR_ESCAPES[] = { "\\\"", "\\\\", "\\n", "\\t", "\\/", "\\u00e9" };
+
+typedef enum {
+    SHAPE_FIELD_COORD,
+    SHAPE_FIELD_EXTRA,
+    SHAPE_FIELD_LONG_STR,
+    SHAPE_FIELD_NEST,
+} ShapeFieldKind;
+
+typedef struct {
+    ShapeFieldKind kind;
+    u32 index;
+} ShapeField;
+
+static u64 shape_mix(u64 x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return x;
+}
+static u64 shape_next(u64* state) {
+    *state += 0x9E3779B97F4A7C15ull;
+    return shape_mix(*state);
+}
+
+static u32 shape_parseEnum(int argc, char** argv, const char* name, const char** strs, u32 count, u32 defaultValue) {
+    char buff[32] = { 0 };
+    if (!getParamValue_namedStr(argc, argv, name, buff, sizeof(buff))) return defaultValue;
+    for (u32 i = 0; i < count; i++) {
+        if (strcmp(buff, strs[i]) == 0) return i;
+    }
+    fprintf(stderr, "ERROR: Unknown %s '%s', expected", name, buff);
+    for (u32 i = 0; i < count; i++) {
+        fprintf(stderr, "%s %s", i == 0 ? "" : (i + 1 == count ? " or" : ","), strs[i]);
+    }
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+CoordShape shape_fromArgs(int argc, char** argv, u32 seed) {
+    CoordShape shape = { 0 };
+    shape.seed = seed;
+    shape.layout = shape_parseEnum(argc, argv, "-layout", SHAPE_LAYOUT_STRS, SHAPE_LAYOUT_COUNT, SHAPE_LAYOUT_PRETTY);
+    shape.numbers = shape_parseEnum(argc, argv, "-numbers", SHAPE_NUMBERS_STRS, SHAPE_NUMBERS_COUNT, SHAPE_NUMBERS_FIXED);
+    shape.isShuffled = getParamFlag(argc, argv, "-shuffle");
+    getParamValue_u32(argc, argv, "-extra", &shape.extraCount);
+    getParamValue_u32(argc, argv, "-longstr", &shape.longStrLen);
+    getParamValue_u32(argc, argv, "-nest", &shape.nestDepth);
+    if (shape.extraCount > SHAPE_MAX_EXTRA) {
+        fprintf(stderr, "ERROR: -extra %u is more than the %d extra fields supported\n", shape.extraCount, SHAPE_MAX_EXTRA);
+        exit(1);
+    }
+    if (shape.longStrLen > SHAPE_MAX_LONG_STR) {
+        fprintf(stderr, "ERROR: -longstr %u is longer than the %d characters supported\n", shape.longStrLen, SHAPE_MAX_LONG_STR);
+        exit(1);
+    }
+    if (shape.nestDepth > SHAPE_MAX_NEST) {
+        fprintf(stderr, "ERROR: -nest %u is deeper than the %d levels supported\n", shape.nestDepth, SHAPE_MAX_NEST);
+        exit(1);
+    }
+    return shape;
+}
+
+bool shape_isDefault(const CoordShape* shape) {
+    return shape->layout == SHAPE_LAYOUT_PRETTY && shape->numbers == SHAPE_NUMBERS_FIXED && !shape->isShuffled
+        && shape->extraCount == 0 && shape->longStrLen == 0 && shape->nestDepth == 0;
+}
+
+static void shape_labelPart(char* buff, u32 buffSize, const char* fmt, u32 value) {
+    u64 len = strlen(buff);
+    if (len + 1 >= buffSize) return;
+    if (len > 0) {
+        buff[len++] = '-';
+        buff[len] = '\0';
+    }
+    snprintf(buff + len, buffSize - len, fmt, value);
+}
+
+void shape_label(const CoordShape* shape, char* buff, u32 buffSize) {
+    buff[0] = '\0';
+    if (shape->layout != SHAPE_LAYOUT_PRETTY) shape_labelPart(buff, buffSize, SHAPE_LAYOUT_STRS[shape->layout], 0);
+    if (shape->numbers != SHAPE_NUMBERS_FIXED) shape_labelPart(buff, buffSize, SHAPE_NUMBERS_STRS[shape->numbers], 0);
+    if (shape->isShuffled) shape_labelPart(buff, buffSize, "shuffled", 0);
+    if (shape->extraCount > 0) shape_labelPart(buff, buffSize, "extra%u", shape->extraCount);
+    if (shape->longStrLen > 0) shape_labelPart(buff, buffSize, "str%u", shape->longStrLen);
+    if (shape->nestDepth > 0) shape_labelPart(buff, buffSize, "nest%u", shape->nestDepth);
+}
+
+u64 shape_lineMax(const CoordShape* shape) {
+    u64 fieldCount = SHAPE_COORD_FIELDS + shape->extraCount + (shape->longStrLen > 0) + (shape->nestDepth > 0);
+    u64 lineMax = SHAPE_LINE_OVERHEAD + fieldCount * (SHAPE_FIELD_OVERHEAD + SHAPE_VALUE_MAX_LEN);
+    lineMax += shape->longStrLen + 8;  // The last escape can run 6 past the length
+    lineMax += (u64) shape->nestDepth * SHAPE_FIELD_OVERHEAD;
+    return lineMax;
+}
+
+const char* shape_header(const CoordShape* shape) {
+    switch (shape->layout) {
+        case SHAPE_LAYOUT_MIN: return "{\"pairs\":[";
+        case SHAPE_LAYOUT_PADDED: return "{\n    \"pairs\" : [\n";
+        default: return "{\"pairs\":[\n";
+    }
+}
+
+const char* shape_footer(const CoordShape* shape) {
+    switch (shape->layout) {
+        case SHAPE_LAYOUT_MIN: return "]}";
+        case SHAPE_LAYOUT_PADDED: return "    ]\n}\n";
+        default: return "]}\n";
+    }
+}
+
+static char* shape_putStr(char* p, const char* str) {
+    u64 len = strlen(str);
+    memcpy(p, str, len);
+    return p + len;
+}
+
+static char* shape_putKey(const CoordShape* shape, char* p, const char* name, u32 suffix) {
+    *p++ = '"';
+    p = shape_putStr(p, name);
+    if (suffix > 0) {
+        p += sprintf(p, "%u", suffix);
+    }
+    *p++ = '"';
+    return shape_putStr(p, shape->layout == SHAPE_LAYOUT_PADDED ? " : " : ":");
+}
+
+static char* shape_putNumber(const CoordShape* shape, char* p, f64 value) {
+    switch (shape->numbers) {
+        case SHAPE_NUMBERS_SHORTEST: {
+            // Fewest significant digits that read back as the same double
+            int len = 0;
+            for (int precision = 15; precision <= 17; precision++) {
+                len = snprintf(p, SHAPE_NUMBER_MAX_LEN, "%.*g", precision, value);
+                if (strtod(p, NULL) == value) break;
+            }
+            return p + len;
+        }
+        case SHAPE_NUMBERS_EXP:
+            return p + snprintf(p, SHAPE_NUMBER_MAX_LEN, "%.16e", value);
+        default:
+            return p + format_f64Fixed16(p, value, shape->layout == SHAPE_LAYOUT_MIN ? 0 : 21);
+    }
+}
+
+static char* shape_putExtra(const CoordShape* shape, char* p, u32 extraIdx, u64 pairIdx, u64* hash) {
+    u32 type = extraIdx % SHAPE_EXTRA_TYPES;
+    p = shape_putKey(shape, p, SHAPE_EXTRA_NAMES[type], extraIdx / SHAPE_EXTRA_TYPES);
+    u64 bits = shape_next(hash);
+    switch (type) {
+        case 0: return p + sprintf(p, "%llu", pairIdx);
+        case 1: return shape_putNumber(shape, p, (f64) (bits >> 11) * 0x1.0p-53 * 2000.0 - 1000.0);
+        case 2: return shape_putStr(p, (bits & 1) ? "true" : "false");
+        case 3: return shape_putStr(p, "null");
+        case 4: return p + sprintf(p, "\"tag-%08x\"", (u32) bits);
+        default: {
+            const char* sep = shape->layout == SHAPE_LAYOUT_PADDED ? ", " : ",";
+            return p + sprintf(p, "[%u%s%u%s%u]", (u32) bits, sep, (u32) (bits >> 32), sep, (u32) (bits >> 48));
+        }
+    }
+}
+
+static char* shape_putLongStr(const CoordShape* shape, char* p, u64* hash) {
+    p = shape_putKey(shape, p, "note", 0);
+    *p++ = '"';
+    char* start = p;
+    u64 bits = 0;
+    for (u32 i = 0; (u32) (p - start) < shape->longStrLen; i++) {
+        if (i % 8 == 0) {
+            bits = shape_next(hash);
+        }
+        u32 pick = (u32) (bits >> ((i % 8) * 8)) & 0xFF;
+        if (i % SHAPE_ESCAPE_EVERY == SHAPE_ESCAPE_EVERY - 1) {
+            p = shape_putStr(p, SHAPE_STR_ESCAPES[pick % (sizeof(SHAPE_STR_ESCAPES) / sizeof(SHAPE_STR_ESCAPES[0]))]);
+        } else {
+            *p++ = SHAPE_STR_CHARS[pick & 63];
+        }
+    }
+    *p++ = '"';
+    return p;
+}
+
+static char* shape_putNest(const CoordShape* shape, char* p) {
+    bool isPadded = shape->layout == SHAPE_LAYOUT_PADDED;
+    p = shape_putKey(shape, p, "meta", 0);
+    for (u32 level = 1; level < shape->nestDepth; level++) {
+        p = shape_putStr(p, isPadded ? "{ " : "{");
+        p = shape_putKey(shape, p, "child", 0);
+    }
+    p = shape_putStr(p, isPadded ? "{ " : "{");
+    p = shape_putKey(shape, p, "depth", 0);
+    p += sprintf(p, "%u", shape->nestDepth);
+    for (u32 level = 0; level < shape->nestDepth; level++) {
+        p = shape_putStr(p, isPadded ? " }" : "}");
+    }
+    return p;
+}
+
+u32 shape_formatPair(const CoordShape* shape, char* out, u64 pairIdx, f64 lng0, f64 lat0, f64 lng1, f64 lat1, bool isLast) {
+    const f64 coords[SHAPE_COORD_FIELDS] = { lng0, lat0, lng1, lat1 };
+    u64 hash = shape_mix(((u64) shape->seed << 32) ^ pairIdx);
+
+    ShapeField fields[SHAPE_MAX_FIELDS];
+    u32 fieldCount = 0;
+    for (u32 i = 0; i < SHAPE_COORD_FIELDS; i++) {
+        fields[fieldCount++] = (ShapeField) { SHAPE_FIELD_COORD, i };
+    }
+    for (u32 i = 0; i < shape->extraCount; i++) {
+        fields[fieldCount++] = (ShapeField) { SHAPE_FIELD_EXTRA, i };
+    }
+    if (shape->longStrLen > 0) {
+        fields[fieldCount++] = (ShapeField) { SHAPE_FIELD_LONG_STR, 0 };
+    }
+    if (shape->nestDepth > 0) {
+        fields[fieldCount++] = (ShapeField) { SHAPE_FIELD_NEST, 0 };
+    }
+    if (shape->isShuffled) {
+        for (u32 i = fieldCount - 1; i > 0; i--) {
+            u32 j = (u32) (shape_next(&hash) % (i + 1));
+            ShapeField tmp = fields[i];
+            fields[i] = fields[j];
+            fields[j] = tmp;
+        }
+    }
+
+    const char* fieldSep = ",";
+    char* p = out;
+    switch (shape->layout) {
+        case SHAPE_LAYOUT_MIN: p = shape_putStr(p, "{"); break;
+        case SHAPE_LAYOUT_PADDED: p = shape_putStr(p, "    {\n        "); fieldSep = ",\n        "; break;
+        default: p = shape_putStr(p, "  {"); break;
+    }
+    for (u32 i = 0; i < fieldCount; i++) {
+        if (i > 0) {
+            p = shape_putStr(p, fieldSep);
+        }
+        switch (fields[i].kind) {
+            case SHAPE_FIELD_COORD:
+                p = shape_putKey(shape, p, SHAPE_COORD_NAMES[fields[i].index], 0);
+                p = shape_putNumber(shape, p, coords[fields[i].index]);
+                break;
+            case SHAPE_FIELD_EXTRA: p = shape_putExtra(shape, p, fields[i].index, pairIdx, &hash); break;
+            case SHAPE_FIELD_LONG_STR: p = shape_putLongStr(shape, p, &hash); break;
+            case SHAPE_FIELD_NEST: p = shape_putNest(shape, p); break;
+        }
+    }
+    switch (shape->layout) {
+        case SHAPE_LAYOUT_MIN: p = shape_putStr(p, isLast ? "}" : "},"); break;
+        case SHAPE_LAYOUT_PADDED: p = shape_putStr(p, isLast ? "\n    }\n" : "\n    },\n"); break;
+        default: p = shape_putStr(p, isLast ? "} \n" : "},\n"); break;
+    }
+    return (u32) (p - out);
+}
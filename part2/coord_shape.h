@@ -0,0 +1,76 @@
+//
+// Created by stevehb on 19-Oct-26.
+//
+
+#ifndef COORD_SHAPE_H
+#define COORD_SHAPE_H
+
+#include <stdbool.h>
+
+#include "types.h"
+
+#define SHAPE_LAYOUTS(X) \
+    X(SHAPE_LAYOUT_PRETTY, "pretty") \
+    X(SHAPE_LAYOUT_MIN, "min") \
+    X(SHAPE_LAYOUT_PADDED, "padded")
+
+#define SHAPE_NUMBER_STYLES(X) \
+    X(SHAPE_NUMBERS_FIXED, "fixed") \
+    X(SHAPE_NUMBERS_SHORTEST, "shortest") \
+    X(SHAPE_NUMBERS_EXP, "exp")
+
+#define ENUM_ENTRY(name, str) name,
+typedef enum {
+    SHAPE_LAYOUTS(ENUM_ENTRY)
+    SHAPE_LAYOUT_COUNT
+} ShapeLayout;
+typedef enum {
+    SHAPE_NUMBER_STYLES(ENUM_ENTRY)
+    SHAPE_NUMBERS_COUNT
+} ShapeNumbers;
+#undef ENUM_ENTRY
+#define STRING_ENTRY(name, str) str,
+static const char* SHAPE_LAYOUT_STRS[] = {
+    SHAPE_LAYOUTS(STRING_ENTRY)
+};
+static const char* SHAPE_NUMBERS_STRS[] = {
+    SHAPE_NUMBER_STYLES(STRING_ENTRY)
+};
+#undef STRING_ENTRY
+#undef SHAPE_LAYOUTS
+#undef SHAPE_NUMBER_STYLES
+
+#define SHAPE_MAX_EXTRA 16
+// Every character of a chunk's worth of lines sits in one buffer, so the string can't grow without bound
+#define SHAPE_MAX_LONG_STR 1024
+// Root, pairs array and pair object come on top, which keeps the total well inside JSON_STREAM_MAX_DEPTH
+#define SHAPE_MAX_NEST 32
+#define SHAPE_LABEL_LEN 96
+
+/// How the pair lines of a generated file are written. The coordinates and distances never depend on it,
+/// so every shape of the same seed shares one set of answers.
+typedef struct {
+    ShapeLayout layout;
+    ShapeNumbers numbers;
+    bool isShuffled;    // Key order drawn per pair
+    u32 extraCount;     // Unused fields of mixed types per pair
+    u32 longStrLen;     // Length of an unused string with escapes, 0 for none
+    u32 nestDepth;      // Depth of an unused nested object, 0 for none
+    u32 seed;
+} CoordShape;
+
+/// Reads -layout, -numbers, -shuffle, -extra, -longstr and -nest, exiting on anything out of range
+CoordShape shape_fromArgs(int argc, char** argv, u32 seed);
+/// True for the original format: pretty lines, %21.16f numbers and nothing but the four coordinates
+bool shape_isDefault(const CoordShape* shape);
+/// Short name for the filename, empty for the default shape
+void shape_label(const CoordShape* shape, char* buff, u32 buffSize);
+/// Upper bound on the bytes shape_formatPair writes for one pair
+u64 shape_lineMax(const CoordShape* shape);
+const char* shape_header(const CoordShape* shape);
+const char* shape_footer(const CoordShape* shape);
+/// Writes the line for pair `pairIdx` and returns its length. Everything but the coordinates comes from a hash
+/// of the seed and index, so a line is the same whichever thread writes it.
+u32 shape_formatPair(const CoordShape* shape, char* out, u64 pairIdx, f64 lng0, f64 lat0, f64 lng1, f64 lat1, bool isLast);
+
+#endif //COORD_SHAPE_H
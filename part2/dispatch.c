@@ -0,0 +1,112 @@
+//
+// Created by stevehb on 19-Oct-26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+#include "types.h"
+#include "dispatch.h"
+#include "kernels.h"
+
+static const DispatchTable DISPATCH_TABLES[ISA_COUNT] = {
+    [ISA_SSE2] = { ISA_SSE2, kernel_haversine_sse2, kernel_haversine32_sse2, kernel_haversineApprox_sse2, kernel_scanWhitespace_sse2, kernel_scanStringEnd_sse2, kernel_scanNumber_sse2 },
+    [ISA_AVX2] = { ISA_AVX2, kernel_haversine_avx2, kernel_haversine32_avx2, kernel_haversineApprox_avx2, kernel_scanWhitespace_avx2, kernel_scanStringEnd_avx2, kernel_scanNumber_avx2 },
+    [ISA_AVX512] = { ISA_AVX512, kernel_haversine_avx512, kernel_haversine32_avx512, kernel_haversineApprox_avx512, kernel_scanWhitespace_avx512, kernel_scanStringEnd_avx512, kernel_scanNumber_avx512 },
+};
+
+DispatchTable dispatch = { ISA_SSE2, kernel_haversine_sse2, kernel_haversine32_sse2, kernel_haversineApprox_sse2, kernel_scanWhitespace_sse2, kernel_scanStringEnd_sse2, kernel_scanNumber_sse2 };
+
+static struct {
+    bool isDetected;
+    bool supported[ISA_COUNT];
+} dispatchFeatures;
+
+static void dispatch_cpuid(u32 leaf, u32 subleaf, u32 regs[4]) {
+#ifdef _MSC_VER
+    __cpuidex((int*) regs, (int) leaf, (int) subleaf);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+static u64 dispatch_xgetbv(u32 index) {
+#ifdef _MSC_VER
+    return _xgetbv(index);
+#else
+    u32 lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(index));
+    return ((u64) hi << 32) | lo;
+#endif
+}
+
+static void dispatch_detect(void) {
+    if (dispatchFeatures.isDetected) return;
+    dispatchFeatures.isDetected = true;
+    dispatchFeatures.supported[ISA_SSE2] = true;  // Baseline for x86-64
+
+    u32 regs[4] = { 0 };
+    dispatch_cpuid(0, 0, regs);
+    u32 maxLeaf = regs[0];
+    dispatch_cpuid(1, 0, regs);
+    bool hasOsxsave = (regs[2] >> 27) & 1;
+    bool hasAvx = (regs[2] >> 28) & 1;
+    bool hasFma = (regs[2] >> 12) & 1;
+    if (!hasOsxsave || !hasAvx || maxLeaf < 7) return;
+
+    // The OS has to save the wider register state too, not just the CPU support it
+    u64 xcr0 = dispatch_xgetbv(0);
+    bool osYmm = (xcr0 & 0x6) == 0x6;
+    bool osZmm = (xcr0 & 0xE6) == 0xE6;
+    dispatch_cpuid(7, 0, regs);
+    bool hasAvx2 = (regs[1] >> 5) & 1;
+    bool hasAvx512f = (regs[1] >> 16) & 1;
+    bool hasAvx512dq = (regs[1] >> 17) & 1;
+    bool hasAvx512bw = (regs[1] >> 30) & 1;
+    dispatchFeatures.supported[ISA_AVX2] = osYmm && hasAvx2 && hasFma;
+    dispatchFeatures.supported[ISA_AVX512] = dispatchFeatures.supported[ISA_AVX2] && osZmm && hasAvx512f && hasAvx512dq && hasAvx512bw;
+}
+
+bool dispatch_isSupported(IsaLevel level) {
+    dispatch_detect();
+    return level < ISA_COUNT && dispatchFeatures.supported[level];
+}
+
+void dispatch_init(const char* isaName) {
+    dispatch_detect();
+    IsaLevel level = ISA_SSE2;
+    if (isaName == NULL || strcmp(isaName, "auto") == 0) {
+        for (u32 i = 0; i < ISA_COUNT; i++) {
+            if (dispatchFeatures.supported[i]) level = i;
+        }
+    } else {
+        level = ISA_COUNT;
+        for (u32 i = 0; i < ISA_COUNT; i++) {
+            if (strcmp(isaName, ISA_STRS[i]) == 0) level = i;
+        }
+        if (level == ISA_COUNT) {
+            fprintf(stderr, "ERROR: Unknown ISA '%s', expected sse2, avx2, avx512 or auto\n", isaName);
+            exit(1);
+        }
+        if (!dispatchFeatures.supported[level]) {
+            fprintf(stderr, "ERROR: ISA '%s' is not supported on this CPU\n", isaName);
+            exit(1);
+        }
+    }
+    dispatch = DISPATCH_TABLES[level];
+}
+
+void dispatch_printFeatures(void) {
+    dispatch_detect();
+    printf("ISA: using %s (supported:", ISA_STRS[dispatch.level]);
+    for (u32 i = 0; i < ISA_COUNT; i++) {
+        if (dispatchFeatures.supported[i]) printf(" %s", ISA_STRS[i]);
+    }
+    printf(")\n");
+}
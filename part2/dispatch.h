@@ -0,0 +1,55 @@
+//
+// Created by stevehb on 19-Oct-26.
+//
+
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include <stdbool.h>
+
+#include "types.h"
+
+#define ISA_LEVELS(X) \
+    X(ISA_SSE2, "sse2") \
+    X(ISA_AVX2, "avx2") \
+    X(ISA_AVX512, "avx512")
+
+#define ENUM_ENTRY(name, str) name,
+typedef enum {
+    ISA_LEVELS(ENUM_ENTRY)
+    ISA_COUNT
+} IsaLevel;
+#undef ENUM_ENTRY
+#define STRING_ENTRY(name, str) str,
+static const char* ISA_STRS[] = {
+    ISA_LEVELS(STRING_ENTRY)
+};
+#undef STRING_ENTRY
+#undef ISA_LEVELS
+
+typedef void (*HaversineKernel)(const f64* lng0, const f64* lat0, const f64* lng1, const f64* lat1, f64* out, u64 count);
+typedef void (*Haversine32Kernel)(const f32* lng0, const f32* lat0, const f32* lng1, const f32* lat1, f32* out, u64 count);
+typedef u64 (*HaversineApproxKernel)(const f64* lng0, const f64* lat0, const f64* lng1, const f64* lat1, f64* out, u64 count, f64 tolerance);
+typedef u64 (*ScanKernel)(const char* data, u64 len);
+
+/// Hot kernels for the selected ISA. Starts out on the SSE2 variants so callers work before dispatch_init.
+typedef struct DispatchTable {
+    IsaLevel level;
+    // Polynomial f64 kernel, only behind -fast: its error grows towards antipodal pairs, see haversine_fastErrorBound.
+    // Everything that is summed or checked against an answer file goes through haversine_reference instead.
+    HaversineKernel haversineFast;
+    Haversine32Kernel haversine32;
+    HaversineApproxKernel haversineApprox;  // Returns how many pairs needed the full formula for the tolerance in km
+    ScanKernel scanWhitespace;  // Length of the leading run of ' ', '\t', '\r', '\n'
+    ScanKernel scanStringEnd;   // Index of the first '"' or '\\', or len
+    ScanKernel scanNumber;      // Length of the leading run of number characters
+} DispatchTable;
+
+extern DispatchTable dispatch;
+
+bool dispatch_isSupported(IsaLevel level);
+/// Picks the best supported ISA, or `isaName` when it is not NULL. Exits if the forced ISA is unknown or unsupported.
+void dispatch_init(const char* isaName);
+void dispatch_printFeatures(void);
+
+#endif //DISPATCH_H
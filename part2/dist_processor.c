@@ -10,9 +10,578 @@
 #include <time.h>
 
 #include "types.h"
+#include "batch.h"
 #include "common_funcs.h"
+#include "dispatch.h"
+#include "haversine.h"
+#include "incremental.h"
 #include "json_parser.h"
+#include "pairs_bin.h"
+#include "spatial_index.h"
 #include "tempo.h"
+#include "validate.h"
+#include "work_queue.h"
+
+// Shortest possible pair object is `{"lng0":0,"lat0":0,"lng1":0,"lat1":0}`, so this bounds the pair count by file size
+#define PIPELINE_MIN_PAIR_BYTES 32
+#define PIPELINE_SPIN_LIMIT 64
+// Fused mode computes and validates in small batches so it can use the vectorized kernels and still keep O(1) memory.
+// Divides the sum block, so the block partials are unchanged.
+#define FUSED_VALIDATE_PAIRS 1024
+// Radius queries timed against brute force for the benchmark, centred on evenly spaced endpoints
+#define SPATIAL_BENCH_QUERIES 64
+#define SPATIAL_PRINT_PAIRS 10
+
+typedef struct {
+    const f64* knownDists;
+    u64 knownCount;
+    u64 pairsProcessed;
+    BlockedSum sum;
+    PairArrays pending;
+    f64 pendingDists[FUSED_VALIDATE_PAIRS];
+    f64* outDists;  // Mapped -out file, NULL when not writing one
+    u64 outCapacity;
+    HaversineKernel kernel;
+    f64 maxDist;
+    ValidateReport report;
+} FusedState;
+
+typedef struct {
+    u64 batchSize;
+    u64 queueDepth;
+    u32 workerCount;
+    HaversineKernel kernel;
+} PipelineConfig;
+
+typedef struct {
+    u64 firstPairIdx;
+    PairArrays pairs;
+    f64* dists;
+} PairBatch;
+
+typedef struct {
+    WorkQueue* fullQueue;
+    WorkQueue* freeQueue;
+    NeumaierSum* blockSums;
+    const f64* knownDists;
+    f64* outDists;
+    HaversineKernel kernel;
+    f64 maxDist;
+    ValidateReport report;
+    u32 workerIdx;
+    u64 pairCount;
+    u64 busyTicks, stallTicks;
+} PipelineWorker;
+
+typedef struct {
+    WorkQueue* fullQueue;
+    WorkQueue* freeQueue;
+    PairBatch* current;
+    u64 batchSize;
+    u64 nextPairIdx;
+    u64 maxPairs;
+    u64 knownCount;
+    bool hasKnown;
+    u64 stallTicks;
+} PipelineProducer;
+
+static void dist_checkKnownCount(u64 pairCount, u64 knownCount) {
+    if (pairCount > knownCount) {
+        fprintf(stderr, "ERROR: Distance file has fewer entries (%llu) than the JSON has pairs\n", knownCount);
+        exit(1);
+    }
+}
+
+static u64 dist_maxPairsForSize(u64 fileSize) {
+    return fileSize / PIPELINE_MIN_PAIR_BYTES + 1;
+}
+
+static void dist_flushFused(FusedState* fused) {
+    PairArrays* pending = &fused->pending;
+    u64 count = pending->count;
+    if (count == 0) return;
+    u64 firstPairIdx = fused->pairsProcessed - count;
+    // With -out the kernel writes straight into the mapped file
+    f64* dists = fused->outDists != NULL ? fused->outDists + firstPairIdx : fused->pendingDists;
+    fused->kernel(pending->lng0, pending->lat0, pending->lng1, pending->lat1, dists, count);
+    for (u64 i = 0; i < count; i++) {
+        blockedSum_add(&fused->sum, dists[i]);
+        fused->maxDist = MAX(fused->maxDist, dists[i]);
+    }
+    if (fused->knownDists != NULL) {
+        dist_checkKnownCount(fused->pairsProcessed, fused->knownCount);
+        validate_range(&fused->report, pending, dists, fused->knownDists + firstPairIdx,
+            0, count, firstPairIdx);
+    }
+    pending->count = 0;
+}
+
+static void dist_onFusedPair(void* ctx, f64 lng0, f64 lat0, f64 lng1, f64 lat1) {
+    FusedState* fused = ctx;
+    if (fused->outDists != NULL && fused->pairsProcessed >= fused->outCapacity) {
+        fprintf(stderr, "ERROR: More pairs than the file size allows (%llu)\n", fused->outCapacity);
+        exit(1);
+    }
+    fused->pairsProcessed++;
+    pairs_append(&fused->pending, lng0, lat0, lng1, lat1);
+    if (fused->pending.count == FUSED_VALIDATE_PAIRS) {
+        dist_flushFused(fused);
+    }
+}
+
+static PairArrays dist_gatherPairs(JsonFile* jsonFile) {
+    bool isInPairs = false;
+    u64 pairsArrayIdx = 0;
+    f64 lng0 = NAN, lat0 = NAN, lng1 = NAN, lat1 = NAN;
+    u64 totalPairsCount = 0;
+    PairArrays pairs = { 0 };
+    tempo_startBlock("dist_gather");
+    for (u64 i = 0; i < jsonFile->elementCount; i++) {
+        JsonElement el = jsonFile->elements[i];
+        if (el.type == JSON_ARRAY_BEGIN && !isInPairs && strcmp(jsonFile->stringBuff + el.nameOffset, "pairs") == 0) {
+            isInPairs = true;
+            pairsArrayIdx = i;
+            totalPairsCount = el.container.childCount;
+            continue;
+        }
+        if (el.type == JSON_ARRAY_END && isInPairs && el.container.startIdx == pairsArrayIdx) {
+            isInPairs = false;
+            continue;
+        }
+        if (!isInPairs) continue;
+        // Only fields of the objects directly in the pairs array count, nested extras are skipped
+        bool isPairField = jsonFile->elements[el.parentElementIdx].parentElementIdx == pairsArrayIdx;
+        if (el.type == JSON_NUMBER && isPairField) {
+            if (strcmp(jsonFile->stringBuff + el.nameOffset, "lng0") == 0) {
+                lng0 = el.number.value;
+            } else if (strcmp(jsonFile->stringBuff + el.nameOffset, "lat0") == 0) {
+                lat0 = el.number.value;
+            } else if (strcmp(jsonFile->stringBuff + el.nameOffset, "lng1") == 0) {
+                lng1 = el.number.value;
+            } else if (strcmp(jsonFile->stringBuff + el.nameOffset, "lat1") == 0) {
+                lat1 = el.number.value;
+            }
+            continue;
+        }
+        if (el.type == JSON_OBJECT_END && el.parentElementIdx == pairsArrayIdx) {
+            if (isnan(lng0) || isnan(lat0) || isnan(lng1) || isnan(lat1)) {
+                fprintf(stderr, "ERROR: Missing numbers for pair %llu: (lng0=%.f,lat0=%f), (lng1=%f,lat1=%f)\n", pairs.count, lng0, lat0, lng1, lat1);
+                exit(1);
+            }
+            pairs_append(&pairs, lng0, lat0, lng1, lat1);
+            lng0 = lat0 = lng1 = lat1 = NAN;
+        }
+    }
+    tempo_countItems(pairs.count);
+    tempo_stopBlock("dist_gather");
+    if (pairs.count != totalPairsCount) {
+        fprintf(stderr, "WARNING: Gathered %llu pairs but the pairs array has %llu children\n", pairs.count, totalPairsCount);
+    }
+    return pairs;
+}
+
+typedef struct {
+    FusedState* fused;
+    bool hasHeld;
+    f64 held[4];
+} IncrementalRun;
+
+static void dist_onIncrementalPair(void* ctx, f64 lng0, f64 lat0, f64 lng1, f64 lat1) {
+    // One pair behind the parser, so a pair whose closing brace is not in the file yet is never committed
+    IncrementalRun* run = ctx;
+    if (run->hasHeld) {
+        dist_onFusedPair(run->fused, run->held[0], run->held[1], run->held[2], run->held[3]);
+    }
+    run->held[0] = lng0;
+    run->held[1] = lat0;
+    run->held[2] = lng1;
+    run->held[3] = lat1;
+    run->hasHeld = true;
+}
+
+/// Resumes from the sidecar state after the last processed pair, computes only the new tail and saves the
+/// state again. Returns the average over every pair so far, bit-identical to a full -fused run.
+static f64 dist_runIncremental(const char* jsonFilename, const f64* knownDists, u64 knownCount,
+                               u64* out_fileSize, u64* out_pairCount, ValidateReport* out_report) {
+    tempo_startFunc;
+    char stateFilename[FILENAME_LEN + 8] = { 0 };
+    snprintf(stateFilename, sizeof(stateFilename), "%s%s", jsonFilename, INCREMENTAL_STATE_SUFFIX);
+    FileState input = mmapFile(jsonFilename);
+
+    IncrementalState state = { 0 };
+    if (incremental_load(stateFilename, &state)) {
+        if (state.byteOffset > input.size || incremental_tailHash(input.data, state.byteOffset) != state.tailHash) {
+            printf("NOTE: %s changed before the saved offset, starting over\n", jsonFilename);
+            state = (IncrementalState){ 0 };
+        }
+    }
+    u64 resumeOffset = state.byteOffset;
+
+    // Only scan up to the last closing brace, a writer may be part way through the next pair
+    u64 scanEnd = input.size;
+    while (scanEnd > resumeOffset && input.data[scanEnd - 1] != '}') {
+        scanEnd--;
+    }
+
+    FusedState* fused = calloc(1, sizeof(FusedState));
+    if (fused == NULL) {
+        fprintf(stderr, "ERROR: Memory alloc failed for fused state\n");
+        exit(1);
+    }
+    fused->knownDists = knownDists;
+    fused->knownCount = knownCount;
+    fused->kernel = haversine_reference;
+    fused->pairsProcessed = state.pairCount;
+    fused->sum = state.sum;
+    IncrementalRun run = { 0 };
+    run.fused = fused;
+    JsonStreamResult stream = json_streamPairsResume(input.data, scanEnd, resumeOffset, dist_onIncrementalPair, &run);
+    if (stream.error[0] != '\0') {
+        fprintf(stderr, "ERROR: %s in %s\n", stream.error, jsonFilename);
+        exit(1);
+    }
+    if (run.hasHeld && stream.closedPairCount == stream.pairCount) {
+        dist_onFusedPair(fused, run.held[0], run.held[1], run.held[2], run.held[3]);
+    }
+    dist_flushFused(fused);
+
+    IncrementalState next = { 0 };
+    next.byteOffset = stream.lastPairEnd;
+    next.pairCount = fused->pairsProcessed;
+    next.sum = fused->sum;
+    next.tailHash = incremental_tailHash(input.data, next.byteOffset);
+    incremental_save(stateFilename, &next);
+    printf("Incremental: resumed at byte %llu after %llu pairs, %llu new pairs up to byte %llu, state in %s\n",
+        resumeOffset, state.pairCount, next.pairCount - state.pairCount, next.byteOffset, stateFilename);
+
+    *out_fileSize = input.size;
+    *out_pairCount = next.pairCount;
+    *out_report = fused->report;
+    f64 result = blockedSum_result(fused->sum, next.pairCount);
+    pairs_free(&fused->pending);
+    free(fused);
+    munmapFile(&input);
+    tempo_stopFunc;
+    return result;
+}
+
+static int dist_compareIds(const void* a, const void* b) {
+    u64 idA = *(const u64*) a;
+    u64 idB = *(const u64*) b;
+    return idA < idB ? -1 : (idA > idB);
+}
+
+/// Builds the spatial index over `pairs`, answers the -query and -nearest requests with it and with a brute-force
+/// scan, checks that both agree and prints the timings
+static void dist_runSpatial(const PairArrays* pairs, const f64* query, bool hasQuery, const f64* nearest, bool hasNearest) {
+    tempo_startFunc;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    tempo_startBlock("spatial_build");
+    SpatialIndex index = spatial_build(pairs);
+    tempo_stopBlock("spatial_build");
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("Spatial index: %llu endpoints in %.3fms\n", index.count, getElapsedMillis(start, end));
+
+    if (hasQuery) {
+        f64 lat = query[0], lng = query[1], radiusKm = query[2];
+        SpatialMatches indexed = { 0 };
+        SpatialMatches brute = { 0 };
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        tempo_startBlock("spatial_query");
+        spatial_queryRadius(&index, pairs, lat, lng, radiusKm, &indexed);
+        tempo_stopBlock("spatial_query");
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        f64 indexMs = getElapsedMillis(start, end);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        tempo_startBlock("spatial_brute");
+        spatial_bruteRadius(pairs, lat, lng, radiusKm, &brute);
+        tempo_stopBlock("spatial_brute");
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        f64 bruteMs = getElapsedMillis(start, end);
+
+        qsort(indexed.pointIds, indexed.count, sizeof(u64), dist_compareIds);
+        bool isSame = indexed.count == brute.count
+            && (indexed.count == 0 || memcmp(indexed.pointIds, brute.pointIds, indexed.count * sizeof(u64)) == 0);
+        if (!isSame) {
+            fprintf(stderr, "WARNING: Spatial index found %llu endpoints, brute force found %llu\n", indexed.count, brute.count);
+        }
+        // Ids are sorted, so both endpoints of a pair sit next to each other
+        u64 anyCount = 0;
+        u64 bothCount = 0;
+        for (u64 i = 0; i < indexed.count; i++) {
+            bool isSecondOfPair = i > 0 && (indexed.pointIds[i] >> 1) == (indexed.pointIds[i - 1] >> 1);
+            if (isSecondOfPair) {
+                bothCount++;
+            } else {
+                anyCount++;
+            }
+        }
+        printf("Query within %.3f km of (%.6f, %.6f): %llu endpoints, %llu pairs with an endpoint inside, %llu with both\n",
+            radiusKm, lat, lng, indexed.count, anyCount, bothCount);
+        u64 printed = 0;
+        for (u64 i = 0; i < indexed.count && printed < SPATIAL_PRINT_PAIRS; i++) {
+            u64 pairIdx = indexed.pointIds[i] >> 1;
+            if (i > 0 && pairIdx == (indexed.pointIds[i - 1] >> 1)) continue;
+            printf("  pair %llu: (%.6f, %.6f) -> (%.6f, %.6f)\n", pairIdx,
+                pairs->lat0[pairIdx], pairs->lng0[pairIdx], pairs->lat1[pairIdx], pairs->lng1[pairIdx]);
+            printed++;
+        }
+        printf("Query: index %.3fms vs brute force %.3fms (%.1fx)%s\n", indexMs, bruteMs,
+            indexMs > 0.0 ? bruteMs / indexMs : 0.0, isSame ? ", results match" : "");
+
+        // Benchmark over many centres, at the same radius
+        u64 benchCount = MIN(SPATIAL_BENCH_QUERIES, pairs->count);
+        u64 indexHits = 0;
+        u64 bruteHits = 0;
+        f64 benchIndexMs = 0.0;
+        f64 benchBruteMs = 0.0;
+        for (u64 q = 0; q < benchCount; q++) {
+            u64 pairIdx = (pairs->count * q) / benchCount;
+            indexed.count = 0;
+            brute.count = 0;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            spatial_queryRadius(&index, pairs, pairs->lat0[pairIdx], pairs->lng0[pairIdx], radiusKm, &indexed);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            benchIndexMs += getElapsedMillis(start, end);
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            spatial_bruteRadius(pairs, pairs->lat0[pairIdx], pairs->lng0[pairIdx], radiusKm, &brute);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            benchBruteMs += getElapsedMillis(start, end);
+            indexHits += indexed.count;
+            bruteHits += brute.count;
+        }
+        if (benchCount > 0) {
+            printf("Query benchmark: %llu queries, %.1f endpoints each, index %.3f us/query vs brute force %.3f us/query (%.1fx)%s\n",
+                benchCount, (f64) indexHits / (f64) benchCount,
+                (benchIndexMs * 1000.0) / (f64) benchCount, (benchBruteMs * 1000.0) / (f64) benchCount,
+                benchIndexMs > 0.0 ? benchBruteMs / benchIndexMs : 0.0, indexHits == bruteHits ? ", hit counts match" : "");
+            if (indexHits != bruteHits) {
+                fprintf(stderr, "WARNING: Benchmark hit counts differ: index %llu, brute force %llu\n", indexHits, bruteHits);
+            }
+        }
+        spatialMatches_free(&indexed);
+        spatialMatches_free(&brute);
+    }
+
+    if (hasNearest && index.count > 0) {
+        f64 lat = nearest[0], lng = nearest[1];
+        f64 indexDist = 0.0;
+        f64 bruteDist = 0.0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        tempo_startBlock("spatial_nearest");
+        u64 indexId = spatial_queryNearest(&index, pairs, lat, lng, &indexDist);
+        tempo_stopBlock("spatial_nearest");
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        f64 indexMs = getElapsedMillis(start, end);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        u64 bruteId = spatial_bruteNearest(pairs, lat, lng, &bruteDist);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        f64 bruteMs = getElapsedMillis(start, end);
+        if (indexId != bruteId) {
+            fprintf(stderr, "WARNING: Spatial index nearest is endpoint %llu, brute force found %llu\n", indexId, bruteId);
+        }
+        printf("Nearest to (%.6f, %.6f): pair %llu endpoint %llu at %.6f km\n", lat, lng, indexId >> 1, indexId & 1, indexDist);
+        printf("Nearest: index %.3fms vs brute force %.3fms (%.1fx)%s\n", indexMs, bruteMs,
+            indexMs > 0.0 ? bruteMs / indexMs : 0.0, indexId == bruteId ? ", results match" : "");
+    }
+    spatial_free(&index);
+    tempo_stopFunc;
+}
+
+static void* pipeline_pop(WorkQueue* queue, u64* stallTicks) {
+    void* item = NULL;
+    if (workQueue_tryPop(queue, &item)) return item;
+    u64 stallStart = tempo_readTicks();
+    for (u32 spins = 1; !workQueue_tryPop(queue, &item); spins++) {
+        if (spins >= PIPELINE_SPIN_LIMIT) {
+            thread_yield();
+        }
+    }
+    *stallTicks += tempo_readTicks() - stallStart;
+    return item;
+}
+static void pipeline_push(WorkQueue* queue, void* item, u64* stallTicks) {
+    if (workQueue_tryPush(queue, item)) return;
+    u64 stallStart = tempo_readTicks();
+    for (u32 spins = 1; !workQueue_tryPush(queue, item); spins++) {
+        if (spins >= PIPELINE_SPIN_LIMIT) {
+            thread_yield();
+        }
+    }
+    *stallTicks += tempo_readTicks() - stallStart;
+}
+
+static void pipeline_workerMain(void* arg) {
+    PipelineWorker* worker = arg;
+    char threadLabel[TEMPO_THREAD_LABEL_LEN] = { 0 };
+    snprintf(threadLabel, sizeof(threadLabel), "compute[%u]", worker->workerIdx);
+    tempo_nameThread(threadLabel);
+    u64 startTicks = tempo_readTicks();
+    for (;;) {
+        PairBatch* batch = pipeline_pop(worker->fullQueue, &worker->stallTicks);
+        PairArrays* pairs = &batch->pairs;
+        if (pairs->count == 0) break;  // End-of-stream marker
+        // With -out the kernel writes straight into the mapped file, the producer already bounded the pair index
+        f64* dists = worker->outDists != NULL ? worker->outDists + batch->firstPairIdx : batch->dists;
+        tempo_startBlock("pipeline_batch");
+        tempo_countItems(pairs->count);
+
+        // Batches are whole multiples of the sum block, so each block partial lands in its fixed slot
+        for (u64 blockStart = 0; blockStart < pairs->count; blockStart += HAVERSINE_SUM_BLOCK_PAIRS) {
+            u64 blockEnd = MIN(blockStart + HAVERSINE_SUM_BLOCK_PAIRS, pairs->count);
+            worker->kernel(pairs->lng0 + blockStart, pairs->lat0 + blockStart, pairs->lng1 + blockStart, pairs->lat1 + blockStart,
+                dists + blockStart, blockEnd - blockStart);
+            NeumaierSum acc = { 0 };
+            for (u64 i = blockStart; i < blockEnd; i++) {
+                neumaier_add(&acc, dists[i]);
+                worker->maxDist = MAX(worker->maxDist, dists[i]);
+            }
+            worker->blockSums[(batch->firstPairIdx + blockStart) / HAVERSINE_SUM_BLOCK_PAIRS] = acc;
+        }
+        if (worker->knownDists != NULL) {
+            validate_range(&worker->report, pairs, dists, worker->knownDists + batch->firstPairIdx,
+                0, pairs->count, batch->firstPairIdx);
+        }
+        tempo_stopBlock("pipeline_batch");
+        worker->pairCount += pairs->count;
+        pipeline_push(worker->freeQueue, batch, &worker->stallTicks);
+    }
+    worker->busyTicks = tempo_readTicks() - startTicks - worker->stallTicks;
+}
+
+static void pipeline_onPair(void* ctx, f64 lng0, f64 lat0, f64 lng1, f64 lat1) {
+    PipelineProducer* producer = ctx;
+    if (producer->nextPairIdx >= producer->maxPairs) {
+        fprintf(stderr, "ERROR: More pairs than the file size allows (%llu)\n", producer->maxPairs);
+        exit(1);
+    }
+    if (producer->hasKnown) {
+        // Workers index the known distances directly, so the bound is enforced before handing out pairs
+        dist_checkKnownCount(producer->nextPairIdx + 1, producer->knownCount);
+    }
+    if (producer->current == NULL) {
+        producer->current = pipeline_pop(producer->freeQueue, &producer->stallTicks);
+        producer->current->firstPairIdx = producer->nextPairIdx;
+        producer->current->pairs.count = 0;
+    }
+    PairBatch* batch = producer->current;
+    pairs_append(&batch->pairs, lng0, lat0, lng1, lat1);  // Never grows: capacity is the batch size
+    producer->nextPairIdx++;
+    if (batch->pairs.count == producer->batchSize) {
+        pipeline_push(producer->fullQueue, batch, &producer->stallTicks);
+        producer->current = NULL;
+    }
+}
+
+/// The calling thread parses and fills batches, `workerCount` threads compute them.
+/// Returns the average distance, bit-identical to the -threads and -fused sums.
+static f64 pipeline_run(const char* jsonFilename, const f64* knownDists, u64 knownCount, f64* outDists, PipelineConfig config,
+                        u64* out_fileSize, u64* out_pairCount, f64* out_maxDist, ValidateReport* out_report) {
+    tempo_startFunc;
+    u64 fileSize = getFileSize(jsonFilename);
+    u64 maxPairs = dist_maxPairsForSize(fileSize);
+    u64 maxBlocks = maxPairs / HAVERSINE_SUM_BLOCK_PAIRS + 1;
+    u64 batchCount = config.queueDepth + config.workerCount;
+    NeumaierSum* blockSums = calloc(maxBlocks, sizeof(NeumaierSum));
+    PairBatch* batches = calloc(batchCount + 1, sizeof(PairBatch));
+    PipelineWorker* workers = calloc(config.workerCount, sizeof(PipelineWorker));
+    ThreadHandle* threads = calloc(config.workerCount, sizeof(ThreadHandle));
+    if (blockSums == NULL || batches == NULL || workers == NULL || threads == NULL) {
+        fprintf(stderr, "ERROR: Memory alloc failed for pipeline of %llu batches\n", batchCount);
+        exit(1);
+    }
+
+    WorkQueue fullQueue = { 0 }, freeQueue = { 0 };
+    workQueue_init(&fullQueue, config.queueDepth);
+    workQueue_init(&freeQueue, batchCount);
+    for (u64 b = 0; b < batchCount; b++) {
+        PairBatch* batch = &batches[b];
+        f64* columns = malloc(5 * config.batchSize * sizeof(f64));
+        if (columns == NULL) {
+            fprintf(stderr, "ERROR: Memory alloc failed for batch of %llu pairs\n", config.batchSize);
+            exit(1);
+        }
+        batch->pairs.lng0 = columns;
+        batch->pairs.lat0 = columns + config.batchSize;
+        batch->pairs.lng1 = columns + config.batchSize * 2;
+        batch->pairs.lat1 = columns + config.batchSize * 3;
+        batch->pairs.capacity = config.batchSize;
+        batch->dists = columns + config.batchSize * 4;
+        workQueue_tryPush(&freeQueue, batch);
+    }
+    PairBatch* endMarker = &batches[batchCount];
+
+    for (u32 w = 0; w < config.workerCount; w++) {
+        workers[w].fullQueue = &fullQueue;
+        workers[w].freeQueue = &freeQueue;
+        workers[w].blockSums = blockSums;
+        workers[w].knownDists = knownDists;
+        workers[w].outDists = outDists;
+        workers[w].kernel = config.kernel;
+        workers[w].workerIdx = w;
+        threads[w] = thread_start(pipeline_workerMain, &workers[w]);
+    }
+
+    PipelineProducer producer = { 0 };
+    producer.fullQueue = &fullQueue;
+    producer.freeQueue = &freeQueue;
+    producer.batchSize = config.batchSize;
+    producer.maxPairs = maxPairs;
+    producer.knownCount = knownCount;
+    producer.hasKnown = knownDists != NULL;
+    u64 parseStart = tempo_readTicks();
+    JsonStreamResult stream = json_streamPairs(jsonFilename, pipeline_onPair, &producer);
+    if (producer.current != NULL) {
+        pipeline_push(&fullQueue, producer.current, &producer.stallTicks);
+        producer.current = NULL;
+    }
+    for (u32 w = 0; w < config.workerCount; w++) {
+        pipeline_push(&fullQueue, endMarker, &producer.stallTicks);
+    }
+    u64 parseTicks = tempo_readTicks() - parseStart;
+
+    tempo_startBlock("pipeline_join");
+    for (u32 w = 0; w < config.workerCount; w++) {
+        thread_join(&threads[w]);
+    }
+    tempo_stopBlock("pipeline_join");
+
+    tempo_addStage("parse", parseTicks - producer.stallTicks, producer.stallTicks, stream.pairCount);
+    ValidateReport report = { 0 };
+    f64 maxDist = 0.0;
+    for (u32 w = 0; w < config.workerCount; w++) {
+        char label[TEMPO_STAGE_LABEL_LEN];
+        maxDist = MAX(maxDist, workers[w].maxDist);
+        snprintf(label, TEMPO_STAGE_LABEL_LEN, "compute[%u]", w);
+        tempo_addStage(label, workers[w].busyTicks, workers[w].stallTicks, workers[w].pairCount);
+        validate_merge(&report, &workers[w].report);
+    }
+
+    u64 blockCount = (stream.pairCount + HAVERSINE_SUM_BLOCK_PAIRS - 1) / HAVERSINE_SUM_BLOCK_PAIRS;
+    NeumaierSum total = { 0 };
+    for (u64 blockIdx = 0; blockIdx < blockCount; blockIdx++) {
+        neumaier_addPartial(&total, blockSums[blockIdx]);
+    }
+    f64 result = stream.pairCount > 0 ? neumaier_result(total) / (f64) stream.pairCount : 0.0;
+
+    for (u64 b = 0; b < batchCount; b++) {
+        free(batches[b].pairs.lng0);
+    }
+    workQueue_free(&fullQueue);
+    workQueue_free(&freeQueue);
+    free(threads);
+    free(workers);
+    free(batches);
+    free(blockSums);
+
+    *out_fileSize = stream.fileSize;
+    *out_pairCount = stream.pairCount;
+    *out_maxDist = maxDist;
+    *out_report = report;
+    tempo_stopFunc;
+    return result;
+}
 
 int main(int argc, char** argv) {
     tempo_startProfile("DIST_PROC");
@@ -24,22 +593,156 @@ int main(int argc, char** argv) {
     char distFilename[FILENAME_LEN] = { 0 };
 
     bool hasJson = getParamValue_str(argc, argv, 1, jsonFilename, FILENAME_LEN);
-    bool hasDist = getParamValue_str(argc, argv, 2, distFilename, FILENAME_LEN);
+    bool hasDist = getParamValue_str(argc, argv, 2, distFilename, FILENAME_LEN) && distFilename[0] != '-';
+    u32 threadCount = 0;
+    getParamValue_u32(argc, argv, "-threads", &threadCount);
+    bool isFused = getParamFlag(argc, argv, "-fused");
+    bool isIncremental = getParamFlag(argc, argv, "-incremental");
+    bool isPipeline = getParamFlag(argc, argv, "-pipeline");
+    bool verifyBinary = getParamFlag(argc, argv, "-verify");
+    bool isFast = getParamFlag(argc, argv, "-fast");
+    char isaName[16] = { 0 };
+    bool hasIsa = getParamValue_namedStr(argc, argv, "-isa", isaName, sizeof(isaName));
+    char batchDir[FILENAME_LEN] = { 0 };
+    char batchList[FILENAME_LEN] = { 0 };
+    bool hasBatchDir = getParamValue_namedStr(argc, argv, "-dir", batchDir, FILENAME_LEN);
+    bool hasBatchList = getParamValue_namedStr(argc, argv, "-list", batchList, FILENAME_LEN);
+    bool isBatch = hasBatchDir || hasBatchList;
+    char precisionName[8] = "f64";
+    getParamValue_namedStr(argc, argv, "-precision", precisionName, sizeof(precisionName));
+    bool isF32 = strcmp(precisionName, "f32") == 0;
+    f64 query[3] = { 0 };
+    f64 nearest[2] = { 0 };
+    f64 approxTolerance = 0.0;  // Metres
+    bool isApprox = getParamValues_f64(argc, argv, "-approx", &approxTolerance, 1);
+    bool hasQuery = getParamValues_f64(argc, argv, "-query", query, 3);
+    bool hasNearest = getParamValues_f64(argc, argv, "-nearest", nearest, 2);
+    char outFilename[FILENAME_LEN] = { 0 };
+    bool hasOut = getParamValue_namedStr(argc, argv, "-out", outFilename, FILENAME_LEN);
+    char traceFilename[FILENAME_LEN] = { 0 };
+    bool hasTrace = getParamValue_namedStr(argc, argv, "-trace", traceFilename, FILENAME_LEN);
+    u64 traceEvents = TEMPO_TRACE_DEFAULT_EVENTS;
+    getParamValue_u64(argc, argv, "-traceEvents", &traceEvents);
+    bool hasCounters = getParamFlag(argc, argv, "-counters");
+    bool hasMemory = getParamFlag(argc, argv, "-memory");
+    if (!isF32 && strcmp(precisionName, "f64") != 0) {
+        fprintf(stderr, "ERROR: Unknown precision '%s', expected f32 or f64\n", precisionName);
+        exit(1);
+    }
+    if (isApprox && !(approxTolerance > 0.0)) {
+        fprintf(stderr, "ERROR: -approx needs a positive tolerance in metres\n");
+        exit(1);
+    }
+    if (isApprox && isF32) {
+        fprintf(stderr, "ERROR: -approx and -precision f32 are separate kernels, pick one\n");
+        exit(1);
+    }
+    PipelineConfig pipelineConfig = { 0 };
+    pipelineConfig.batchSize = HAVERSINE_SUM_BLOCK_PAIRS;
+    pipelineConfig.queueDepth = 8;
+    // Pipeline and batch mode share it: one compute thread per CPU, less the one the main thread runs on
+    pipelineConfig.workerCount = MAX(1, getCpuCount() - 1);
+    getParamValue_u64(argc, argv, "-batch", &pipelineConfig.batchSize);
+    getParamValue_u64(argc, argv, "-queue", &pipelineConfig.queueDepth);
+    getParamValue_u32(argc, argv, "-workers", &pipelineConfig.workerCount);
+    // Whole sum blocks per batch keep the pipeline sum identical to the other modes
+    pipelineConfig.batchSize = MAX(1, (pipelineConfig.batchSize + HAVERSINE_SUM_BLOCK_PAIRS - 1) / HAVERSINE_SUM_BLOCK_PAIRS) * HAVERSINE_SUM_BLOCK_PAIRS;
+    pipelineConfig.queueDepth = MAX(1, pipelineConfig.queueDepth);
+    pipelineConfig.workerCount = MAX(1, pipelineConfig.workerCount);
 
-    if (!hasJson) {
+    if (!hasJson && !isBatch) {
         const char* progName = basename(argv[0]);
-        fprintf(stdout, "Usage: %s jsonFilename [distFilename]\n", progName);
-        fprintf(stdout, "  jsonFilename    generated JSON file with coordinate pairs\n");
+        fprintf(stdout, "Usage: %s jsonFilename [distFilename] [-threads N] [-fused] [-pipeline [-batch N] [-queue N] [-workers N]] [-isa NAME] [-precision f32|f64] [-approx TOL_M] [-fast] [-out FILE] [-incremental] [-trace FILE [-traceEvents N]] [-counters] [-memory]\n", progName);
+        fprintf(stdout, "       %s jsonFilename [-query LAT LNG RADIUS_KM] [-nearest LAT LNG]\n", progName);
+        fprintf(stdout, "       %s -dir PATH | -list FILE [-workers N] [-isa NAME]\n", progName);
+        fprintf(stdout, "  jsonFilename    generated JSON file with coordinate pairs, or a binary pairs file\n");
         fprintf(stdout, "  distFilename    generated distances file for validation\n");
+        fprintf(stdout, "  -threads N      also compute a deterministic parallel sum on N threads\n");
+        fprintf(stdout, "  -fused          parse, calculate and check in one pass without building elements\n");
+        fprintf(stdout, "  -pipeline       parse on this thread and calculate on worker threads\n");
+        fprintf(stdout, "  -incremental    only process pairs appended since the last run, tracked in jsonFilename%s\n", INCREMENTAL_STATE_SUFFIX);
+        fprintf(stdout, "  -batch N        pairs per pipeline batch, rounded up to %d (default %d)\n", HAVERSINE_SUM_BLOCK_PAIRS, HAVERSINE_SUM_BLOCK_PAIRS);
+        fprintf(stdout, "  -queue N        pipeline batches queued between parser and workers (default 8)\n");
+        fprintf(stdout, "  -workers N      compute threads for -pipeline and batch mode (default CPU count - 1)\n");
+        fprintf(stdout, "  -verify         check the checksum of a binary pairs file before using it\n");
+        fprintf(stdout, "  -isa NAME       force the kernel set: sse2, avx2, avx512 or auto (default auto)\n");
+        fprintf(stdout, "  -precision f32  calculate on f32 coordinates with the single-precision kernel (default f64)\n");
+        fprintf(stdout, "  -approx TOL_M   use a cheaper formula for pairs whose error bound is under TOL_M metres, haversine elsewhere\n");
+        fprintf(stdout, "  -fast           use the dispatched polynomial f64 kernel, approximate with a reported error bound\n");
+        fprintf(stdout, "  -out FILE       write every distance, then the average, in the coord_gen answer layout\n");
+        fprintf(stdout, "  -trace FILE     write the profiled blocks of every thread as a Chrome trace, for Perfetto or chrome://tracing\n");
+        fprintf(stdout, "  -traceEvents N  latest blocks kept per thread for -trace (default %d)\n", TEMPO_TRACE_DEFAULT_EVENTS);
+        fprintf(stdout, "  -counters       add IPC, branch and cache misses per profiled block from hardware counters, where permitted\n");
+        fprintf(stdout, "  -memory         add page faults and resident set changes per profiled block\n");
+        fprintf(stdout, "  -query LAT LNG RADIUS_KM  list the pairs with an endpoint within RADIUS_KM, via a k-d tree and brute force\n");
+        fprintf(stdout, "  -nearest LAT LNG          find the closest endpoint, via a k-d tree and brute force\n");
+        fprintf(stdout, "  -dir PATH       process every .json and .bin pairs file in PATH on a worker pool\n");
+        fprintf(stdout, "  -list FILE      process the files listed in FILE, one per line\n");
+        fprintf(stdout, "                  X-coords.json is checked against X-dist.f64 when it exists\n");
         exit(0);
     }
+    if (hasTrace) {
+        tempo_startTrace(traceEvents);
+    }
+    if (hasCounters) {
+        tempo_startCounters();
+    }
+    if (hasMemory) {
+        tempo_startMemory();
+    }
+    dispatch_init(hasIsa ? isaName : NULL);
+    dispatch_printFeatures();
+    if (isBatch) {
+        if (hasOut) {
+            printf("NOTE: -out is not supported in batch mode, ignoring it\n");
+        }
+        BatchList batch = { 0 };
+        if (hasBatchDir) {
+            batch_addDirectory(&batch, batchDir);
+        }
+        if (hasBatchList) {
+            batch_addListFile(&batch, batchList);
+        }
+        tempo_stopBlock("startup");
+        u64 failedCount = batch_run(&batch, pipelineConfig.workerCount, verifyBinary);
+        batch_free(&batch);
+        printf("\n");
+        tempo_stopProfile();
+        tempo_printProfile();
+        if (hasTrace) {
+            tempo_writeTrace(traceFilename);
+        }
+        return failedCount > 0 ? 1 : 0;
+    }
+    bool isBinary = pairsBin_isBinaryFile(jsonFilename);
+    if (isIncremental) {
+        if (isBinary || isF32 || isApprox || isFast || hasQuery || hasNearest || hasOut || isPipeline) {
+            printf("NOTE: -incremental streams new JSON pairs only, ignoring the other modes\n");
+        }
+        if (isBinary) {
+            fprintf(stderr, "ERROR: -incremental needs a JSON pairs file\n");
+            exit(1);
+        }
+        isFused = isPipeline = isF32 = isApprox = isFast = hasQuery = hasNearest = hasOut = false;
+        threadCount = 0;
+    }
+    if (isBinary && (isFused || isPipeline)) {
+        printf("NOTE: %s is a binary pairs file, reading it directly instead of %s\n", jsonFilename, isFused ? "-fused" : "-pipeline");
+        isFused = isPipeline = false;
+    }
+    if (isFast && (isF32 || isApprox)) {
+        printf("NOTE: %s has its own kernel, ignoring -fast\n", isF32 ? "-precision f32" : "-approx");
+        isFast = false;
+    }
+    // The answer file holds reference distances, only -fast trades them for speed
+    HaversineKernel haversineKernel = isFast ? dispatch.haversineFast : haversine_reference;
+    pipelineConfig.kernel = haversineKernel;
+    if ((isF32 || isApprox || hasQuery || hasNearest) && (isFused || isPipeline)) {
+        printf("NOTE: %s works on the pair arrays, ignoring %s\n", isF32 ? "-precision f32" : isApprox ? "-approx" : "the spatial index", isFused ? "-fused" : "-pipeline");
+        isFused = isPipeline = false;
+    }
     tempo_stopBlock("startup");
 
-    printf("Reading %s\n", jsonFilename);
-    JsonFile jsonFile = json_parseFile(jsonFilename);
-    u64 jsonFileSize = jsonFile.fileSize;
-    u64 jsonElementCount = jsonFile.elementCount;
-
     tempo_startBlock("dist_fileMap");
     FileState distFile = { 0 };
     if (hasDist) {
@@ -47,96 +750,328 @@ int main(int argc, char** argv) {
     }
     tempo_stopBlock("dist_fileMap");
 
-    bool isInPairs = false;
-    f64 lng0 = NAN, lat0 = NAN, lng1 = NAN, lat1 = NAN;
-    u64 pairsProcessed = 0, totalPairsCount = 0;
-    f64 accumCoef = 1.0;
+    printf("Reading %s%s\n", jsonFilename, isIncremental ? " (incremental)" : isFused ? " (fused)" : isPipeline ? " (pipeline)" : isBinary ? " (binary)" : "");
+    u64 jsonFileSize = 0;
+    u64 jsonElementCount = 0;
+    u64 pairsProcessed = 0;
     f64 calcAccum = 0.0;
-    f64 maxDistDrift = 0.0;
-    u64 distDriftCount = 0;
-    u64 maxDistPairIdx = 0;
+    ValidateReport report = { 0 };
+    const f64* knownDists = hasDist ? (const f64*) distFile.data : NULL;
+    u64 knownCount = hasDist ? (distFile.size / sizeof(f64)) - 1 : 0;  // Last entry is the average
     f64 distCheckFinal = 0.0;
-    u64 distCheckElapsed = 0;
-    tempo_startBlock("dist_calc");
-    for (u64 i = 0; i < jsonFile.elementCount; i++) {
-        JsonElement el = jsonFile.elements[i];
-        if (el.type == JSON_ARRAY_BEGIN && strcmp(jsonFile.stringBuff + el.nameOffset, "pairs") == 0) {
-            isInPairs = true;
-            totalPairsCount = el.container.childCount;
-            accumCoef = 1.0 / (f64)totalPairsCount;
-            continue;
+    f64 validateMs = 0.0;
+    f64 calcMs = 0.0;
+    f64 parallelAccum = 0.0;
+    f64 parallelMs = 0.0;
+    f64 singleMs = 0.0;  // Same kernel and blocked sum as the parallel run, on one thread
+    f64 f64KernelMs = 0.0;
+    u64 approxFullCount = 0;
+    f64 maxDist = 0.0;  // Longest pair, for the -fast error bound
+    // The output holds one f64 per pair plus the average. Streaming modes size it for the most pairs the
+    // input could hold and trim it once the real count is known.
+    FileState outFile = { 0 };
+    f64* outDists = NULL;
+    if (hasOut && (isPipeline || isFused)) {
+        u64 maxPairs = dist_maxPairsForSize(getFileSize(jsonFilename));
+        outFile = mmapFileWrite(outFilename, (maxPairs + 1) * sizeof(f64));
+        outDists = (f64*) outFile.data;
+    }
+    if (isIncremental) {
+        struct timespec calcStart, calcEnd;
+        clock_gettime(CLOCK_MONOTONIC, &calcStart);
+        calcAccum = dist_runIncremental(jsonFilename, knownDists, knownCount, &jsonFileSize, &pairsProcessed, &report);
+        clock_gettime(CLOCK_MONOTONIC, &calcEnd);
+        calcMs = getElapsedMillis(calcStart, calcEnd);
+    } else if (isPipeline) {
+        struct timespec calcStart, calcEnd;
+        clock_gettime(CLOCK_MONOTONIC, &calcStart);
+        calcAccum = pipeline_run(jsonFilename, knownDists, knownCount, outDists, pipelineConfig, &jsonFileSize, &pairsProcessed, &maxDist, &report);
+        clock_gettime(CLOCK_MONOTONIC, &calcEnd);
+        calcMs = getElapsedMillis(calcStart, calcEnd);
+    } else if (isFused) {
+        FusedState* fused = calloc(1, sizeof(FusedState));
+        if (fused == NULL) {
+            fprintf(stderr, "ERROR: Memory alloc failed for fused state\n");
+            exit(1);
         }
-        if (el.type == JSON_ARRAY_END && strcmp(jsonFile.stringBuff + el.nameOffset, "pairs") == 0) {
-            isInPairs = false;
-            continue;
+        fused->knownDists = knownDists;
+        fused->knownCount = knownCount;
+        fused->outDists = outDists;
+        fused->outCapacity = outDists != NULL ? dist_maxPairsForSize(getFileSize(jsonFilename)) : 0;
+        fused->kernel = haversineKernel;
+        struct timespec calcStart, calcEnd;
+        clock_gettime(CLOCK_MONOTONIC, &calcStart);
+        tempo_startBlock("dist_fused");
+        JsonStreamResult stream = json_streamPairs(jsonFilename, dist_onFusedPair, fused);
+        dist_flushFused(fused);
+        tempo_countBytes(stream.fileSize);
+        tempo_countItems(fused->pairsProcessed);
+        tempo_stopBlock("dist_fused");
+        clock_gettime(CLOCK_MONOTONIC, &calcEnd);
+        calcMs = getElapsedMillis(calcStart, calcEnd);
+        jsonFileSize = stream.fileSize;
+        pairsProcessed = fused->pairsProcessed;
+        calcAccum = blockedSum_result(fused->sum, pairsProcessed);
+        maxDist = fused->maxDist;
+        report = fused->report;
+        pairs_free(&fused->pending);
+        free(fused);
+    } else {
+        JsonFile jsonFile = { 0 };
+        FileState binFile = { 0 };
+        PairArrays pairs = { 0 };
+        if (isBinary) {
+            tempo_startBlock("bin_map");
+            binFile = mmapFile(jsonFilename);
+            pairs = pairsBin_view(&binFile, verifyBinary);
+            jsonFileSize = binFile.size;
+            tempo_stopBlock("bin_map");
+        } else {
+            jsonFile = json_parseFile(jsonFilename);
+            jsonFileSize = jsonFile.fileSize;
+            jsonElementCount = jsonFile.elementCount;
+            pairs = dist_gatherPairs(&jsonFile);
         }
-        if (el.type == JSON_NUMBER && isInPairs) {
-            if (strcmp(jsonFile.stringBuff + el.nameOffset, "lng0") == 0) {
-                lng0 = el.number.value;
-            } else if (strcmp(jsonFile.stringBuff + el.nameOffset, "lat0") == 0) {
-                lat0 = el.number.value;
-            } else if (strcmp(jsonFile.stringBuff + el.nameOffset, "lng1") == 0) {
-                lng1 = el.number.value;
-            } else if (strcmp(jsonFile.stringBuff + el.nameOffset, "lat1") == 0) {
-                lat1 = el.number.value;
+
+        // Only kept whole when something reads them afterwards, or the kernel fills them in one call
+        f64* dists = NULL;
+        if (hasOut) {
+            outFile = mmapFileWrite(outFilename, (pairs.count + 1) * sizeof(f64));
+            outDists = (f64*) outFile.data;
+            dists = outDists;
+        } else if (hasDist || isF32 || isApprox) {
+            dists = malloc(MAX(1, pairs.count) * sizeof(f64));
+            if (dists == NULL) {
+                fprintf(stderr, "ERROR: Memory alloc failed for %llu distances\n", pairs.count);
+                exit(1);
             }
-            continue;
         }
-        if (el.type == JSON_OBJECT_END && isInPairs) {
-            pairsProcessed++;
-            if (isnan(lng0) || isnan(lat0) || isnan(lng1) || isnan(lat1)) {
-                fprintf(stderr, "ERROR: Missing numbers for pair %llu: (lng0=%.f,lat0=%f), (lng1=%f,lat1=%f)\n", totalPairsCount, lng0, lat0, lng1, lat1);
+        BlockedSum sum = { 0 };  // Same blocks as coord_gen's average and haversine_sumParallel
+        struct timespec calcStart, calcEnd;
+        if (isF32) {
+            tempo_startBlock("dist_toF32");
+            PairArrays32 pairs32 = pairs32_fromPairs(&pairs);
+            f32* dists32 = malloc(MAX(1, pairs.count) * sizeof(f32));
+            if (dists32 == NULL) {
+                fprintf(stderr, "ERROR: Memory alloc failed for %llu f32 distances\n", pairs.count);
                 exit(1);
             }
-            f64 calcDist = referenceHaversineDistance(lng0, lat0, lng1, lat1, EARTH_RAD);
-            calcAccum += calcDist * accumCoef;
-            lng0 = lat0 = lng1 = lat1 = NAN;
+            tempo_stopBlock("dist_toF32");
+            clock_gettime(CLOCK_MONOTONIC, &calcStart);
+            tempo_startBlock("dist_calc32");
+            tempo_countBytes(pairs32.count * 4 * sizeof(f32));
+            tempo_countItems(pairs32.count);
+            dispatch.haversine32(pairs32.lng0, pairs32.lat0, pairs32.lng1, pairs32.lat1, dists32, pairs32.count);
+            tempo_stopBlock("dist_calc32");
+            clock_gettime(CLOCK_MONOTONIC, &calcEnd);
+            calcMs = getElapsedMillis(calcStart, calcEnd);
+            for (u64 i = 0; i < pairs.count; i++) {
+                pairsProcessed++;
+                dists[i] = (f64) dists32[i];
+                blockedSum_add(&sum, dists[i]);
+            }
+
+            // Same pairs through the f64 polynomial kernel, the same method in double, to put a price on the precision
+            struct timespec kernelStart, kernelEnd;
+            clock_gettime(CLOCK_MONOTONIC, &kernelStart);
+            tempo_startBlock("dist_calc64");
+            tempo_countBytes(pairs.count * 4 * sizeof(f64));
+            tempo_countItems(pairs.count);
+            dispatch.haversineFast(pairs.lng0, pairs.lat0, pairs.lng1, pairs.lat1, dists, pairs.count);
+            tempo_stopBlock("dist_calc64");
+            clock_gettime(CLOCK_MONOTONIC, &kernelEnd);
+            f64KernelMs = getElapsedMillis(kernelStart, kernelEnd);
+            for (u64 i = 0; i < pairs.count; i++) {
+                dists[i] = (f64) dists32[i];
+            }
+            free(dists32);
+            pairs32_free(&pairs32);
+        } else if (isApprox) {
+            // Timed against the polynomial kernel the fallback pairs go through. Both would otherwise pay for
+            // first touching the inputs and the output, so warm them up
+            tempo_startBlock("dist_warmup");
+            dispatch.haversineFast(pairs.lng0, pairs.lat0, pairs.lng1, pairs.lat1, dists, pairs.count);
+            tempo_stopBlock("dist_warmup");
+            struct timespec kernelStart, kernelEnd;
+            clock_gettime(CLOCK_MONOTONIC, &kernelStart);
+            tempo_startBlock("dist_calc64");
+            tempo_countBytes(pairs.count * 4 * sizeof(f64));
+            tempo_countItems(pairs.count);
+            dispatch.haversineFast(pairs.lng0, pairs.lat0, pairs.lng1, pairs.lat1, dists, pairs.count);
+            tempo_stopBlock("dist_calc64");
+            clock_gettime(CLOCK_MONOTONIC, &kernelEnd);
+            f64KernelMs = getElapsedMillis(kernelStart, kernelEnd);
 
-            if (hasDist) {
-                f64 knownDist = 0.0;
-                memcpy(&knownDist, distFile.data + distFile.position, sizeof(f64));
-                distFile.position += sizeof(f64);
-                f64 diff = fabs(knownDist - calcDist);
-                if (diff >= (DBL_EPSILON * 1.0)) {
-                    distDriftCount++;
-                    if (diff > maxDistDrift) {
-                        maxDistDrift = diff;
-                        maxDistPairIdx = pairsProcessed;
-                    }
+            clock_gettime(CLOCK_MONOTONIC, &calcStart);
+            tempo_startBlock("dist_calcApprox");
+            tempo_countBytes(pairs.count * 4 * sizeof(f64));
+            tempo_countItems(pairs.count);
+            approxFullCount = dispatch.haversineApprox(pairs.lng0, pairs.lat0, pairs.lng1, pairs.lat1, dists, pairs.count, approxTolerance / 1000.0);
+            tempo_stopBlock("dist_calcApprox");
+            clock_gettime(CLOCK_MONOTONIC, &calcEnd);
+            calcMs = getElapsedMillis(calcStart, calcEnd);
+            for (u64 i = 0; i < pairs.count; i++) {
+                pairsProcessed++;
+                blockedSum_add(&sum, dists[i]);
+            }
+        } else {
+            clock_gettime(CLOCK_MONOTONIC, &calcStart);
+            tempo_startBlock("dist_calc");
+            tempo_countBytes(pairs.count * 4 * sizeof(f64));
+            tempo_countItems(pairs.count);
+            f64 blockDists[HAVERSINE_SUM_BLOCK_PAIRS];  // Stands in for dists when nothing keeps them
+            for (u64 start = 0; start < pairs.count; start += HAVERSINE_SUM_BLOCK_PAIRS) {
+                u64 count = MIN(HAVERSINE_SUM_BLOCK_PAIRS, pairs.count - start);
+                f64* out = dists != NULL ? dists + start : blockDists;
+                haversineKernel(pairs.lng0 + start, pairs.lat0 + start, pairs.lng1 + start, pairs.lat1 + start, out, count);
+                for (u64 i = 0; i < count; i++) {
+                    pairsProcessed++;
+                    blockedSum_add(&sum, out[i]);
+                    maxDist = MAX(maxDist, out[i]);
                 }
             }
+            tempo_stopBlock("dist_calc");
+            clock_gettime(CLOCK_MONOTONIC, &calcEnd);
+            calcMs = getElapsedMillis(calcStart, calcEnd);
         }
+        calcAccum = blockedSum_result(sum, pairsProcessed);
+
+        if (hasDist) {
+            dist_checkKnownCount(pairs.count, knownCount);
+            struct timespec valStart, valEnd;
+            clock_gettime(CLOCK_MONOTONIC, &valStart);
+            tempo_startBlock("dist_validate");
+            tempo_countItems(pairs.count);
+            validate_range(&report, &pairs, dists, knownDists, 0, pairs.count, 0);
+            tempo_stopBlock("dist_validate");
+            clock_gettime(CLOCK_MONOTONIC, &valEnd);
+            validateMs = getElapsedMillis(valStart, valEnd);
+        }
+
+        if (threadCount > 0) {
+            // Baseline for the scaling figure: identical work, only the thread count differs
+            struct timespec singleStart, singleEnd;
+            clock_gettime(CLOCK_MONOTONIC, &singleStart);
+            tempo_startBlock("dist_calcSingle");
+            haversine_sumParallel(&pairs, 1, haversineKernel);
+            tempo_stopBlock("dist_calcSingle");
+            clock_gettime(CLOCK_MONOTONIC, &singleEnd);
+            singleMs = getElapsedMillis(singleStart, singleEnd);
+
+            struct timespec parStart, parEnd;
+            clock_gettime(CLOCK_MONOTONIC, &parStart);
+            tempo_startBlock("dist_calcParallel");
+            parallelAccum = haversine_sumParallel(&pairs, threadCount, haversineKernel);
+            tempo_stopBlock("dist_calcParallel");
+            clock_gettime(CLOCK_MONOTONIC, &parEnd);
+            parallelMs = getElapsedMillis(parStart, parEnd);
+        }
+
+        if (hasQuery || hasNearest) {
+            dist_runSpatial(&pairs, query, hasQuery, nearest, hasNearest);
+        }
+
+        tempo_startBlock("cleanup");
+        if (isBinary) {
+            munmapFile(&binFile);  // Pairs were a view into the mapping
+        } else {
+            json_freeFile(&jsonFile);
+            pairs_free(&pairs);
+        }
+        if (!hasOut) {
+            free(dists);
+        }
+        tempo_stopBlock("cleanup");
+    }
+    if (hasOut) {
+        tempo_startBlock("dist_writeOut");
+        outDists[pairsProcessed] = calcAccum;
+        munmapFileWrite(&outFile, (pairsProcessed + 1) * sizeof(f64));
+        tempo_stopBlock("dist_writeOut");
     }
-    tempo_stopBlock("dist_calc");
     if (hasDist) {
         u64 lastOffset = distFile.size - sizeof(f64);
         memcpy(&distCheckFinal, distFile.data + lastOffset, sizeof(f64));
     }
 
-    if (distDriftCount > 0) {
-        printf("WARNING: Found %llu distance errors greater than DBL_EPSILON (%E): max error %E at pair %llu\n", distDriftCount, (f64) DBL_EPSILON, maxDistDrift, maxDistPairIdx);
+    if (hasDist) {
+        validate_print(&report);
+        if (validateMs > 0.0) {
+            printf("Validation took %.3fms (%.3f ns/pair)\n", validateMs, (validateMs * 1000000.0) / (f64) MAX(1, report.pairCount));
+        }
     }
 
-    tempo_startBlock("cleanup");
     if (hasDist) {
         munmapFile(&distFile);
     }
-    json_freeFile(&jsonFile);
-    tempo_stopBlock("cleanup");
 
-    printf("Read and parsed %llu bytes in %s: %llu elements\n", jsonFileSize, jsonFilename, jsonElementCount);
+    if (isPipeline) {
+        printf("Read and parsed %llu bytes in %s: pipelined, no elements kept\n", jsonFileSize, jsonFilename);
+        printf("Pipeline with %u workers, %llu-pair batches, queue depth %llu: %.3fms (%.3f MB/s)\n",
+            pipelineConfig.workerCount, pipelineConfig.batchSize, pipelineConfig.queueDepth,
+            calcMs, ((f64) jsonFileSize / (1024.0 * 1024.0)) / (calcMs / 1000.0));
+    } else if (isIncremental) {
+        printf("Read %llu bytes in %s: incremental, %.3fms\n", jsonFileSize, jsonFilename, calcMs);
+    } else if (isFused) {
+        printf("Read and parsed %llu bytes in %s: fused, no elements kept\n", jsonFileSize, jsonFilename);
+        printf("Fused parse and calculate: %.3fms (%.3f MB/s)\n", calcMs, ((f64) jsonFileSize / (1024.0 * 1024.0)) / (calcMs / 1000.0));
+    } else if (isBinary) {
+        printf("Mapped %llu bytes in %s: binary pairs, no parsing\n", jsonFileSize, jsonFilename);
+    } else {
+        printf("Read and parsed %llu bytes in %s: %llu elements\n", jsonFileSize, jsonFilename, jsonElementCount);
+    }
     printf("Calculated%s distance for %llu coordinate pairs.\n", hasDist ? " and checked" : "", pairsProcessed);
+    if (isF32) {
+        f64 nsPerPair = 1000000.0 / (f64) MAX(1, pairsProcessed);
+        printf("Precision f32: %.3fms (%.3f ns/pair) vs f64 polynomial kernel %.3fms (%.3f ns/pair), %.2fx\n",
+            calcMs, calcMs * nsPerPair, f64KernelMs, f64KernelMs * nsPerPair, calcMs > 0.0 ? f64KernelMs / calcMs : 0.0);
+    }
+    if (isApprox) {
+        f64 nsPerPair = 1000000.0 / (f64) MAX(1, pairsProcessed);
+        u64 cheapCount = pairsProcessed - approxFullCount;
+        printf("Approx within %.3f m: %llu cheap pairs (%.2f%%), %llu haversine\n",
+            approxTolerance, cheapCount, 100.0 * (f64) cheapCount / (f64) MAX(1, pairsProcessed), approxFullCount);
+        printf("Approx: %.3fms (%.3f ns/pair) vs f64 polynomial kernel %.3fms (%.3f ns/pair), %.2fx\n",
+            calcMs, calcMs * nsPerPair, f64KernelMs, f64KernelMs * nsPerPair, calcMs > 0.0 ? f64KernelMs / calcMs : 0.0);
+        if (report.pairCount > 0) {
+            printf("Approx max error %.6f m %s the tolerance\n", report.maxAbsError * 1000.0,
+                report.maxAbsError * 1000.0 <= approxTolerance ? "is within" : "EXCEEDS");
+        }
+    }
     printf("Final sum:   %.16f\n", calcAccum);
+    if (hasOut) {
+        printf("Wrote %llu distances and the average to %s\n", pairsProcessed, outFilename);
+    }
     if (hasDist) {
         printf("Checked sum: %.16f\n", distCheckFinal);
     }
-    if (maxDistDrift > 0.0) {
-        printf("Max pair error: %.16f at pair index %llu\n", maxDistDrift, maxDistPairIdx);
+    if (report.worstCount > 0 && report.maxAbsError > 0.0) {
+        printf("Max pair error: %.16f at pair index %llu\n", report.maxAbsError, report.worst[0].pairIdx + 1);
+    }
+    if (isFast) {
+        f64 errorBound = haversine_fastErrorBound(maxDist);
+        printf("Fast kernel (%s): approximate, each distance within %.3E km of the reference\n", ISA_STRS[dispatch.level], errorBound);
+        if (report.pairCount > 0) {
+            printf("Fast max error %.3E km %s the bound\n", report.maxAbsError, report.maxAbsError <= errorBound ? "is within" : "EXCEEDS");
+        }
+    }
+    if (threadCount > 0 && !isFused && !isPipeline) {
+        f64 speedup = parallelMs > 0.0 ? singleMs / parallelMs : 0.0;
+        printf("Parallel sum: %.16f (%u threads, %llu-pair blocks)\n", parallelAccum, threadCount, (u64) HAVERSINE_SUM_BLOCK_PAIRS);
+        printf("Parallel diff from final sum: %E\n", parallelAccum - calcAccum);
+        if (hasDist) {
+            printf("Parallel diff from checked sum: %E\n", parallelAccum - distCheckFinal);
+        }
+        printf("Parallel scaling: %.3fms single vs %.3fms parallel (%.2fx, %.1f%% efficiency)\n",
+            singleMs, parallelMs, speedup, (speedup / (f64) threadCount) * 100.0);
     }
     printf("\n");
 
     tempo_stopProfile();
     tempo_printProfile();
+    if (hasTrace) {
+        tempo_writeTrace(traceFilename);
+    }
 
     return 0;
 }
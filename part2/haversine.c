@@ -0,0 +1,191 @@
+//
+// Created by stevehb on 19-Oct-26.
+//
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "types.h"
+#include "common_funcs.h"
+#include "dispatch.h"
+#include "haversine.h"
+
+// The polynomial sin/cos are good to about 1 ulp, so a = sin^2 + cos*cos*sin^2, a sum of non-negative products,
+// is within this of the reference relative to a
+#define HAVERSINE_FAST_A_ERR (16.0 * DBL_EPSILON)
+
+typedef struct {
+    PairArrays* pairs;
+    HaversineKernel kernel;
+    NeumaierSum* blockSums;
+    u64 firstBlock, endBlock;
+} SumWork;
+
+void pairs_append(PairArrays* pairs, f64 lng0, f64 lat0, f64 lng1, f64 lat1) {
+    if (pairs->count + 1 > pairs->capacity) {
+        u64 newCapacity = pairs->capacity == 0 ? 1024 : (pairs->capacity * 2);
+        u64 newSize = newCapacity * sizeof(f64);
+        f64* cols[4] = { pairs->lng0, pairs->lat0, pairs->lng1, pairs->lat1 };
+        for (u32 c = 0; c < 4; c++) {
+            cols[c] = realloc(cols[c], newSize);
+            if (cols[c] == NULL) {
+                fprintf(stderr, "ERROR: Memory re-alloc failed for %llu bytes\n", newSize);
+                exit(1);
+            }
+        }
+        pairs->lng0 = cols[0];
+        pairs->lat0 = cols[1];
+        pairs->lng1 = cols[2];
+        pairs->lat1 = cols[3];
+        pairs->capacity = newCapacity;
+    }
+    u64 idx = pairs->count++;
+    pairs->lng0[idx] = lng0;
+    pairs->lat0[idx] = lat0;
+    pairs->lng1[idx] = lng1;
+    pairs->lat1[idx] = lat1;
+}
+void pairs_free(PairArrays* pairs) {
+    free(pairs->lng0);
+    free(pairs->lat0);
+    free(pairs->lng1);
+    free(pairs->lat1);
+    *pairs = (PairArrays){ 0 };
+}
+PairArrays32 pairs32_fromPairs(const PairArrays* pairs) {
+    PairArrays32 result = { 0 };
+    u64 size = MAX(1, pairs->count) * sizeof(f32);
+    result.lng0 = malloc(size);
+    result.lat0 = malloc(size);
+    result.lng1 = malloc(size);
+    result.lat1 = malloc(size);
+    if (result.lng0 == NULL || result.lat0 == NULL || result.lng1 == NULL || result.lat1 == NULL) {
+        fprintf(stderr, "ERROR: Memory alloc failed for %llu f32 pairs\n", pairs->count);
+        exit(1);
+    }
+    for (u64 i = 0; i < pairs->count; i++) {
+        result.lng0[i] = (f32) pairs->lng0[i];
+        result.lat0[i] = (f32) pairs->lat0[i];
+        result.lng1[i] = (f32) pairs->lng1[i];
+        result.lat1[i] = (f32) pairs->lat1[i];
+    }
+    result.count = pairs->count;
+    return result;
+}
+void pairs32_free(PairArrays32* pairs) {
+    free(pairs->lng0);
+    free(pairs->lat0);
+    free(pairs->lng1);
+    free(pairs->lat1);
+    *pairs = (PairArrays32){ 0 };
+}
+
+void neumaier_add(NeumaierSum* acc, f64 value) {
+    f64 t = acc->sum + value;
+    if (fabs(acc->sum) >= fabs(value)) {
+        acc->comp += (acc->sum - t) + value;
+    } else {
+        acc->comp += (value - t) + acc->sum;
+    }
+    acc->sum = t;
+}
+f64 neumaier_result(NeumaierSum acc) {
+    return acc.sum + acc.comp;
+}
+void neumaier_addPartial(NeumaierSum* acc, NeumaierSum partial) {
+    neumaier_add(acc, partial.sum);
+    neumaier_add(acc, partial.comp);
+}
+
+void blockedSum_add(BlockedSum* acc, f64 value) {
+    neumaier_add(&acc->block, value);
+    if (++acc->blockFill == HAVERSINE_SUM_BLOCK_PAIRS) {
+        neumaier_addPartial(&acc->total, acc->block);
+        acc->block = (NeumaierSum){ 0 };
+        acc->blockFill = 0;
+    }
+}
+f64 blockedSum_result(BlockedSum acc, u64 count) {
+    if (count == 0) return 0.0;
+    if (acc.blockFill > 0) {
+        neumaier_addPartial(&acc.total, acc.block);
+    }
+    return neumaier_result(acc.total) / (f64) count;
+}
+
+void haversine_reference(const f64* lng0, const f64* lat0, const f64* lng1, const f64* lat1, f64* out, u64 count) {
+    for (u64 i = 0; i < count; i++) {
+        out[i] = referenceHaversineDistance(lng0[i], lat0[i], lng1[i], lat1[i], EARTH_RAD);
+    }
+}
+
+/// asin(sqrt(a)) only gets steeper as a grows, towards antipodal pairs, so the spread at the longest distance
+/// bounds every shorter pair too
+f64 haversine_fastErrorBound(f64 maxDist) {
+    f64 sinHalf = sin(maxDist / (2.0 * EARTH_RAD));
+    f64 a = sinHalf * sinHalf;
+    f64 low = a * (1.0 - HAVERSINE_FAST_A_ERR);
+    f64 high = MIN(1.0, a * (1.0 + HAVERSINE_FAST_A_ERR));
+    f64 spread = asin(sqrt(high)) - asin(sqrt(low));
+    // Plus a few ulp of the distance from the asin polynomial and the final multiply
+    return 2.0 * EARTH_RAD * spread + maxDist * 8.0 * DBL_EPSILON;
+}
+
+static void haversine_sumBlocks(void* arg) {
+    SumWork* work = arg;
+    PairArrays* pairs = work->pairs;
+    f64 dists[HAVERSINE_SUM_BLOCK_PAIRS];
+    for (u64 blockIdx = work->firstBlock; blockIdx < work->endBlock; blockIdx++) {
+        u64 start = blockIdx * HAVERSINE_SUM_BLOCK_PAIRS;
+        u64 end = MIN(start + HAVERSINE_SUM_BLOCK_PAIRS, pairs->count);
+        work->kernel(pairs->lng0 + start, pairs->lat0 + start, pairs->lng1 + start, pairs->lat1 + start, dists, end - start);
+        NeumaierSum acc = { 0 };
+        for (u64 i = 0; i < end - start; i++) {
+            neumaier_add(&acc, dists[i]);
+        }
+        work->blockSums[blockIdx] = acc;
+    }
+}
+
+/// Returns the average distance. Each fixed-size block is summed on its own and the
+/// block partials are combined in block order, so the result is bit-identical for any
+/// thread count.
+f64 haversine_sumParallel(PairArrays* pairs, u32 threadCount, HaversineKernel kernel) {
+    if (pairs->count == 0) return 0.0;
+    u64 blockCount = (pairs->count + HAVERSINE_SUM_BLOCK_PAIRS - 1) / HAVERSINE_SUM_BLOCK_PAIRS;
+    threadCount = (u32) MAX(1, MIN(threadCount, blockCount));
+    NeumaierSum* blockSums = malloc(blockCount * sizeof(NeumaierSum));
+    SumWork* work = malloc(threadCount * sizeof(SumWork));
+    ThreadHandle* threads = malloc(threadCount * sizeof(ThreadHandle));
+    if (blockSums == NULL || work == NULL || threads == NULL) {
+        fprintf(stderr, "ERROR: Memory alloc failed for %llu sum blocks\n", blockCount);
+        exit(1);
+    }
+
+    for (u32 t = 0; t < threadCount; t++) {
+        work[t].pairs = pairs;
+        work[t].kernel = kernel;
+        work[t].blockSums = blockSums;
+        work[t].firstBlock = (blockCount * t) / threadCount;
+        work[t].endBlock = (blockCount * (t + 1)) / threadCount;
+    }
+    // The calling thread takes the first slice itself
+    for (u32 t = 1; t < threadCount; t++) {
+        threads[t] = thread_start(haversine_sumBlocks, &work[t]);
+    }
+    haversine_sumBlocks(&work[0]);
+    for (u32 t = 1; t < threadCount; t++) {
+        thread_join(&threads[t]);
+    }
+
+    NeumaierSum total = { 0 };
+    for (u64 blockIdx = 0; blockIdx < blockCount; blockIdx++) {
+        neumaier_addPartial(&total, blockSums[blockIdx]);
+    }
+    free(threads);
+    free(work);
+    free(blockSums);
+    return neumaier_result(total) / (f64) pairs->count;
+}
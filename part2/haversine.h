@@ -0,0 +1,65 @@
+//
+// Created by stevehb on 19-Oct-26.
+//
+
+#ifndef HAVERSINE_H
+#define HAVERSINE_H
+
+#include "types.h"
+#include "dispatch.h"
+
+// Pairs per reduction block. The block shape is fixed so that the summation
+// order never depends on how many threads share the work.
+#define HAVERSINE_SUM_BLOCK_PAIRS 4096
+
+typedef struct PairArrays {
+    f64* lng0;
+    f64* lat0;
+    f64* lng1;
+    f64* lat1;
+    u64 count;
+    u64 capacity;
+} PairArrays;
+
+/// Single-precision copy of the coordinate columns for the f32 kernels
+typedef struct PairArrays32 {
+    f32* lng0;
+    f32* lat0;
+    f32* lng1;
+    f32* lat1;
+    u64 count;
+} PairArrays32;
+
+typedef struct NeumaierSum {
+    f64 sum;
+    f64 comp;
+} NeumaierSum;
+
+// Running form of the blocked reduction, for callers that see one pair at a time.
+// Produces the same bits as haversine_sumParallel for the same distances.
+typedef struct BlockedSum {
+    NeumaierSum total;
+    NeumaierSum block;
+    u64 blockFill;
+} BlockedSum;
+
+void pairs_append(PairArrays* pairs, f64 lng0, f64 lat0, f64 lng1, f64 lat1);
+void pairs_free(PairArrays* pairs);
+PairArrays32 pairs32_fromPairs(const PairArrays* pairs);
+void pairs32_free(PairArrays32* pairs);
+
+void neumaier_add(NeumaierSum* acc, f64 value);
+f64 neumaier_result(NeumaierSum acc);
+void neumaier_addPartial(NeumaierSum* acc, NeumaierSum partial);
+
+void blockedSum_add(BlockedSum* acc, f64 value);
+f64 blockedSum_result(BlockedSum acc, u64 count);
+
+/// referenceHaversineDistance over arrays, the same bits coord_gen writes to its answer file on every ISA
+void haversine_reference(const f64* lng0, const f64* lat0, const f64* lng1, const f64* lat1, f64* out, u64 count);
+/// Largest difference in km between dispatch.haversineFast and haversine_reference for pairs up to `maxDist` km apart
+f64 haversine_fastErrorBound(f64 maxDist);
+
+f64 haversine_sumParallel(PairArrays* pairs, u32 threadCount, HaversineKernel kernel);
+
+#endif //HAVERSINE_H
@@ -0,0 +1,82 @@
+//
+// Created by stevehb on 19-Oct-26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#include "types.h"
+#include "common_funcs.h"
+#include "incremental.h"
+
+#define INCREMENTAL_STATE_MAGIC "HAVERSINE_STATE"
+
+// Floats are stored as hex so they round-trip exactly
+bool incremental_load(const char* filename, IncrementalState* out_state) {
+    memset(out_state, 0, sizeof(*out_state));
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) return false;
+
+    IncrementalState state = { 0 };
+    char magic[32] = { 0 };
+    u32 version = 0;
+    int matched = fscanf(file, "%31s %u offset %llu pairs %llu tail_hash %llx "
+                               "total_sum %la total_comp %la block_sum %la block_comp %la block_fill %llu",
+        magic, &version, &state.byteOffset, &state.pairCount, &state.tailHash,
+        &state.sum.total.sum, &state.sum.total.comp, &state.sum.block.sum, &state.sum.block.comp, &state.sum.blockFill);
+    fclose(file);
+    if (matched != 10 || strcmp(magic, INCREMENTAL_STATE_MAGIC) != 0 || version != INCREMENTAL_STATE_VERSION) {
+        fprintf(stderr, "WARNING: Ignoring unreadable state file %s\n", filename);
+        return false;
+    }
+    *out_state = state;
+    return true;
+}
+
+void incremental_save(const char* filename, const IncrementalState* state) {
+    char tmpFilename[FILENAME_LEN + 8] = { 0 };
+    snprintf(tmpFilename, sizeof(tmpFilename), "%s.tmp", filename);
+    FILE* file = fopen(tmpFilename, "w");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR: Failed to write state file %s\n", tmpFilename);
+        exit(1);
+    }
+    fprintf(file, "%s %u\n", INCREMENTAL_STATE_MAGIC, INCREMENTAL_STATE_VERSION);
+    fprintf(file, "offset %llu\n", state->byteOffset);
+    fprintf(file, "pairs %llu\n", state->pairCount);
+    fprintf(file, "tail_hash %016llx\n", state->tailHash);
+    fprintf(file, "total_sum %a\n", state->sum.total.sum);
+    fprintf(file, "total_comp %a\n", state->sum.total.comp);
+    fprintf(file, "block_sum %a\n", state->sum.block.sum);
+    fprintf(file, "block_comp %a\n", state->sum.block.comp);
+    fprintf(file, "block_fill %llu\n", state->sum.blockFill);
+    if (fclose(file) != 0) {
+        fprintf(stderr, "ERROR: Failed to write state file %s\n", tmpFilename);
+        exit(1);
+    }
+#ifdef _WIN32
+    bool isMoved = MoveFileExA(tmpFilename, filename, MOVEFILE_REPLACE_EXISTING);
+#else
+    bool isMoved = rename(tmpFilename, filename) == 0;
+#endif
+    if (!isMoved) {
+        fprintf(stderr, "ERROR: Failed to replace state file %s\n", filename);
+        exit(1);
+    }
+}
+
+u64 incremental_tailHash(const char* data, u64 offset) {
+    u64 start = offset > INCREMENTAL_TAIL_BYTES ? offset - INCREMENTAL_TAIL_BYTES : 0;
+    u64 hash = 0xcbf29ce484222325ull;  // FNV-1a
+    for (u64 i = start; i < offset; i++) {
+        hash ^= (u8) data[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash ^ offset;
+}
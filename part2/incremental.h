@@ -0,0 +1,32 @@
+//
+// Created by stevehb on 19-Oct-26.
+//
+
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <stdbool.h>
+
+#include "types.h"
+#include "haversine.h"
+
+#define INCREMENTAL_STATE_VERSION 2
+#define INCREMENTAL_STATE_SUFFIX ".state"
+// Bytes before the resume offset that are hashed to notice an input that was rewritten rather than appended to
+#define INCREMENTAL_TAIL_BYTES 64
+
+/// Progress through an append-only pairs file, kept in a sidecar next to it
+typedef struct IncrementalState {
+    u64 byteOffset;  // Just past the closing brace of the last pair that was processed
+    u64 pairCount;
+    BlockedSum sum;  // Same running blocked sum as the fused mode, so resuming gives the bits of a full recompute
+    u64 tailHash;
+} IncrementalState;
+
+/// Returns false, leaving `out_state` zeroed, if there is no usable state file
+bool incremental_load(const char* filename, IncrementalState* out_state);
+/// Writes to a temporary file and renames it over `filename`, so a crash never leaves a torn state
+void incremental_save(const char* filename, const IncrementalState* state);
+u64 incremental_tailHash(const char* data, u64 offset);
+
+#endif //INCREMENTAL_H
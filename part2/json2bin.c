@@ -0,0 +1,67 @@
+//
+// Created by stevehb on 19-Oct-26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "types.h"
+#include "common_funcs.h"
+#include "dispatch.h"
+#include "haversine.h"
+#include "json_parser.h"
+#include "pairs_bin.h"
+#include "tempo.h"
+
+static void json2bin_onPair(void* ctx, f64 lng0, f64 lat0, f64 lng1, f64 lat1) {
+    pairs_append((PairArrays*) ctx, lng0, lat0, lng1, lat1);
+}
+
+int main(int argc, char** argv) {
+    setbuf(stdout, NULL);
+    setbuf(stderr, NULL);
+    dispatch_init(NULL);
+
+    char jsonFilename[FILENAME_LEN] = { 0 };
+    char binFilename[FILENAME_LEN] = { 0 };
+    bool hasJson = getParamValue_str(argc, argv, 1, jsonFilename, FILENAME_LEN);
+    bool hasBin = getParamValue_str(argc, argv, 2, binFilename, FILENAME_LEN);
+    if (!hasJson) {
+        const char* progName = basename(argv[0]);
+        fprintf(stdout, "Usage: %s jsonFilename [binFilename]\n", progName);
+        fprintf(stdout, "  jsonFilename    generated JSON file with coordinate pairs\n");
+        fprintf(stdout, "  binFilename     binary pairs file to write (default: jsonFilename with .bin)\n");
+        exit(0);
+    }
+    if (!hasBin) {
+        snprintf(binFilename, FILENAME_LEN, "%s", jsonFilename);
+        char* ext = strrchr(binFilename, '.');
+        if (ext != NULL && strcmp(ext, ".json") == 0) {
+            *ext = '\0';
+        }
+        strncat(binFilename, ".bin", FILENAME_LEN - strlen(binFilename) - 1);
+    }
+
+    tempo_startProfile("JSON2BIN");
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    PairArrays pairs = { 0 };
+    JsonStreamResult stream = json_streamPairs(jsonFilename, json2bin_onPair, &pairs);
+    tempo_startBlock("bin_write");
+    tempo_countBytes(pairs.count * 4 * sizeof(f64));
+    tempo_countItems(pairs.count);
+    pairsBin_write(binFilename, &pairs);
+    tempo_stopBlock("bin_write");
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    tempo_stopProfile();
+
+    printf("Converted %llu pairs (%llu bytes of JSON) from %s to %s in %.3fms\n",
+        pairs.count, stream.fileSize, jsonFilename, binFilename, getElapsedMillis(start, end));
+    printf("Checksum: 0x%016llX\n", pairsBin_checksum(&pairs));
+    printf("\n");
+    tempo_printProfile();
+    pairs_free(&pairs);
+    return 0;
+}
@@ -3,12 +3,15 @@
 //
 
 #include <assert.h>
+#include <errno.h>
+#include <float.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "common_funcs.h"
+#include "dispatch.h"
 #include "json_parser.h"
 #include "tempo.h"
 
@@ -40,13 +43,16 @@ static const char* TOKEN_STRS[] = {
 
 
 static u64 json_getLenWhile(FileState* state, char* validChars);
-static u64 json_getLenUntil(FileState* state, char* delims);
+static u64 json_getStringLen(FileState* state);
 static u64 json_addElement(JsonFile* file, JsonElement element);
-static u64 json_findStrInHaystack(char* haystack, u64 haystackSize, char* needle, u64 needleLen);
-static u64 json_ingestString(FileState* state, JsonFile* file);
+static u64 json_findName(JsonFile* file, const char* needle, u64 needleLen);
+static u64 json_ingestString(FileState* state, JsonFile* file, bool isName);
+static bool json_parseSimpleNumber(const char* str, u64 len, f64* out);
 static f64 json_ingestNumber(FileState* state);
 static u64 json_consumeWhitespace(FileState* state);
 static JsonToken json_getToken(char c);
+static s32 json_pairKeyIdx(const char* key, u64 keyLen);
+static JsonStreamResult json_streamPairsFrom(const char* data, u64 size, u64 startOffset, bool isInPairs, JsonPairFunc onPair, void* ctx);
 
 static u64 json_getLenWhile(FileState* state, char* validChars) {
     u64 startPos = state->position;
@@ -67,25 +73,18 @@ static u64 json_getLenWhile(FileState* state, char* validChars) {
     }
     return idx - startPos;
 }
-static u64 json_getLenUntil(FileState* state, char* delims) {
+static u64 json_getStringLen(FileState* state) {
+    // Jump between quotes and backslashes with the SIMD scan, stepping over whatever each backslash escapes
     u64 startPos = state->position;
     u64 idx = startPos;
-    char prevC = '\0';
     while (idx < state->size) {
-        char c = state->data[idx];
-        for (char* d = delims; *d != '\0'; d++) {
-            if (*d == c) {
-                if (*d == '"' && prevC == '\\') {
-                    // Escaped quotation mark should not match a quotation mark delimiter
-                    continue;
-                }
-                return idx - startPos;
-            }
+        idx += dispatch.scanStringEnd(state->data + idx, state->size - idx);
+        if (idx >= state->size || state->data[idx] == '"') {
+            break;
         }
-        prevC = c;
-        idx++;
+        idx += 2;
     }
-    return idx - startPos;
+    return (idx < state->size ? idx : state->size) - startPos;
 }
 static u64 json_addElement(JsonFile* file, JsonElement element) {
     if (file->elementCount + 1 > file->elementCapacity) {
@@ -103,25 +102,19 @@ static u64 json_addElement(JsonFile* file, JsonElement element) {
     file->elements[file->elementCount++] = element;
     return file->elementCount - 1;
 }
-static u64 json_findStrInHaystack(char* haystack, u64 haystackSize, char* needle, u64 needleLen) {
-    u64 haystackIdx = 1;  // 0 Reserved for not found
-    while (haystackIdx < haystackSize) {
-        u64 hayLen = strlen(haystack + haystackIdx);
-        if (needleLen == hayLen) {
-            bool isEqual = memcmp(haystack + haystackIdx, needle, needleLen) == 0;
-            if (isEqual) {
-                return haystackIdx;
-            }
+static u64 json_findName(JsonFile* file, const char* needle, u64 needleLen) {
+    for (u64 i = 0; i < file->nameCount; i++) {
+        if (file->nameLens[i] == needleLen && memcmp(file->stringBuff + file->nameOffsets[i], needle, needleLen) == 0) {
+            return file->nameOffsets[i];
         }
-        haystackIdx += hayLen + 1;
     }
-    return 0;
+    return 0;  // 0 Reserved for not found
 }
-static u64 json_ingestString(FileState* state, JsonFile* file) {
-    u64 needleLen = json_getLenUntil(state, "\"");
-    // Try to find exising string
-    {
-        u64 existingOffset = json_findStrInHaystack(file->stringBuff, file->stringBuffUsed, state->data + state->position, needleLen);
+static u64 json_ingestString(FileState* state, JsonFile* file, bool isName) {
+    u64 needleLen = json_getStringLen(state);
+    // Try to find exising name
+    if (isName) {
+        u64 existingOffset = json_findName(file, state->data + state->position, needleLen);
         if (existingOffset != 0) {
             state->position += needleLen + 1;  // Consume closing quotation mark
             return existingOffset;
@@ -153,29 +146,111 @@ static u64 json_ingestString(FileState* state, JsonFile* file) {
     file->stringBuff[buffIdx + needleLen] = '\0';
     file->stringBuffUsed += needleLen + 1;
     state->position += needleLen + 1;  // Consume closing quotation mark
+    if (isName) {
+        if (file->nameCount + 1 > file->nameCapacity) {
+            u64 newCapacity = file->nameCapacity == 0 ? 32 : (file->nameCapacity * 2);
+            u64* newOffsets = realloc(file->nameOffsets, newCapacity * sizeof(u64));
+            if (newOffsets == NULL) {
+                fprintf(stderr, "ERROR: Memory re-alloc failed for %llu bytes\n", newCapacity * sizeof(u64));
+                exit(1);
+            }
+            file->nameOffsets = newOffsets;
+            u64* newLens = realloc(file->nameLens, newCapacity * sizeof(u64));
+            if (newLens == NULL) {
+                fprintf(stderr, "ERROR: Memory re-alloc failed for %llu bytes\n", newCapacity * sizeof(u64));
+                exit(1);
+            }
+            file->nameLens = newLens;
+            file->nameCapacity = newCapacity;
+        }
+        file->nameOffsets[file->nameCount] = buffIdx;
+        file->nameLens[file->nameCount++] = needleLen;
+    }
     return buffIdx;
 }
-static f64 json_ingestNumber(FileState* state) {
-    u64 numLen = json_getLenWhile(state, "-.0123456789");
+static bool json_parseSimpleNumber(const char* str, u64 len, f64* out) {
+    // Clinger's fast path: an exact mantissa divided by an exact power of ten rounds once, so it matches strtod.
+    // That needs the mantissa to fit in 53 bits. coord_gen writes up to 19 digits, which fit the 64-bit x87
+    // long double instead, and its quotient is kept unless rounding it to f64 could land on the wrong side of a tie.
+    static const f64 POW10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    u64 idx = 0;
+    bool isNegative = len > 0 && str[0] == '-';
+    idx += isNegative;
+    u64 mantissa = 0;
+    u32 digitCount = 0;
+    u32 fracDigits = 0;
+    bool seenDot = false;
+    for (; idx < len; idx++) {
+        char c = str[idx];
+        if (c >= '0' && c <= '9') {
+            if (++digitCount > 19) return false;
+            mantissa = mantissa * 10 + (u64) (c - '0');
+            fracDigits += seenDot;
+        } else if (c == '.' && !seenDot) {
+            seenDot = true;
+        } else {
+            return false;  // Exponents and anything odd go to strtod
+        }
+    }
+    if (digitCount == 0 || fracDigits > 22) {
+        return false;
+    }
+    f64 value = 0.0;
+    if (mantissa <= (1ull << 53)) {
+        value = (f64) mantissa / POW10[fracDigits];
+    } else {
+#if LDBL_MANT_DIG == 64
+        long double wide = (long double) mantissa / (long double) POW10[fracDigits];
+        u64 wideBits = 0;
+        memcpy(&wideBits, &wide, sizeof(wideBits));  // The explicit 64-bit significand
+        // The 11 bits f64 drops: 0x400 is a tie, and the wide quotient itself may be off by one either way
+        u64 droppedBits = wideBits & 0x7FF;
+        if (droppedBits >= 0x3FF && droppedBits <= 0x401) {
+            return false;
+        }
+        value = (f64) wide;
+#else
+        return false;  // No wider type to divide in
+#endif
+    }
+    *out = isNegative ? -value : value;
+    return true;
+}
+/// Returns false and describes the problem in `error` when the number is malformed
+static bool json_readNumber(FileState* state, f64* out, char* error, u64 errorLen) {
+    u64 numLen = dispatch.scanNumber(state->data + state->position, state->size - state->position);
     if (numLen > 64) {
-        fprintf(stderr, "ERROR: Number string is too big. expected less than 64, found %llu\n", numLen);
-        exit(1);
+        snprintf(error, errorLen, "Number string is too big. expected less than 64, found %llu", numLen);
+        return false;
+    }
+    if (json_parseSimpleNumber(state->data + state->position, numLen, out)) {
+        state->position += numLen;
+        return true;
     }
-    char numStr[64] = { 0 };
+    char numStr[65] = { 0 };
     memcpy(numStr, state->data + state->position, numLen);
     errno = 0;
     char* endPtr = NULL;
-    f64 result = strtod(numStr, &endPtr);
+    *out = strtod(numStr, &endPtr);
     if (errno == ERANGE || endPtr == numStr || *endPtr != '\0') {
-        fprintf(stderr, "ERROR: Failed to convert string to f64: errno=%s\n", strerror(errno));
-        fprintf(stderr, "    str: %s\n", numStr);
-        exit(1);
+        snprintf(error, errorLen, "Failed to convert string to f64 at %llu: errno=%s, str: %s", state->position, strerror(errno), numStr);
+        return false;
     }
     state->position += numLen;
+    return true;
+}
+static f64 json_ingestNumber(FileState* state) {
+    f64 result = 0.0;
+    char error[JSON_STREAM_ERROR_LEN];
+    if (!json_readNumber(state, &result, error, sizeof(error))) {
+        fprintf(stderr, "ERROR: %s\n", error);
+        exit(1);
+    }
     return result;
 }
 static u64 json_consumeWhitespace(FileState* state) {
-    u64 wsLen = json_getLenWhile(state, " \t\r\n");
+    u64 wsLen = dispatch.scanWhitespace(state->data + state->position, state->size - state->position);
     state->position += wsLen;
     return wsLen;
 }
@@ -218,12 +293,20 @@ static JsonToken json_getToken(char c) {
         tok = TOK_WHITESPACE;
         break;
     default:
-        fprintf(stderr, "ERROR: Non-token character '%c' (0x%X)\n", c, (int) c);
-        exit(0);
+        break;  // TOK_COUNT, the caller reports where
     }
     return tok;
 }
 
+static s32 json_pairKeyIdx(const char* key, u64 keyLen) {
+    if (keyLen != 4) return -1;
+    if (memcmp(key, "lng0", 4) == 0) return 0;
+    if (memcmp(key, "lat0", 4) == 0) return 1;
+    if (memcmp(key, "lng1", 4) == 0) return 2;
+    if (memcmp(key, "lat1", 4) == 0) return 3;
+    return -1;
+}
+
 JsonFile json_parseFile(const char* filename) {
     tempo_startFunc;
     tempo_startBlock("json_map");
@@ -239,6 +322,7 @@ JsonFile json_parseFile(const char* filename) {
     bool hasPending = false;
     u32 indentLevel = 0;
     tempo_startBlock("json_parseChars");
+    tempo_countBytes(state.size);
     while (state.position < state.size) {
         char c = state.data[state.position++];
         JsonToken tok = json_getToken(c);
@@ -307,10 +391,10 @@ JsonFile json_parseFile(const char* filename) {
             bool needsName = parentEl->type == JSON_OBJECT_BEGIN;
             bool isName = needsName && pendingEl.nameOffset == 0;
             if (isName) {
-                pendingEl.nameOffset = json_ingestString(&state, &file);
+                pendingEl.nameOffset = json_ingestString(&state, &file, true);
             } else {
                 pendingEl.type = JSON_STRING;
-                pendingEl.string.valueOffset = json_ingestString(&state, &file);
+                pendingEl.string.valueOffset = json_ingestString(&state, &file, false);
             }
             hasPending = true;
         } break;
@@ -332,11 +416,12 @@ JsonFile json_parseFile(const char* filename) {
 
         case TOK_NULL: {
             pendingEl.type = JSON_NULL;
+            state.position += json_getLenWhile(&state, "nul");
             hasPending = true;
         } break;
 
         case TOK_COUNT:
-            fprintf(stderr, "ERROR: Reached bad token at %llu\n", state.position);
+            fprintf(stderr, "ERROR: Non-token character '%c' (0x%X) at %llu\n", c, (u8) c, state.position - 1);
             exit(1);
         }
     }
@@ -348,6 +433,160 @@ JsonFile json_parseFile(const char* filename) {
     tempo_stopFunc;
     return file;
 }
+static JsonStreamResult json_streamPairsFrom(const char* data, u64 size, u64 startOffset, bool isInPairs, JsonPairFunc onPair, void* ctx) {
+    FileState state = { 0 };
+    state.data = (char*) data;
+    state.size = size;
+    JsonStreamResult result = { 0 };
+    result.fileSize = size;
+    result.lastPairEnd = startOffset;
+
+    JsonType containerStack[JSON_STREAM_MAX_DEPTH] = { 0 };
+    u32 depth = 0;
+    u32 pairsDepth = 0;  // Depth just inside the "pairs" array, 0 when not in it
+    if (isInPairs) {
+        // Resuming between two pairs: inside the root object, inside its "pairs" array
+        containerStack[depth++] = JSON_OBJECT_BEGIN;
+        containerStack[depth++] = JSON_ARRAY_BEGIN;
+        pairsDepth = depth;
+    }
+    bool expectKey = false;
+    const char* key = NULL;
+    u64 keyLen = 0;
+    f64 coords[4] = { 0 };
+    u32 coordMask = 0;
+    state.position = startOffset;
+    while (state.position < state.size) {
+        char c = state.data[state.position++];
+        JsonToken tok = json_getToken(c);
+        switch (tok) {
+        case TOK_LBRACE:
+        case TOK_LBRACKET: {
+            if (depth >= JSON_STREAM_MAX_DEPTH) {
+                snprintf(result.error, sizeof(result.error), "JSON nesting deeper than %d at %llu", JSON_STREAM_MAX_DEPTH, state.position);
+                return result;
+            }
+            bool isPairsArray = tok == TOK_LBRACKET && pairsDepth == 0 && keyLen == 5 && memcmp(key, "pairs", 5) == 0;
+            containerStack[depth++] = (tok == TOK_LBRACE) ? JSON_OBJECT_BEGIN : JSON_ARRAY_BEGIN;
+            if (isPairsArray) {
+                pairsDepth = depth;
+            }
+            if (tok == TOK_LBRACE && pairsDepth != 0 && depth == pairsDepth + 1) {
+                coordMask = 0;
+            }
+            expectKey = tok == TOK_LBRACE;
+            keyLen = 0;
+        } break;
+
+        case TOK_RBRACE:
+        case TOK_RBRACKET: {
+            if (depth == 0) {
+                snprintf(result.error, sizeof(result.error), "Unbalanced '%c' at %llu", c, state.position);
+                return result;
+            }
+            if (tok == TOK_RBRACE && pairsDepth != 0 && depth == pairsDepth + 1) {
+                if ((coordMask & 0xF) != 0xF) {
+                    snprintf(result.error, sizeof(result.error), "Missing numbers for pair %llu: coordinate mask 0x%X", result.pairCount, coordMask);
+                    return result;
+                }
+                result.closedPairCount++;
+                result.lastPairEnd = state.position;
+            }
+            if (depth == pairsDepth) {
+                pairsDepth = 0;
+            }
+            depth--;
+            expectKey = false;
+            keyLen = 0;
+        } break;
+
+        case TOK_COLON: {
+            expectKey = false;
+        } break;
+
+        case TOK_COMMA: {
+            expectKey = depth > 0 && containerStack[depth - 1] == JSON_OBJECT_BEGIN;
+            keyLen = 0;
+        } break;
+
+        case TOK_WHITESPACE: {
+            json_consumeWhitespace(&state);
+        } break;
+
+        case TOK_STRING: {
+            u64 len = json_getStringLen(&state);
+            if (expectKey) {
+                key = state.data + state.position;
+                keyLen = len;
+            }
+            state.position += len + 1;  // Consume closing quotation mark
+        } break;
+
+        case TOK_NUMBER: {
+            state.position--;
+            f64 value = 0.0;
+            if (!json_readNumber(&state, &value, result.error, sizeof(result.error))) {
+                return result;
+            }
+            if (pairsDepth != 0 && depth == pairsDepth + 1) {
+                s32 coordIdx = json_pairKeyIdx(key, keyLen);
+                if (coordIdx >= 0) {
+                    coords[coordIdx] = value;
+                    coordMask |= 1u << coordIdx;
+                    // Fire once, on the fourth coordinate, without waiting for the closing brace
+                    if (coordMask == 0xF) {
+                        onPair(ctx, coords[0], coords[1], coords[2], coords[3]);
+                        result.pairCount++;
+                        coordMask |= 0x10;
+                    }
+                }
+            }
+        } break;
+
+        case TOK_BOOL_FALSE:
+        case TOK_BOOL_TRUE: {
+            state.position += json_getLenWhile(&state, "truefalse");
+        } break;
+
+        case TOK_NULL: {
+            state.position += json_getLenWhile(&state, "nul");
+        } break;
+
+        case TOK_COUNT:
+            snprintf(result.error, sizeof(result.error), "Non-token character '%c' (0x%X) at %llu", c, (u8) c, state.position - 1);
+            return result;
+        }
+    }
+    return result;
+}
+JsonStreamResult json_streamPairsBuffer(const char* data, u64 size, JsonPairFunc onPair, void* ctx) {
+    return json_streamPairsFrom(data, size, 0, false, onPair, ctx);
+}
+JsonStreamResult json_streamPairsResume(const char* data, u64 size, u64 offset, JsonPairFunc onPair, void* ctx) {
+    return json_streamPairsFrom(data, size, offset, offset > 0, onPair, ctx);
+}
+JsonStreamResult json_streamPairs(const char* filename, JsonPairFunc onPair, void* ctx) {
+    tempo_startFunc;
+    tempo_startBlock("json_map");
+    FileState state = mmapFile(filename);
+    tempo_stopBlock("json_map");
+
+    tempo_startBlock("json_streamChars");
+    JsonStreamResult result = json_streamPairsBuffer(state.data, state.size, onPair, ctx);
+    if (result.error[0] != '\0') {
+        fprintf(stderr, "ERROR: %s in %s\n", result.error, filename);
+        exit(1);
+    }
+    tempo_countBytes(state.size);
+    tempo_countItems(result.pairCount);
+    tempo_stopBlock("json_streamChars");
+
+    tempo_startBlock("json_unmap");
+    munmapFile(&state);
+    tempo_stopBlock("json_unmap");
+    tempo_stopFunc;
+    return result;
+}
 char* json_getElementStr(JsonFile* file, JsonElement* el, char* out_buff, u32 buffLen) {
     char typeStr[32] = { 0 };
     {
@@ -423,5 +662,11 @@ void json_freeFile(JsonFile* file) {
     file->stringBuff = NULL;
     file->stringBuffUsed = 0;
     file->stringBuffCapacity = 0;
+    free(file->nameOffsets);
+    file->nameOffsets = NULL;
+    free(file->nameLens);
+    file->nameLens = NULL;
+    file->nameCount = 0;
+    file->nameCapacity = 0;
 }
 
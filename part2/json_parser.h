@@ -78,11 +78,38 @@ typedef struct JsonFile {
     char* stringBuff;
     u64 stringBuffUsed;
     u64 stringBuffCapacity;
+
+    // Names repeat on every object, so they are stored once and looked up here. Values are never shared.
+    u64* nameOffsets;
+    u64* nameLens;  // Next to the offsets, so a lookup never compares past the end of a shorter name
+    u64 nameCount;
+    u64 nameCapacity;
 } JsonFile;
 
 
+#define JSON_STREAM_MAX_DEPTH 64
+#define JSON_STREAM_ERROR_LEN 160
+
+typedef void (*JsonPairFunc)(void* ctx, f64 lng0, f64 lat0, f64 lng1, f64 lat1);
+
+typedef struct JsonStreamResult {
+    u64 fileSize;
+    u64 pairCount;
+    u64 closedPairCount;  // Pairs whose closing brace was seen, one less than pairCount if the input ends inside a pair
+    u64 lastPairEnd;      // Offset just past the closing brace of the last pair
+    char error[JSON_STREAM_ERROR_LEN];  // Empty unless the scan stopped at malformed input
+} JsonStreamResult;
+
 
 JsonFile json_parseFile(const char* filename);
+/// Single pass without building elements: calls `onPair` as soon as the fourth coordinate
+/// of each object in the "pairs" array has been read. Exits on malformed input.
+JsonStreamResult json_streamPairs(const char* filename, JsonPairFunc onPair, void* ctx);
+/// Same scan over bytes that are already in memory. Touches no global state, so worker threads may call it.
+/// Stops at malformed input and describes it in `error`, leaving the caller to decide whether that is fatal.
+JsonStreamResult json_streamPairsBuffer(const char* data, u64 size, JsonPairFunc onPair, void* ctx);
+/// Continues a scan at `offset`, which must be a lastPairEnd from an earlier scan of the same data (0 starts over)
+JsonStreamResult json_streamPairsResume(const char* data, u64 size, u64 offset, JsonPairFunc onPair, void* ctx);
 char* json_getElementStr(JsonFile* file, JsonElement* el, char* out_buff, u32 buffLen);
 void json_freeFile(JsonFile* file);
 
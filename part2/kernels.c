@@ -0,0 +1,251 @@
+//
+// Created by stevehb on 19-Oct-26.
+//
+
+#include <immintrin.h>
+
+#include "types.h"
+#include "common_funcs.h"
+#include "kernels.h"
+
+// Each ISA gets the same haversine loop; the target attribute decides the vector width
+#define KERNEL_HAVERSINE_LOOP \
+    for (u64 i = 0; i < count; i++) { \
+        out[i] = kernel_haversine(lng0[i], lat0[i], lng1[i], lat1[i], EARTH_RAD); \
+    }
+
+// SSE2 has no 64-bit compares for the bit selects, so this one stays scalar and is the portable baseline
+KERNEL_TARGET("sse2")
+void kernel_haversine_sse2(const f64* restrict lng0, const f64* restrict lat0, const f64* restrict lng1, const f64* restrict lat1,
+                           f64* restrict out, u64 count) {
+    KERNEL_HAVERSINE_LOOP
+}
+KERNEL_TARGET("avx2,fma")
+void kernel_haversine_avx2(const f64* restrict lng0, const f64* restrict lat0, const f64* restrict lng1, const f64* restrict lat1,
+                           f64* restrict out, u64 count) {
+    KERNEL_HAVERSINE_LOOP
+}
+KERNEL_TARGET("avx512f,avx512dq,fma,prefer-vector-width=512")
+void kernel_haversine_avx512(const f64* restrict lng0, const f64* restrict lat0, const f64* restrict lng1, const f64* restrict lat1,
+                             f64* restrict out, u64 count) {
+    KERNEL_HAVERSINE_LOOP
+}
+
+// Cheap formula for every pair of a block along with its error bound. The pairs over the tolerance are turned
+// into bit masks and walked bit by bit, so finding them costs per pair that needs it, not per pair in the block.
+// Their coordinates are gathered into small arrays for the full haversine, which still vectorizes, and scattered back.
+#define KERNEL_APPROX_BLOCK 256
+#define KERNEL_HAVERSINE_APPROX_LOOP \
+    u64 fullCount = 0; \
+    for (u64 blockStart = 0; blockStart < count; blockStart += KERNEL_APPROX_BLOCK) { \
+        u64 blockLen = count - blockStart < KERNEL_APPROX_BLOCK ? count - blockStart : KERNEL_APPROX_BLOCK; \
+        const f64* bLng0 = lng0 + blockStart; \
+        const f64* bLat0 = lat0 + blockStart; \
+        const f64* bLng1 = lng1 + blockStart; \
+        const f64* bLat1 = lat1 + blockStart; \
+        f64* bOut = out + blockStart; \
+        u64 useFull[KERNEL_APPROX_BLOCK]; \
+        for (u64 i = 0; i < blockLen; i++) { \
+            f64 bound; \
+            bOut[i] = kernel_haversineApprox(bLng0[i], bLat0[i], bLng1[i], bLat1[i], EARTH_RAD, &bound); \
+            useFull[i] = (u64) (bound > tolerance); \
+        } \
+        f64 gLng0[KERNEL_APPROX_BLOCK], gLat0[KERNEL_APPROX_BLOCK], gLng1[KERNEL_APPROX_BLOCK], gLat1[KERNEL_APPROX_BLOCK]; \
+        f64 gOut[KERNEL_APPROX_BLOCK]; \
+        u32 gIdx[KERNEL_APPROX_BLOCK]; \
+        u64 gCount = 0; \
+        for (u64 wordStart = 0; wordStart < blockLen; wordStart += 64) { \
+            u64 wordLen = blockLen - wordStart < 64 ? blockLen - wordStart : 64; \
+            u64 mask = 0; \
+            for (u64 i = 0; i < wordLen; i++) { \
+                mask |= useFull[wordStart + i] << i; \
+            } \
+            while (mask) { \
+                u32 i = (u32) (wordStart + __builtin_ctzll(mask)); \
+                gLng0[gCount] = bLng0[i]; \
+                gLat0[gCount] = bLat0[i]; \
+                gLng1[gCount] = bLng1[i]; \
+                gLat1[gCount] = bLat1[i]; \
+                gIdx[gCount++] = i; \
+                mask &= mask - 1; \
+            } \
+        } \
+        for (u64 j = 0; j < gCount; j++) { \
+            gOut[j] = kernel_haversine(gLng0[j], gLat0[j], gLng1[j], gLat1[j], EARTH_RAD); \
+        } \
+        for (u64 j = 0; j < gCount; j++) { \
+            bOut[gIdx[j]] = gOut[j]; \
+        } \
+        fullCount += gCount; \
+    } \
+    return fullCount;
+
+KERNEL_TARGET("sse2")
+u64 kernel_haversineApprox_sse2(const f64* restrict lng0, const f64* restrict lat0, const f64* restrict lng1, const f64* restrict lat1,
+                                f64* restrict out, u64 count, f64 tolerance) {
+    KERNEL_HAVERSINE_APPROX_LOOP
+}
+KERNEL_TARGET("avx2,fma")
+u64 kernel_haversineApprox_avx2(const f64* restrict lng0, const f64* restrict lat0, const f64* restrict lng1, const f64* restrict lat1,
+                                f64* restrict out, u64 count, f64 tolerance) {
+    KERNEL_HAVERSINE_APPROX_LOOP
+}
+KERNEL_TARGET("avx512f,avx512dq,fma,prefer-vector-width=512")
+u64 kernel_haversineApprox_avx512(const f64* restrict lng0, const f64* restrict lat0, const f64* restrict lng1, const f64* restrict lat1,
+                                  f64* restrict out, u64 count, f64 tolerance) {
+    KERNEL_HAVERSINE_APPROX_LOOP
+}
+
+#define KERNEL_HAVERSINE32_LOOP \
+    for (u64 i = 0; i < count; i++) { \
+        out[i] = kernel_haversine32(lng0[i], lat0[i], lng1[i], lat1[i], (f32) EARTH_RAD); \
+    }
+
+KERNEL_TARGET("sse2")
+void kernel_haversine32_sse2(const f32* restrict lng0, const f32* restrict lat0, const f32* restrict lng1, const f32* restrict lat1,
+                             f32* restrict out, u64 count) {
+    KERNEL_HAVERSINE32_LOOP
+}
+KERNEL_TARGET("avx2,fma")
+void kernel_haversine32_avx2(const f32* restrict lng0, const f32* restrict lat0, const f32* restrict lng1, const f32* restrict lat1,
+                             f32* restrict out, u64 count) {
+    KERNEL_HAVERSINE32_LOOP
+}
+KERNEL_TARGET("avx512f,avx512dq,fma,prefer-vector-width=512")
+void kernel_haversine32_avx512(const f32* restrict lng0, const f32* restrict lat0, const f32* restrict lng1, const f32* restrict lat1,
+                               f32* restrict out, u64 count) {
+    KERNEL_HAVERSINE32_LOOP
+}
+
+
+static bool kernel_isWhitespace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+static bool kernel_isNumberChar(char c) {
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+// Scans only ever load whole vectors inside [0, len), the tail goes byte by byte so the end of a mapping is never crossed
+
+KERNEL_TARGET("sse2")
+u64 kernel_scanWhitespace_sse2(const char* data, u64 len) {
+    u64 i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (data + i));
+        __m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))),
+                                  _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+        u32 notWs = ~(u32) _mm_movemask_epi8(ws) & 0xFFFF;
+        if (notWs) return i + __builtin_ctz(notWs);
+    }
+    while (i < len && kernel_isWhitespace(data[i])) i++;
+    return i;
+}
+KERNEL_TARGET("avx2")
+u64 kernel_scanWhitespace_avx2(const char* data, u64 len) {
+    u64 i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (data + i));
+        __m256i ws = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))),
+                                     _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+        u32 notWs = ~(u32) _mm256_movemask_epi8(ws);
+        if (notWs) return i + __builtin_ctz(notWs);
+    }
+    while (i < len && kernel_isWhitespace(data[i])) i++;
+    return i;
+}
+KERNEL_TARGET("avx512f,avx512bw")
+u64 kernel_scanWhitespace_avx512(const char* data, u64 len) {
+    u64 i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i v = _mm512_loadu_si512((const void*) (data + i));
+        __mmask64 ws = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(' ')) | _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\n'))
+                     | _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\t')) | _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\r'));
+        u64 notWs = ~(u64) ws;
+        if (notWs) return i + __builtin_ctzll(notWs);
+    }
+    while (i < len && kernel_isWhitespace(data[i])) i++;
+    return i;
+}
+
+KERNEL_TARGET("sse2")
+u64 kernel_scanStringEnd_sse2(const char* data, u64 len) {
+    u64 i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (data + i));
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+        u32 mask = (u32) _mm_movemask_epi8(hit);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    while (i < len && data[i] != '"' && data[i] != '\\') i++;
+    return i;
+}
+KERNEL_TARGET("avx2")
+u64 kernel_scanStringEnd_avx2(const char* data, u64 len) {
+    u64 i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (data + i));
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+        u32 mask = (u32) _mm256_movemask_epi8(hit);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    while (i < len && data[i] != '"' && data[i] != '\\') i++;
+    return i;
+}
+KERNEL_TARGET("avx512f,avx512bw")
+u64 kernel_scanStringEnd_avx512(const char* data, u64 len) {
+    u64 i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i v = _mm512_loadu_si512((const void*) (data + i));
+        u64 mask = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('"')) | _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\\'));
+        if (mask) return i + __builtin_ctzll(mask);
+    }
+    while (i < len && data[i] != '"' && data[i] != '\\') i++;
+    return i;
+}
+
+KERNEL_TARGET("sse2")
+u64 kernel_scanNumber_sse2(const char* data, u64 len) {
+    u64 i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (data + i));
+        // Bytes >= 0x80 are negative here, so they fail the digit range test
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+        __m128i sign = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('-')), _mm_cmpeq_epi8(v, _mm_set1_epi8('+')));
+        __m128i other = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('.')),
+                                     _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('e')), _mm_cmpeq_epi8(v, _mm_set1_epi8('E'))));
+        u32 notNum = ~(u32) _mm_movemask_epi8(_mm_or_si128(digit, _mm_or_si128(sign, other))) & 0xFFFF;
+        if (notNum) return i + __builtin_ctz(notNum);
+    }
+    while (i < len && kernel_isNumberChar(data[i])) i++;
+    return i;
+}
+KERNEL_TARGET("avx2")
+u64 kernel_scanNumber_avx2(const char* data, u64 len) {
+    u64 i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (data + i));
+        __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+        __m256i sign = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('-')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('+')));
+        __m256i other = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('.')),
+                                        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('e')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('E'))));
+        u32 notNum = ~(u32) _mm256_movemask_epi8(_mm256_or_si256(digit, _mm256_or_si256(sign, other)));
+        if (notNum) return i + __builtin_ctz(notNum);
+    }
+    while (i < len && kernel_isNumberChar(data[i])) i++;
+    return i;
+}
+KERNEL_TARGET("avx512f,avx512bw")
+u64 kernel_scanNumber_avx512(const char* data, u64 len) {
+    u64 i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i v = _mm512_loadu_si512((const void*) (data + i));
+        __mmask64 num = _mm512_cmplt_epu8_mask(_mm512_sub_epi8(v, _mm512_set1_epi8('0')), _mm512_set1_epi8(10))
+                      | _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('-')) | _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('+'))
+                      | _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('.')) | _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('e'))
+                      | _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('E'));
+        u64 notNum = ~(u64) num;
+        if (notNum) return i + __builtin_ctzll(notNum);
+    }
+    while (i < len && kernel_isNumberChar(data[i])) i++;
+    return i;
+}
@@ -0,0 +1,242 @@
+//
+// Created by stevehb on 19-Oct-26.
+//
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <string.h>
+
+#include "types.h"
+#include "common_funcs.h"
+
+#ifdef _MSC_VER
+#define KERNEL_TARGET(isa)
+#define KERNEL_INLINE static __forceinline
+#else
+// The haversine loops only vectorize when built with -fno-math-errno, otherwise sqrt keeps a scalar errno branch
+#define KERNEL_TARGET(isa) __attribute__((target(isa)))
+#define KERNEL_INLINE static inline __attribute__((always_inline))
+#endif
+
+// Branch-free double math for the haversine kernels. Every select is done on bits so the
+// same source vectorizes for each target. Arguments are bounded: |x| <= pi for sin/cos,
+// 0 <= x <= 1 for asin. Polynomials are the fdlibm kernels, good to about 1 ulp.
+
+#define KERNEL_ROUND_MAGIC 6755399441055744.0  // 1.5 * 2^52: adding it rounds to an integer in the low mantissa bits
+#define KERNEL_TWO_OVER_PI 0.63661977236758134308
+#define KERNEL_PIO2_1  1.57079632673412561417e+00
+#define KERNEL_PIO2_1T 6.07710050650619224932e-11
+#define KERNEL_PIO2_2  6.07710050630396597660e-11
+#define KERNEL_PIO2_2T 2.02226624879595063154e-21
+#define KERNEL_PIO2    1.57079632679489655800e+00
+
+KERNEL_INLINE u64 kernel_bits(f64 f) {
+    u64 u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+KERNEL_INLINE f64 kernel_f64(u64 u) {
+    f64 f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+KERNEL_INLINE f64 kernel_sinPoly(f64 x) {
+    f64 z = x * x;
+    f64 r = 8.33333333332248946124e-03 + z * (-1.98412698298579493134e-04 + z * (2.75573137070700676789e-06
+          + z * (-2.50507602534068634195e-08 + z * 1.58969099521155010221e-10)));
+    return x + (z * x) * (-1.66666666666666324348e-01 + z * r);
+}
+KERNEL_INLINE f64 kernel_cosPoly(f64 x) {
+    f64 z = x * x;
+    f64 r = z * (4.16666666666666019037e-02 + z * (-1.38888888888741095749e-03 + z * (2.48015872894767294178e-05
+          + z * (-2.75573143513906633035e-07 + z * (2.08757232129817482790e-09 + z * -1.13596475577881948265e-11)))));
+    f64 hz = 0.5 * z;
+    f64 w = 1.0 - hz;
+    return w + (((1.0 - w) - hz) + z * r);
+}
+
+/// Computes sin(x) (`wantCos` = 0) or cos(x) (`wantCos` = 1) for |x| <= pi
+KERNEL_INLINE f64 kernel_sinCos(f64 x, u64 wantCos) {
+    f64 shifted = x * KERNEL_TWO_OVER_PI + KERNEL_ROUND_MAGIC;
+    f64 k = shifted - KERNEL_ROUND_MAGIC;
+    u64 quadrant = kernel_bits(shifted) + wantCos;
+    f64 r = (x - k * KERNEL_PIO2_1) - k * KERNEL_PIO2_1T;
+    f64 s = kernel_sinPoly(r);
+    f64 c = kernel_cosPoly(r);
+    u64 useCos = (u64) 0 - (quadrant & 1);
+    u64 bits = (kernel_bits(c) & useCos) | (kernel_bits(s) & ~useCos);
+    return kernel_f64(bits ^ ((quadrant & 2) << 62));
+}
+
+/// asin(x) for 0 <= x <= 1, using asin(x) = pi/2 - 2*asin(sqrt((1-x)/2)) above 0.5
+KERNEL_INLINE f64 kernel_asin(f64 x) {
+    u64 isHigh = (u64) 0 - (u64) (x > 0.5);
+    f64 tLow = x * x;
+    f64 tHigh = (1.0 - x) * 0.5;
+    f64 t = kernel_f64((kernel_bits(tHigh) & isHigh) | (kernel_bits(tLow) & ~isHigh));
+    f64 w = kernel_f64((kernel_bits(__builtin_sqrt(tHigh)) & isHigh) | (kernel_bits(x) & ~isHigh));
+    f64 p = t * (1.66666666666666657415e-01 + t * (-3.25565818622400915405e-01 + t * (2.01212532134862925881e-01
+          + t * (-4.00555345006794114027e-02 + t * (7.91534994289814532176e-04 + t * 3.47933107596021167570e-05)))));
+    f64 q = 1.0 + t * (-2.40339491173441421878e+00 + t * (2.02094576023350569471e+00 + t * (-6.88283971605453293030e-01
+          + t * 7.70381505559019352791e-02)));
+    f64 r = w + w * (p / q);
+    f64 high = KERNEL_PIO2 - 2.0 * r;
+    return kernel_f64((kernel_bits(high) & isHigh) | (kernel_bits(r) & ~isHigh));
+}
+
+KERNEL_INLINE f64 kernel_haversine(f64 lng0, f64 lat0, f64 lng1, f64 lat1, f64 rad) {
+    f64 dLat = DEG2RAD(lat1 - lat0);
+    f64 dLng = DEG2RAD(lng1 - lng0);
+    f64 sinHalfLat = kernel_sinCos(dLat * 0.5, 0);
+    f64 sinHalfLng = kernel_sinCos(dLng * 0.5, 0);
+    f64 cosLat0 = kernel_sinCos(DEG2RAD(lat0), 1);
+    f64 cosLat1 = kernel_sinCos(DEG2RAD(lat1), 1);
+    f64 a = sinHalfLat * sinHalfLat + cosLat0 * cosLat1 * (sinHalfLng * sinHalfLng);
+    u64 isOver = (u64) 0 - (u64) (a > 1.0);
+    a = kernel_f64((kernel_bits(1.0) & isOver) | (kernel_bits(a) & ~isOver));
+    return rad * 2.0 * kernel_asin(__builtin_sqrt(a));
+}
+
+// Short-range approximation. With x = |dLat| / 2 and y = |dLng| / 2 both at most KERNEL_APPROX_MAX_HALF:
+//   sin(t) ~ t - t^3/6 + t^5/120, tail <= t^7/5040, so sin^2 is off by a relative eps(t) <= t^6/2400
+//   cos(lat0) * cos(lat1) = cos^2(mean lat) - sin^2(dLat/2), with cos from an even Taylor series to m^20,
+//   tail <= (pi/2)^22 / 22! ~ 2e-17 for |mean lat| <= pi/2, so no range reduction is needed
+//   asin(s) ~ s + s^3/6 + 3s^5/40, tail <= (5/112) s^7 / (1 - s^2), taken for s <= 1/2
+// Propagating these through d = 2R asin(sqrt(a)) gives the bound written to `out_bound`, in the units of `rad`.
+// Pairs outside the range get an infinite bound so they always fall back.
+
+#define KERNEL_APPROX_MAX_HALF 0.5
+#define KERNEL_APPROX_MAX_S 0.5
+#define KERNEL_APPROX_COS_ERR 1e-15  // Absolute error of cos^2 from the polynomial, with margin
+#define KERNEL_APPROX_ROUND_ERR 2e-15
+
+/// cos(m) for |m| <= pi/2, a single Horner chain
+KERNEL_INLINE f64 kernel_cosHalfPi(f64 m) {
+    f64 z = m * m;
+    return 1.0 + z * (-1.0 / 2.0 + z * (1.0 / 24.0 + z * (-1.0 / 720.0 + z * (1.0 / 40320.0 + z * (-1.0 / 3628800.0
+         + z * (1.0 / 479001600.0 + z * (-1.0 / 87178291200.0 + z * (1.0 / 20922789888000.0
+         + z * (-1.0 / 6402373705728000.0 + z * (1.0 / 2432902008176640000.0))))))))));
+}
+
+KERNEL_INLINE f64 kernel_haversineApprox(f64 lng0, f64 lat0, f64 lng1, f64 lat1, f64 rad, f64* out_bound) {
+    f64 x = DEG2RAD(lat1 - lat0) * 0.5;
+    f64 y = DEG2RAD(lng1 - lng0) * 0.5;
+    f64 x2 = x * x;
+    f64 y2 = y * y;
+    f64 sinX = x * (1.0 + x2 * (-1.0 / 6.0 + x2 * (1.0 / 120.0)));
+    f64 sinY = y * (1.0 + y2 * (-1.0 / 6.0 + y2 * (1.0 / 120.0)));
+    f64 cosMean = kernel_cosHalfPi(DEG2RAD(lat0 + lat1) * 0.5);
+    f64 sinX2 = sinX * sinX;
+    f64 sinY2 = sinY * sinY;
+    f64 termLat = sinX2;
+    f64 termLng = (cosMean * cosMean - sinX2) * sinY2;  // Never meaningfully negative, cos0 cos1 >= 0
+    f64 a = termLat + termLng;
+    u64 isNegative = (u64) 0 - (u64) (a < 0.0);
+    a = kernel_f64(kernel_bits(a) & ~isNegative);
+    f64 s = __builtin_sqrt(a);
+    f64 s2 = s * s;
+    f64 asinS = s * (1.0 + s2 * (1.0 / 6.0 + s2 * (3.0 / 40.0)));
+    f64 dist = rad * 2.0 * asinS;
+
+    // Error in a, then in sqrt(a) (the smaller of sqrt(err) and err / s), then through asin
+    f64 epsX = (x2 * x2 * x2) * (1.0 / 2400.0);
+    f64 epsY = (y2 * y2 * y2) * (1.0 / 2400.0);
+    f64 errA = epsX * termLat * (1.0 + sinY2) + epsY * __builtin_fabs(termLng)
+             + sinY2 * KERNEL_APPROX_COS_ERR + KERNEL_APPROX_ROUND_ERR * (a + sinY2);
+    f64 errSqrtA = __builtin_sqrt(errA);
+    f64 errDivS = errA / (s + 1e-300);
+    u64 isDivSmaller = (u64) 0 - (u64) (errDivS < errSqrtA);
+    f64 errS = kernel_f64((kernel_bits(errDivS) & isDivSmaller) | (kernel_bits(errSqrtA) & ~isDivSmaller));
+    f64 s7 = s2 * s2 * s2 * s;
+    f64 bound = 1.1 * (rad * 2.0 * ((5.0 / 112.0) * (4.0 / 3.0) * s7 + 1.16 * errS) + dist * 1e-15);
+
+    u64 isInRange = ((u64) 0 - (u64) (x2 <= KERNEL_APPROX_MAX_HALF * KERNEL_APPROX_MAX_HALF))
+                  & ((u64) 0 - (u64) (y2 <= KERNEL_APPROX_MAX_HALF * KERNEL_APPROX_MAX_HALF))
+                  & ((u64) 0 - (u64) (s + errS <= KERNEL_APPROX_MAX_S));
+    *out_bound = kernel_f64((kernel_bits(bound) & isInRange) | (kernel_bits(__builtin_inf()) & ~isInRange));
+    return dist;
+}
+
+// Single-precision versions, cephes sinf/cosf/asinf polynomials, good to a few ulp of f32.
+// Every select is on u32 bits, so unlike the f64 kernel the SSE2 variant vectorizes too.
+
+#define KERNEL_ROUND_MAGIC_F32 12582912.0f  // 1.5 * 2^23
+#define KERNEL_PIO2_F32_1 1.5703125f
+#define KERNEL_PIO2_F32_2 4.837512969970703125e-4f
+#define KERNEL_PIO2_F32_3 7.54978995489188216e-8f
+
+KERNEL_INLINE u32 kernel_bits32(f32 f) {
+    u32 u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+KERNEL_INLINE f32 kernel_f32(u32 u) {
+    f32 f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+/// sinf(x) (`wantCos` = 0) or cosf(x) (`wantCos` = 1) for |x| <= pi
+KERNEL_INLINE f32 kernel_sinCos32(f32 x, u32 wantCos) {
+    f32 shifted = x * 0.636619772f + KERNEL_ROUND_MAGIC_F32;
+    f32 k = shifted - KERNEL_ROUND_MAGIC_F32;
+    u32 quadrant = kernel_bits32(shifted) + wantCos;
+    f32 r = ((x - k * KERNEL_PIO2_F32_1) - k * KERNEL_PIO2_F32_2) - k * KERNEL_PIO2_F32_3;
+    f32 z = r * r;
+    f32 s = r + r * z * (-1.6666654611e-1f + z * (8.3321608736e-3f + z * -1.9515295891e-4f));
+    f32 c = 1.0f - 0.5f * z + z * z * (4.166664568298827e-2f + z * (-1.388731625493765e-3f + z * 2.443315711809948e-5f));
+    u32 useCos = 0u - (quadrant & 1);
+    u32 bits = (kernel_bits32(c) & useCos) | (kernel_bits32(s) & ~useCos);
+    return kernel_f32(bits ^ ((quadrant & 2) << 30));
+}
+
+/// asinf(x) for 0 <= x <= 1
+KERNEL_INLINE f32 kernel_asin32(f32 x) {
+    u32 isHigh = 0u - (u32) (x > 0.5f);
+    f32 zHigh = (1.0f - x) * 0.5f;
+    f32 w = kernel_f32((kernel_bits32(__builtin_sqrtf(zHigh)) & isHigh) | (kernel_bits32(x) & ~isHigh));
+    f32 z = w * w;
+    f32 r = w + w * z * (1.6666752422e-1f + z * (7.4953002686e-2f + z * (4.5470025998e-2f
+          + z * (2.4181311049e-2f + z * 4.2163199048e-2f))));
+    f32 high = 1.570796327f - 2.0f * r;
+    return kernel_f32((kernel_bits32(high) & isHigh) | (kernel_bits32(r) & ~isHigh));
+}
+
+KERNEL_INLINE f32 kernel_haversine32(f32 lng0, f32 lat0, f32 lng1, f32 lat1, f32 rad) {
+    const f32 degToRad = (f32) DEG2RAD_FACTOR;
+    f32 dLat = (lat1 - lat0) * degToRad;
+    f32 dLng = (lng1 - lng0) * degToRad;
+    f32 sinHalfLat = kernel_sinCos32(dLat * 0.5f, 0);
+    f32 sinHalfLng = kernel_sinCos32(dLng * 0.5f, 0);
+    f32 cosLat0 = kernel_sinCos32(lat0 * degToRad, 1);
+    f32 cosLat1 = kernel_sinCos32(lat1 * degToRad, 1);
+    f32 a = sinHalfLat * sinHalfLat + cosLat0 * cosLat1 * (sinHalfLng * sinHalfLng);
+    u32 isOver = 0u - (u32) (a > 1.0f);
+    a = kernel_f32((kernel_bits32(1.0f) & isOver) | (kernel_bits32(a) & ~isOver));
+    return rad * 2.0f * kernel_asin32(__builtin_sqrtf(a));
+}
+
+void kernel_haversine_sse2(const f64* lng0, const f64* lat0, const f64* lng1, const f64* lat1, f64* out, u64 count);
+void kernel_haversine_avx2(const f64* lng0, const f64* lat0, const f64* lng1, const f64* lat1, f64* out, u64 count);
+void kernel_haversine_avx512(const f64* lng0, const f64* lat0, const f64* lng1, const f64* lat1, f64* out, u64 count);
+u64 kernel_haversineApprox_sse2(const f64* lng0, const f64* lat0, const f64* lng1, const f64* lat1, f64* out, u64 count, f64 tolerance);
+u64 kernel_haversineApprox_avx2(const f64* lng0, const f64* lat0, const f64* lng1, const f64* lat1, f64* out, u64 count, f64 tolerance);
+u64 kernel_haversineApprox_avx512(const f64* lng0, const f64* lat0, const f64* lng1, const f64* lat1, f64* out, u64 count, f64 tolerance);
+
+void kernel_haversine32_sse2(const f32* lng0, const f32* lat0, const f32* lng1, const f32* lat1, f32* out, u64 count);
+void kernel_haversine32_avx2(const f32* lng0, const f32* lat0, const f32* lng1, const f32* lat1, f32* out, u64 count);
+void kernel_haversine32_avx512(const f32* lng0, const f32* lat0, const f32* lng1, const f32* lat1, f32* out, u64 count);
+
+u64 kernel_scanWhitespace_sse2(const char* data, u64 len);
+u64 kernel_scanWhitespace_avx2(const char* data, u64 len);
+u64 kernel_scanWhitespace_avx512(const char* data, u64 len);
+u64 kernel_scanStringEnd_sse2(const char* data, u64 len);
+u64 kernel_scanStringEnd_avx2(const char* data, u64 len);
+u64 kernel_scanStringEnd_avx512(const char* data, u64 len);
+u64 kernel_scanNumber_sse2(const char* data, u64 len);
+u64 kernel_scanNumber_avx2(const char* data, u64 len);
+u64 kernel_scanNumber_avx512(const char* data, u64 len);
+
+#endif //KERNELS_H
@@ -0,0 +1,142 @@
+//
+// Created by stevehb on 19-Oct-26.
+//
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "types.h"
+#include "number_format.h"
+
+#define FORMAT_POW5_16 152587890625ull      // 10^16 = 5^16 * 2^16
+#define FORMAT_POW10_16 10000000000000000ull
+#define FORMAT_POW10_8 100000000ull
+#define FORMAT_FAST_LIMIT 1024.0            // Keeps round(|value| * 10^16) inside a u64
+
+static const char FORMAT_DIGIT_PAIRS[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static void format_mul64(u64 a, u64 b, u64* out_hi, u64* out_lo) {
+#ifdef _MSC_VER
+    *out_lo = _umul128(a, b, out_hi);
+#else
+    u128 product = (u128) a * b;
+    *out_hi = (u64) (product >> 64);
+    *out_lo = (u64) product;
+#endif
+}
+
+/// Eight digits of `value` < 10^8, zero padded
+static void format_write8(char* out, u32 value) {
+    u32 high = value / 10000;
+    u32 low = value % 10000;
+    memcpy(out + 0, &FORMAT_DIGIT_PAIRS[(high / 100) * 2], 2);
+    memcpy(out + 2, &FORMAT_DIGIT_PAIRS[(high % 100) * 2], 2);
+    memcpy(out + 4, &FORMAT_DIGIT_PAIRS[(low / 100) * 2], 2);
+    memcpy(out + 6, &FORMAT_DIGIT_PAIRS[(low % 100) * 2], 2);
+}
+
+/// round(|value| * 10^16) with ties to even, the same rounding glibc applies to the exact binary value
+static u64 format_scaledRound(u64 bits) {
+    u64 biasedExp = (bits >> 52) & 0x7FF;
+    u64 mantissa = bits & 0xFFFFFFFFFFFFFull;
+    s32 exp = -1074;
+    if (biasedExp != 0) {
+        mantissa |= 1ull << 52;
+        exp = (s32) biasedExp - 1075;
+    }
+    // |value| * 10^16 = mantissa * 5^16 * 2^(exp + 16), and exp + 16 <= -27 below the fast limit
+    u32 shift = (u32) -(exp + 16);
+    u64 hi, lo;
+    format_mul64(mantissa, FORMAT_POW5_16, &hi, &lo);
+    if (shift >= 128) return 0;  // The product is under 2^91, so it is less than half of 2^shift
+
+    u64 q, remHi, remLo, halfHi, halfLo;
+    if (shift < 64) {
+        q = (lo >> shift) | (hi << (64 - shift));
+        remHi = 0;
+        remLo = lo & ((1ull << shift) - 1);
+        halfHi = 0;
+        halfLo = 1ull << (shift - 1);
+    } else if (shift == 64) {
+        q = hi;
+        remHi = 0;
+        remLo = lo;
+        halfHi = 0;
+        halfLo = 1ull << 63;
+    } else {
+        q = hi >> (shift - 64);
+        remHi = hi & ((1ull << (shift - 64)) - 1);
+        remLo = lo;
+        halfHi = 1ull << (shift - 65);
+        halfLo = 0;
+    }
+    bool isAboveHalf = remHi > halfHi || (remHi == halfHi && remLo > halfLo);
+    bool isHalf = remHi == halfHi && remLo == halfLo;
+    if (isAboveHalf || (isHalf && (q & 1))) {
+        q++;
+    }
+    return q;
+}
+
+u32 format_f64Fixed16(char* out, f64 value, u32 width) {
+    u64 bits = 0;
+    memcpy(&bits, &value, sizeof(bits));
+    bool isNegative = (bits >> 63) != 0;
+    f64 magnitude = isNegative ? -value : value;
+    if (!(magnitude < FORMAT_FAST_LIMIT)) {
+        // Large, infinite or NaN
+        return (u32) snprintf(out, 512, "%*.16f", (int) width, value);
+    }
+
+    u64 scaled = format_scaledRound(bits);
+    u32 intPart = (u32) (scaled / FORMAT_POW10_16);
+    u64 fracPart = scaled % FORMAT_POW10_16;
+
+    // Integer digits go into a scratch area right-aligned, so padding is a single fill
+    char digits[FORMAT_FIXED16_MAX_LEN];
+    char* end = digits + FORMAT_FIXED16_MAX_LEN;
+    format_write8(end - 8, (u32) (fracPart % FORMAT_POW10_8));
+    format_write8(end - 16, (u32) (fracPart / FORMAT_POW10_8));
+    end[-17] = '.';
+    char* start = end - 17;
+    if (intPart >= 100) {
+        memcpy(start - 2, &FORMAT_DIGIT_PAIRS[(intPart % 100) * 2], 2);
+        start -= 2;
+        intPart /= 100;
+        if (intPart >= 10) {
+            memcpy(start - 2, &FORMAT_DIGIT_PAIRS[intPart * 2], 2);
+            start -= 2;
+        } else {
+            *--start = (char) ('0' + intPart);
+        }
+    } else if (intPart >= 10) {
+        memcpy(start - 2, &FORMAT_DIGIT_PAIRS[intPart * 2], 2);
+        start -= 2;
+    } else {
+        *--start = (char) ('0' + intPart);
+    }
+    if (isNegative) {
+        *--start = '-';
+    }
+
+    u32 len = (u32) (end - start);
+    u32 pad = width > len ? width - len : 0;
+    memset(out, ' ', pad);
+    memcpy(out + pad, start, len);
+    return pad + len;
+}
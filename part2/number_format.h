@@ -0,0 +1,18 @@
+//
+// Created by stevehb on 19-Oct-26.
+//
+
+#ifndef NUMBER_FORMAT_H
+#define NUMBER_FORMAT_H
+
+#include "types.h"
+
+// Longest output of format_f64Fixed16 on the fast path: sign, 4 integer digits, '.', 16 digits
+#define FORMAT_FIXED16_MAX_LEN 22
+
+/// Writes `value` exactly as printf("%*.16f", width, value) would, right-aligned with spaces, and returns the
+/// length. No terminator is written. |value| below 1024 takes the integer path, anything else goes through
+/// snprintf, so `out` must have room for the widest double when that can happen.
+u32 format_f64Fixed16(char* out, f64 value, u32 width);
+
+#endif //NUMBER_FORMAT_H
@@ -0,0 +1,207 @@
+//
+// Created by stevehb on 19-Oct-26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "common_funcs.h"
+#include "haversine.h"
+#include "pairs_bin.h"
+
+#define PAIRS_BIN_FNV_OFFSET 0xCBF29CE484222325ull
+#define PAIRS_BIN_FNV_PRIME  0x00000100000001B3ull
+
+_Static_assert(sizeof(PairsBinHeader) == PAIRS_BIN_ALIGN, "PairsBinHeader must fill one aligned block");
+
+static u64 pairsBin_columnStride(u64 pairCount) {
+    u64 bytes = pairCount * sizeof(f64);
+    return (bytes + PAIRS_BIN_ALIGN - 1) / PAIRS_BIN_ALIGN * PAIRS_BIN_ALIGN;
+}
+static u64 pairsBin_hashWords(u64 hash, const f64* values, u64 count) {
+    for (u64 i = 0; i < count; i++) {
+        u64 word = 0;
+        memcpy(&word, &values[i], sizeof(word));
+        hash = (hash ^ word) * PAIRS_BIN_FNV_PRIME;
+    }
+    return hash;
+}
+static u64 pairsBin_combineHashes(const u64 columnHashes[4]) {
+    u64 hash = PAIRS_BIN_FNV_OFFSET;
+    for (u32 c = 0; c < 4; c++) {
+        hash = (hash ^ columnHashes[c]) * PAIRS_BIN_FNV_PRIME;
+    }
+    return hash;
+}
+static PairsBinHeader pairsBin_makeHeader(u64 pairCount) {
+    PairsBinHeader header = { 0 };
+    memcpy(header.magic, PAIRS_BIN_MAGIC, PAIRS_BIN_MAGIC_LEN);
+    header.version = PAIRS_BIN_VERSION;
+    header.headerSize = sizeof(PairsBinHeader);
+    header.pairCount = pairCount;
+    header.columnStride = pairsBin_columnStride(pairCount);
+    return header;
+}
+
+bool pairsBin_isBinaryFile(const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) return false;
+    char magic[PAIRS_BIN_MAGIC_LEN] = { 0 };
+    size_t got = fread(magic, 1, PAIRS_BIN_MAGIC_LEN, file);
+    fclose(file);
+    return got == PAIRS_BIN_MAGIC_LEN && memcmp(magic, PAIRS_BIN_MAGIC, PAIRS_BIN_MAGIC_LEN) == 0;
+}
+
+/// The returned columns point into `state`, keep it mapped while they are in use and never pairs_free them
+PairArrays pairsBin_view(FileState* state, bool verifyChecksum) {
+    PairArrays pairs = { 0 };
+    char error[PAIRS_BIN_ERROR_LEN];
+    if (!pairsBin_tryView(state, verifyChecksum, &pairs, error, sizeof(error))) {
+        fprintf(stderr, "ERROR: %s\n", error);
+        exit(1);
+    }
+    return pairs;
+}
+bool pairsBin_tryView(FileState* state, bool verifyChecksum, PairArrays* out_pairs, char* error, u64 errorLen) {
+    PairsBinHeader header = { 0 };
+    if (state->size < sizeof(header)) {
+        snprintf(error, errorLen, "Binary pairs file is smaller than its header");
+        return false;
+    }
+    memcpy(&header, state->data, sizeof(header));
+    if (memcmp(header.magic, PAIRS_BIN_MAGIC, PAIRS_BIN_MAGIC_LEN) != 0 || header.version != PAIRS_BIN_VERSION) {
+        snprintf(error, errorLen, "Unsupported binary pairs file: version %u", header.version);
+        return false;
+    }
+    if (header.headerSize < sizeof(header) || header.headerSize > state->size || header.headerSize % PAIRS_BIN_ALIGN != 0) {
+        snprintf(error, errorLen, "Binary pairs file has a bad header size: %u bytes in a %llu byte file", header.headerSize, state->size);
+        return false;
+    }
+    // Compared by division, so a corrupt count or stride cannot wrap around and pass
+    u64 maxStride = (state->size - header.headerSize) / 4;
+    if (header.columnStride % PAIRS_BIN_ALIGN != 0 || header.columnStride > maxStride || header.pairCount > header.columnStride / sizeof(f64)) {
+        snprintf(error, errorLen, "Binary pairs file is truncated: %llu pairs with a %llu byte column stride do not fit in %llu bytes",
+            header.pairCount, header.columnStride, state->size);
+        return false;
+    }
+
+    char* columns = state->data + header.headerSize;
+    PairArrays pairs = { 0 };
+    pairs.lng0 = (f64*) (columns);
+    pairs.lat0 = (f64*) (columns + header.columnStride);
+    pairs.lng1 = (f64*) (columns + header.columnStride * 2);
+    pairs.lat1 = (f64*) (columns + header.columnStride * 3);
+    pairs.count = header.pairCount;
+    pairs.capacity = header.pairCount;
+
+    if (verifyChecksum) {
+        u64 checksum = pairsBin_checksum(&pairs);
+        if (checksum != header.checksum) {
+            snprintf(error, errorLen, "Binary pairs checksum mismatch: header 0x%016llX, data 0x%016llX", header.checksum, checksum);
+            return false;
+        }
+    }
+    *out_pairs = pairs;
+    return true;
+}
+
+u64 pairsBin_checksum(const PairArrays* pairs) {
+    u64 columnHashes[4] = {
+        pairsBin_hashWords(PAIRS_BIN_FNV_OFFSET, pairs->lng0, pairs->count),
+        pairsBin_hashWords(PAIRS_BIN_FNV_OFFSET, pairs->lat0, pairs->count),
+        pairsBin_hashWords(PAIRS_BIN_FNV_OFFSET, pairs->lng1, pairs->count),
+        pairsBin_hashWords(PAIRS_BIN_FNV_OFFSET, pairs->lat1, pairs->count),
+    };
+    return pairsBin_combineHashes(columnHashes);
+}
+
+void pairsBin_write(const char* filename, const PairArrays* pairs) {
+    PairsBinWriter writer = { 0 };
+    pairsBin_openWriter(&writer, filename, pairs->count);
+    for (u64 i = 0; i < pairs->count; i++) {
+        pairsBin_append(&writer, pairs->lng0[i], pairs->lat0[i], pairs->lng1[i], pairs->lat1[i]);
+    }
+    pairsBin_closeWriter(&writer);
+}
+
+static void pairsBin_writeColumns(PairsBinWriter* writer, const f64* const cols[4], u64 firstIdx, u64 count) {
+    for (u32 c = 0; c < 4; c++) {
+        u64 offset = writer->header.headerSize + c * writer->header.columnStride + firstIdx * sizeof(f64);
+        if (fileSeek(writer->file, offset) != 0 || fwrite(cols[c], sizeof(f64), count, writer->file) != count) {
+            fprintf(stderr, "ERROR: Failed writing binary pairs column %u at %llu\n", c, offset);
+            exit(1);
+        }
+        writer->columnHashes[c] = pairsBin_hashWords(writer->columnHashes[c], cols[c], count);
+    }
+}
+
+static void pairsBin_flush(PairsBinWriter* writer) {
+    u64 count = writer->buff.count;
+    if (count == 0) return;
+    const f64* const cols[4] = { writer->buff.lng0, writer->buff.lat0, writer->buff.lng1, writer->buff.lat1 };
+    pairsBin_writeColumns(writer, cols, writer->written - count, count);
+    writer->buff.count = 0;
+}
+
+void pairsBin_openWriter(PairsBinWriter* writer, const char* filename, u64 pairCount) {
+    *writer = (PairsBinWriter){ 0 };
+    writer->file = fopen(filename, "wb");
+    if (writer->file == NULL) {
+        fprintf(stderr, "ERROR: Failed to open %s for writing\n", filename);
+        exit(1);
+    }
+    writer->header = pairsBin_makeHeader(pairCount);
+    for (u32 c = 0; c < 4; c++) {
+        writer->columnHashes[c] = PAIRS_BIN_FNV_OFFSET;
+    }
+    fileReserve(writer->file, writer->header.headerSize + 4 * writer->header.columnStride);
+    // Header is rewritten with the checksum on close; writing it now also sizes the file start
+    fwrite(&writer->header, sizeof(writer->header), 1, writer->file);
+}
+
+void pairsBin_append(PairsBinWriter* writer, f64 lng0, f64 lat0, f64 lng1, f64 lat1) {
+    if (writer->written >= writer->header.pairCount) {
+        fprintf(stderr, "ERROR: Binary pairs writer expected only %llu pairs\n", writer->header.pairCount);
+        exit(1);
+    }
+    pairs_append(&writer->buff, lng0, lat0, lng1, lat1);
+    writer->written++;
+    if (writer->buff.count == PAIRS_BIN_WRITE_BUFF_PAIRS) {
+        pairsBin_flush(writer);
+    }
+}
+
+void pairsBin_appendColumns(PairsBinWriter* writer, const f64* lng0, const f64* lat0, const f64* lng1, const f64* lat1, u64 count) {
+    if (writer->written + count > writer->header.pairCount) {
+        fprintf(stderr, "ERROR: Binary pairs writer expected only %llu pairs\n", writer->header.pairCount);
+        exit(1);
+    }
+    pairsBin_flush(writer);
+    const f64* const cols[4] = { lng0, lat0, lng1, lat1 };
+    pairsBin_writeColumns(writer, cols, writer->written, count);
+    writer->written += count;
+}
+
+void pairsBin_closeWriter(PairsBinWriter* writer) {
+    pairsBin_flush(writer);
+    if (writer->written != writer->header.pairCount) {
+        fprintf(stderr, "ERROR: Binary pairs writer got %llu pairs, expected %llu\n", writer->written, writer->header.pairCount);
+        exit(1);
+    }
+    writer->header.checksum = pairsBin_combineHashes(writer->columnHashes);
+
+    // Pad the last column out to its aligned end so the file can be mapped as a whole
+    u64 fileSize = writer->header.headerSize + 4 * writer->header.columnStride;
+    u64 dataEnd = writer->header.headerSize + 3 * writer->header.columnStride + writer->header.pairCount * sizeof(f64);
+    static const u8 zeros[PAIRS_BIN_ALIGN] = { 0 };
+    fileSeek(writer->file, dataEnd);
+    fwrite(zeros, 1, fileSize - dataEnd, writer->file);
+
+    fileSeek(writer->file, 0);
+    fwrite(&writer->header, sizeof(writer->header), 1, writer->file);
+    fclose(writer->file);
+    pairs_free(&writer->buff);
+    writer->file = NULL;
+}
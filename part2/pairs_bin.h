@@ -0,0 +1,57 @@
+//
+// Created by stevehb on 19-Oct-26.
+//
+
+#ifndef PAIRS_BIN_H
+#define PAIRS_BIN_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "types.h"
+#include "common_funcs.h"
+#include "haversine.h"
+
+// Layout: 64-byte header, then the lng0, lat0, lng1 and lat1 columns of `pairCount` f64 each.
+// Every column starts on a 64-byte boundary `columnStride` bytes apart, so a mapping of the
+// file can be used as PairArrays without copying.
+#define PAIRS_BIN_MAGIC "HAVPAIRS"
+#define PAIRS_BIN_MAGIC_LEN 8
+#define PAIRS_BIN_VERSION 1
+#define PAIRS_BIN_ALIGN 64
+#define PAIRS_BIN_WRITE_BUFF_PAIRS 8192
+#define PAIRS_BIN_ERROR_LEN 128
+
+typedef struct PairsBinHeader {
+    char magic[PAIRS_BIN_MAGIC_LEN];
+    u32 version;
+    u32 headerSize;
+    u64 pairCount;
+    u64 columnStride;
+    u64 checksum;
+    u8 reserved[24];
+} PairsBinHeader;
+
+typedef struct PairsBinWriter {
+    FILE* file;
+    PairsBinHeader header;
+    u64 written;
+    u64 columnHashes[4];
+    PairArrays buff;
+} PairsBinWriter;
+
+bool pairsBin_isBinaryFile(const char* filename);
+PairArrays pairsBin_view(FileState* state, bool verifyChecksum);
+/// Same view, but returns false and describes the problem in `error` instead of exiting on a bad file
+bool pairsBin_tryView(FileState* state, bool verifyChecksum, PairArrays* out_pairs, char* error, u64 errorLen);
+u64 pairsBin_checksum(const PairArrays* pairs);
+void pairsBin_write(const char* filename, const PairArrays* pairs);
+
+/// Streams pairs into the column layout; the pair count must be known up front
+void pairsBin_openWriter(PairsBinWriter* writer, const char* filename, u64 pairCount);
+void pairsBin_append(PairsBinWriter* writer, f64 lng0, f64 lat0, f64 lng1, f64 lat1);
+/// Writes `count` pairs straight from column arrays, without copying them into the writer buffer
+void pairsBin_appendColumns(PairsBinWriter* writer, const f64* lng0, const f64* lat0, const f64* lng1, const f64* lat1, u64 count);
+void pairsBin_closeWriter(PairsBinWriter* writer);
+
+#endif //PAIRS_BIN_H
@@ -3,40 +3,152 @@
 //
 
 #include <float.h>
+#include <stdbool.h>
+#include <string.h>
 
 #include "types.h"
 #include "random_number_generator.h"
 
 static u32 xoshiro_primarySeed = 0;
-static u32 xoshiro_state[4] __attribute__((aligned(16))) = {1, 2, 3, 4};
+static Xoshiro128 xoshiro_global = { { 1, 2, 3, 4 } };
+static XoshiroLanes xoshiro_globalLanes = { 0 };
+static bool xoshiro_isLanesSeeded = false;
+
+#define XOSHIRO_ONE_BITS 0x3FF0000000000000ull
 
 static u32 xoshiro_rotl(u32 x, int k) {
     return (x << k) | (x >> (32 - k));
 }
 
-static u32 xoshiro128() {
-    u32 result = xoshiro_rotl(xoshiro_state[1] * 5, 7) * 9;
-    u32 t = xoshiro_state[1] << 9;
-    xoshiro_state[2] ^= xoshiro_state[0];
-    xoshiro_state[3] ^= xoshiro_state[1];
-    xoshiro_state[1] ^= xoshiro_state[2];
-    xoshiro_state[0] ^= xoshiro_state[3];
-    xoshiro_state[2] ^= t;
-    xoshiro_state[3] = xoshiro_rotl(xoshiro_state[3], 11);
+static inline u32 xoshiro_next(Xoshiro128* rng) {
+    u32* s = rng->state;
+    u32 result = xoshiro_rotl(s[1] * 5, 7) * 9;
+    u32 t = s[1] << 9;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = xoshiro_rotl(s[3], 11);
     return result;
 }
 
-void xoshiro_seed(u32 seed) {
-    xoshiro_primarySeed = seed;
+static u32 xoshiro128() {
+    return xoshiro_next(&xoshiro_global);
+}
 
+void xoshiro_seedState(Xoshiro128* rng, u32 seed) {
     // Scramble seed bits using the LCG constants
-    xoshiro_state[0] = seed = seed * 1664525u + 1013904223u;
-    xoshiro_state[1] = seed = seed * 1664525u + 1013904223u;
-    xoshiro_state[2] = seed = seed * 1664525u + 1013904223u;
-    xoshiro_state[3] = seed = seed * 1664525u + 1013904223u;
+    rng->state[0] = seed = seed * 1664525u + 1013904223u;
+    rng->state[1] = seed = seed * 1664525u + 1013904223u;
+    rng->state[2] = seed = seed * 1664525u + 1013904223u;
+    rng->state[3] = seed = seed * 1664525u + 1013904223u;
 
     // Warmup the entropy
-    for(int i = 0; i < 8; i++) { xoshiro128(); }
+    for(int i = 0; i < 8; i++) { xoshiro_next(rng); }
+}
+
+void xoshiro_seed(u32 seed) {
+    xoshiro_primarySeed = seed;
+    xoshiro_seedState(&xoshiro_global, seed);
+    xoshiroLanes_seed(&xoshiro_globalLanes, &xoshiro_global);
+    xoshiro_isLanesSeeded = true;
+}
+
+static void xoshiro_jumpBy(Xoshiro128* rng, const u32 poly[4]) {
+    u32 s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (int i = 0; i < 4; i++) {
+        for (int b = 0; b < 32; b++) {
+            if (poly[i] & (1u << b)) {
+                s0 ^= rng->state[0];
+                s1 ^= rng->state[1];
+                s2 ^= rng->state[2];
+                s3 ^= rng->state[3];
+            }
+            xoshiro_next(rng);
+        }
+    }
+    rng->state[0] = s0;
+    rng->state[1] = s1;
+    rng->state[2] = s2;
+    rng->state[3] = s3;
+}
+
+void xoshiro_jump(Xoshiro128* rng) {
+    static const u32 JUMP[] = { 0x8764000b, 0xf542d2d3, 0x6fa035c3, 0x77f2db5b };
+    xoshiro_jumpBy(rng, JUMP);
+}
+
+static void xoshiro_longJump(Xoshiro128* rng) {
+    static const u32 LONG_JUMP[] = { 0xb523952e, 0x0b6f099f, 0xccf5a0ef, 0x1c580662 };
+    xoshiro_jumpBy(rng, LONG_JUMP);
+}
+
+u64 xoshiro_randU64(Xoshiro128* rng) {
+    u64 high = xoshiro_next(rng);
+    return (high << 32) | xoshiro_next(rng);
+}
+
+f64 xoshiro_randF64(Xoshiro128* rng, f64 min, f64 max) {
+    // Same top 52 bits under the exponent of 1.0 as xoshiroLanes_fillF64, so [min, max) and uniform
+    u64 bits = XOSHIRO_ONE_BITS | (xoshiro_randU64(rng) >> 12);
+    f64 unit;
+    memcpy(&unit, &bits, sizeof(unit));
+    return min + (unit - 1.0) * (max - min);
+}
+
+void xoshiroLanes_seed(XoshiroLanes* lanes, const Xoshiro128* base) {
+    Xoshiro128 rng = *base;
+    for (u32 lane = 0; lane < XOSHIRO_LANES; lane++) {
+        xoshiro_longJump(&rng);
+        lanes->s0[lane] = rng.state[0];
+        lanes->s1[lane] = rng.state[1];
+        lanes->s2[lane] = rng.state[2];
+        lanes->s3[lane] = rng.state[3];
+    }
+}
+
+/// One step of every lane. Plain per-lane loops over local arrays, which the compiler turns into vector code.
+static inline void xoshiroLanes_step(u32* restrict s0, u32* restrict s1, u32* restrict s2, u32* restrict s3, u32* restrict out) {
+    for (u32 lane = 0; lane < XOSHIRO_LANES; lane++) {
+        u32 result = xoshiro_rotl(s1[lane] * 5, 7) * 9;
+        u32 t = s1[lane] << 9;
+        s2[lane] ^= s0[lane];
+        s3[lane] ^= s1[lane];
+        s1[lane] ^= s2[lane];
+        s0[lane] ^= s3[lane];
+        s2[lane] ^= t;
+        s3[lane] = xoshiro_rotl(s3[lane], 11);
+        out[lane] = result;
+    }
+}
+
+void xoshiroLanes_fillF64(XoshiroLanes* lanes, f64* out, u64 count, f64 min, f64 max) {
+    u32 s0[XOSHIRO_LANES], s1[XOSHIRO_LANES], s2[XOSHIRO_LANES], s3[XOSHIRO_LANES];
+    memcpy(s0, lanes->s0, sizeof(s0));
+    memcpy(s1, lanes->s1, sizeof(s1));
+    memcpy(s2, lanes->s2, sizeof(s2));
+    memcpy(s3, lanes->s3, sizeof(s3));
+    f64 scale = max - min;
+    for (u64 done = 0; done < count; done += XOSHIRO_LANES) {
+        u32 high[XOSHIRO_LANES], low[XOSHIRO_LANES];
+        xoshiroLanes_step(s0, s1, s2, s3, high);
+        xoshiroLanes_step(s0, s1, s2, s3, low);
+        // 52 random bits under the exponent of 1.0 give a double in [1, 2) with every mantissa equally likely
+        f64 values[XOSHIRO_LANES];
+        for (u32 lane = 0; lane < XOSHIRO_LANES; lane++) {
+            u64 bits = XOSHIRO_ONE_BITS | ((u64) high[lane] << 20) | (low[lane] >> 12);
+            f64 unit;
+            memcpy(&unit, &bits, sizeof(unit));
+            values[lane] = min + (unit - 1.0) * scale;
+        }
+        u64 take = count - done < XOSHIRO_LANES ? count - done : XOSHIRO_LANES;
+        memcpy(out + done, values, take * sizeof(f64));
+    }
+    memcpy(lanes->s0, s0, sizeof(s0));
+    memcpy(lanes->s1, s1, sizeof(s1));
+    memcpy(lanes->s2, s2, sizeof(s2));
+    memcpy(lanes->s3, s3, sizeof(s3));
 }
 
 // Inclusive of `min` and `max`
@@ -54,8 +166,14 @@ f32 rand_f32(f32 min, f32 max) {
 }
 
 f64 rand_f64(f64 min, f64 max) {
-    // Combine two 32-bit values for full 64-bit precision
-    u64 ri = ((u64)xoshiro128() << 32) | xoshiro128();
-    f64 r = (f64)ri / (f64)UINT64_MAX;
-    return min + r * (max - min);
+    // Two steps, 52 of their bits, uniform in [min, max)
+    return xoshiro_randF64(&xoshiro_global, min, max);
+}
+
+void rand_f64_fill(f64* out, u64 count, f64 min, f64 max) {
+    if (!xoshiro_isLanesSeeded) {
+        xoshiroLanes_seed(&xoshiro_globalLanes, &xoshiro_global);
+        xoshiro_isLanesSeeded = true;
+    }
+    xoshiroLanes_fillF64(&xoshiro_globalLanes, out, count, min, max);
 }
@@ -7,9 +7,36 @@
 
 #include "types.h"
 
+/// Independent generator state, for code that needs more than the one global stream
+typedef struct Xoshiro128 {
+    u32 state[4];
+} __attribute__((aligned(16))) Xoshiro128;
+
+// Interleaved states stepped together, laid out by state word so every step is one SIMD operation per word
+#define XOSHIRO_LANES 8
+
+typedef struct XoshiroLanes {
+    u32 s0[XOSHIRO_LANES];
+    u32 s1[XOSHIRO_LANES];
+    u32 s2[XOSHIRO_LANES];
+    u32 s3[XOSHIRO_LANES];
+} __attribute__((aligned(32))) XoshiroLanes;
+
 void xoshiro_seed(u32 seed);
+void xoshiro_seedState(Xoshiro128* rng, u32 seed);
+/// Advances `rng` by 2^64 steps, so repeated jumps give non-overlapping substreams
+void xoshiro_jump(Xoshiro128* rng);
+/// 64 random bits, two steps
+u64 xoshiro_randU64(Xoshiro128* rng);
+/// Uniform double in [min, max), 52 random bits
+f64 xoshiro_randF64(Xoshiro128* rng, f64 min, f64 max);
+/// Lane N starts from `base` long-jumped N + 1 times (2^96 steps each), clear of any plain jump() substreams
+void xoshiroLanes_seed(XoshiroLanes* lanes, const Xoshiro128* base);
+/// Uniform doubles in [min, max), 52 random bits each. Every call consumes whole steps of all lanes.
+void xoshiroLanes_fillF64(XoshiroLanes* lanes, f64* out, u64 count, f64 min, f64 max);
 u32 rand_u32(u32 min, u32 max);
 f32 rand_f32(f32 min, f32 max);
 f64 rand_f64(f64 min, f64 max);
+void rand_f64_fill(f64* out, u64 count, f64 min, f64 max);
 
 #endif //RANDOM_NUMBER_GENERATOR_H
@@ -0,0 +1,285 @@
+//
+// Created by stevehb on 19-Oct-26.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "types.h"
+#include "common_funcs.h"
+#include "spatial_index.h"
+
+#define SPATIAL_MAX_DEPTH 128
+// Chord bounds are widened by this much so rounding never drops a point the haversine check would keep
+#define SPATIAL_CHORD_SLACK 1e-9
+
+typedef struct {
+    u64 lo, hi;
+} SpatialRange;
+
+static void spatial_toXyz(f64 lat, f64 lng, f64* out_xyz) {
+    f64 latRad = DEG2RAD(lat);
+    f64 lngRad = DEG2RAD(lng);
+    out_xyz[0] = cos(latRad) * cos(lngRad);
+    out_xyz[1] = cos(latRad) * sin(lngRad);
+    out_xyz[2] = sin(latRad);
+}
+
+static void spatial_pointLatLng(const PairArrays* pairs, u64 pointId, f64* out_lat, f64* out_lng) {
+    u64 pairIdx = pointId >> 1;
+    bool isEnd = pointId & 1;
+    *out_lat = isEnd ? pairs->lat1[pairIdx] : pairs->lat0[pairIdx];
+    *out_lng = isEnd ? pairs->lng1[pairIdx] : pairs->lng0[pairIdx];
+}
+
+static void spatial_pushMatch(SpatialMatches* matches, u64 pointId) {
+    if (matches->count + 1 > matches->capacity) {
+        u64 newCapacity = matches->capacity == 0 ? 256 : (matches->capacity * 2);
+        u64* newIds = realloc(matches->pointIds, newCapacity * sizeof(u64));
+        if (newIds == NULL) {
+            fprintf(stderr, "ERROR: Memory re-alloc failed for %llu matches\n", newCapacity);
+            exit(1);
+        }
+        matches->pointIds = newIds;
+        matches->capacity = newCapacity;
+    }
+    matches->pointIds[matches->count++] = pointId;
+}
+
+static f64* spatial_dim(SpatialIndex* index, u32 dim) {
+    return dim == 0 ? index->x : dim == 1 ? index->y : index->z;
+}
+
+static void spatial_swap(SpatialIndex* index, u64 a, u64 b) {
+    f64 t;
+    t = index->x[a]; index->x[a] = index->x[b]; index->x[b] = t;
+    t = index->y[a]; index->y[a] = index->y[b]; index->y[b] = t;
+    t = index->z[a]; index->z[a] = index->z[b]; index->z[b] = t;
+    u64 id = index->pointIds[a]; index->pointIds[a] = index->pointIds[b]; index->pointIds[b] = id;
+}
+
+/// Quickselect: afterwards `k` holds the point that sorted order would put there, smaller ones before it, larger after
+static void spatial_select(SpatialIndex* index, u32 dim, u64 lo, u64 hi, u64 k) {
+    f64* values = spatial_dim(index, dim);
+    while (hi - lo > 1) {
+        // Median of three keeps sorted or clustered input from going quadratic. The lower middle keeps j below the last slot.
+        u64 mid = lo + (hi - lo - 1) / 2;
+        u64 last = hi - 1;
+        if (values[mid] < values[lo]) spatial_swap(index, mid, lo);
+        if (values[last] < values[lo]) spatial_swap(index, last, lo);
+        if (values[last] < values[mid]) spatial_swap(index, last, mid);
+        f64 pivot = values[mid];
+        u64 i = lo;
+        u64 j = last;
+        for (;;) {
+            while (values[i] < pivot) i++;
+            while (values[j] > pivot) j--;
+            if (i >= j) break;
+            spatial_swap(index, i, j);
+            i++;
+            j--;
+        }
+        if (k <= j) {
+            hi = j + 1;
+        } else {
+            lo = j + 1;
+        }
+    }
+}
+
+static void spatial_buildRange(SpatialIndex* index, u64 lo, u64 hi) {
+    SpatialRange stack[SPATIAL_MAX_DEPTH];
+    u32 top = 0;
+    stack[top++] = (SpatialRange){ lo, hi };
+    while (top > 0) {
+        SpatialRange range = stack[--top];
+        if (range.hi - range.lo <= SPATIAL_LEAF_POINTS) continue;
+        // Split on the axis with the widest spread
+        f64 minV[3] = { INFINITY, INFINITY, INFINITY };
+        f64 maxV[3] = { -INFINITY, -INFINITY, -INFINITY };
+        for (u64 i = range.lo; i < range.hi; i++) {
+            f64 p[3] = { index->x[i], index->y[i], index->z[i] };
+            for (u32 d = 0; d < 3; d++) {
+                minV[d] = MIN(minV[d], p[d]);
+                maxV[d] = MAX(maxV[d], p[d]);
+            }
+        }
+        u32 dim = 0;
+        for (u32 d = 1; d < 3; d++) {
+            if (maxV[d] - minV[d] > maxV[dim] - minV[dim]) dim = d;
+        }
+        u64 mid = range.lo + (range.hi - range.lo) / 2;
+        spatial_select(index, dim, range.lo, range.hi, mid);
+        index->splitDims[mid] = (u8) dim;
+        stack[top++] = (SpatialRange){ range.lo, mid };
+        stack[top++] = (SpatialRange){ mid + 1, range.hi };
+    }
+}
+
+SpatialIndex spatial_build(const PairArrays* pairs) {
+    SpatialIndex index = { 0 };
+    index.count = pairs->count * 2;
+    u64 n = MAX(1, index.count);
+    index.x = malloc(n * sizeof(f64));
+    index.y = malloc(n * sizeof(f64));
+    index.z = malloc(n * sizeof(f64));
+    index.pointIds = malloc(n * sizeof(u64));
+    index.splitDims = calloc(n, sizeof(u8));
+    if (index.x == NULL || index.y == NULL || index.z == NULL || index.pointIds == NULL || index.splitDims == NULL) {
+        fprintf(stderr, "ERROR: Memory alloc failed for a spatial index of %llu points\n", index.count);
+        exit(1);
+    }
+    for (u64 pointId = 0; pointId < index.count; pointId++) {
+        f64 lat, lng, xyz[3];
+        spatial_pointLatLng(pairs, pointId, &lat, &lng);
+        spatial_toXyz(lat, lng, xyz);
+        index.x[pointId] = xyz[0];
+        index.y[pointId] = xyz[1];
+        index.z[pointId] = xyz[2];
+        index.pointIds[pointId] = pointId;
+    }
+    spatial_buildRange(&index, 0, index.count);
+    return index;
+}
+
+void spatial_free(SpatialIndex* index) {
+    free(index->x);
+    free(index->y);
+    free(index->z);
+    free(index->pointIds);
+    free(index->splitDims);
+    *index = (SpatialIndex){ 0 };
+}
+
+void spatialMatches_free(SpatialMatches* matches) {
+    free(matches->pointIds);
+    *matches = (SpatialMatches){ 0 };
+}
+
+static f64 spatial_chordSqr(const SpatialIndex* index, u64 i, const f64* q) {
+    f64 dx = index->x[i] - q[0];
+    f64 dy = index->y[i] - q[1];
+    f64 dz = index->z[i] - q[2];
+    return dx * dx + dy * dy + dz * dz;
+}
+
+void spatial_queryRadius(const SpatialIndex* index, const PairArrays* pairs, f64 lat, f64 lng, f64 radiusKm, SpatialMatches* matches) {
+    if (index->count == 0 || radiusKm < 0.0) return;
+    f64 q[3];
+    spatial_toXyz(lat, lng, q);
+    // Chord for an arc of radiusKm: squared chord = 4 * sin^2(arc / 2), the same `a` the haversine formula builds
+    f64 halfAngle = MIN(radiusKm / (2.0 * EARTH_RAD), M_PI / 2.0);
+    f64 chord = 2.0 * sin(halfAngle) * (1.0 + SPATIAL_CHORD_SLACK) + SPATIAL_CHORD_SLACK;
+    f64 chordSqr = chord * chord;
+
+    SpatialRange stack[SPATIAL_MAX_DEPTH];
+    u32 top = 0;
+    stack[top++] = (SpatialRange){ 0, index->count };
+    while (top > 0) {
+        SpatialRange range = stack[--top];
+        if (range.hi - range.lo <= SPATIAL_LEAF_POINTS) {
+            for (u64 i = range.lo; i < range.hi; i++) {
+                if (spatial_chordSqr(index, i, q) > chordSqr) continue;
+                u64 pointId = index->pointIds[i];
+                f64 pLat, pLng;
+                spatial_pointLatLng(pairs, pointId, &pLat, &pLng);
+                if (referenceHaversineDistance(lng, lat, pLng, pLat, EARTH_RAD) <= radiusKm) {
+                    spatial_pushMatch(matches, pointId);
+                }
+            }
+            continue;
+        }
+        u64 mid = range.lo + (range.hi - range.lo) / 2;
+        u32 dim = index->splitDims[mid];
+        f64 planeDist = q[dim] - spatial_dim((SpatialIndex*) index, dim)[mid];
+        if (spatial_chordSqr(index, mid, q) <= chordSqr) {
+            u64 pointId = index->pointIds[mid];
+            f64 pLat, pLng;
+            spatial_pointLatLng(pairs, pointId, &pLat, &pLng);
+            if (referenceHaversineDistance(lng, lat, pLng, pLat, EARTH_RAD) <= radiusKm) {
+                spatial_pushMatch(matches, pointId);
+            }
+        }
+        // A side of the plane is only visited if the ball reaches it
+        if (planeDist <= 0.0 || planeDist * planeDist <= chordSqr) {
+            stack[top++] = (SpatialRange){ range.lo, mid };
+        }
+        if (planeDist >= 0.0 || planeDist * planeDist <= chordSqr) {
+            stack[top++] = (SpatialRange){ mid + 1, range.hi };
+        }
+    }
+}
+
+void spatial_bruteRadius(const PairArrays* pairs, f64 lat, f64 lng, f64 radiusKm, SpatialMatches* matches) {
+    for (u64 pointId = 0; pointId < pairs->count * 2; pointId++) {
+        f64 pLat, pLng;
+        spatial_pointLatLng(pairs, pointId, &pLat, &pLng);
+        if (referenceHaversineDistance(lng, lat, pLng, pLat, EARTH_RAD) <= radiusKm) {
+            spatial_pushMatch(matches, pointId);
+        }
+    }
+}
+
+/// Ties on distance go to the smaller point id, so the index and the brute force agree
+static void spatial_considerNearest(const PairArrays* pairs, u64 pointId, f64 lat, f64 lng, u64* bestId, f64* bestDist) {
+    f64 pLat, pLng;
+    spatial_pointLatLng(pairs, pointId, &pLat, &pLng);
+    f64 dist = referenceHaversineDistance(lng, lat, pLng, pLat, EARTH_RAD);
+    if (dist < *bestDist || (dist == *bestDist && pointId < *bestId)) {
+        *bestDist = dist;
+        *bestId = pointId;
+    }
+}
+
+u64 spatial_queryNearest(const SpatialIndex* index, const PairArrays* pairs, f64 lat, f64 lng, f64* out_distKm) {
+    u64 bestId = UINT64_MAX;
+    f64 bestDist = INFINITY;
+    f64 q[3];
+    spatial_toXyz(lat, lng, q);
+
+    SpatialRange stack[SPATIAL_MAX_DEPTH];
+    u32 top = 0;
+    if (index->count > 0) {
+        stack[top++] = (SpatialRange){ 0, index->count };
+    }
+    while (top > 0) {
+        SpatialRange range = stack[--top];
+        // Convert the best arc so far back to a chord to prune with
+        f64 bestChord = isinf(bestDist) ? INFINITY
+            : 2.0 * sin(MIN(bestDist / (2.0 * EARTH_RAD), M_PI / 2.0)) * (1.0 + SPATIAL_CHORD_SLACK) + SPATIAL_CHORD_SLACK;
+        if (range.hi - range.lo <= SPATIAL_LEAF_POINTS) {
+            for (u64 i = range.lo; i < range.hi; i++) {
+                if (spatial_chordSqr(index, i, q) <= bestChord * bestChord) {
+                    spatial_considerNearest(pairs, index->pointIds[i], lat, lng, &bestId, &bestDist);
+                }
+            }
+            continue;
+        }
+        u64 mid = range.lo + (range.hi - range.lo) / 2;
+        u32 dim = index->splitDims[mid];
+        f64 planeDist = q[dim] - spatial_dim((SpatialIndex*) index, dim)[mid];
+        if (spatial_chordSqr(index, mid, q) <= bestChord * bestChord) {
+            spatial_considerNearest(pairs, index->pointIds[mid], lat, lng, &bestId, &bestDist);
+        }
+        SpatialRange nearSide = planeDist <= 0.0 ? (SpatialRange){ range.lo, mid } : (SpatialRange){ mid + 1, range.hi };
+        SpatialRange farSide = planeDist <= 0.0 ? (SpatialRange){ mid + 1, range.hi } : (SpatialRange){ range.lo, mid };
+        // Far side first on the stack so the near side is popped first and tightens the bound
+        if (planeDist * planeDist <= bestChord * bestChord) {
+            stack[top++] = farSide;
+        }
+        stack[top++] = nearSide;
+    }
+    *out_distKm = bestDist;
+    return bestId;
+}
+
+u64 spatial_bruteNearest(const PairArrays* pairs, f64 lat, f64 lng, f64* out_distKm) {
+    u64 bestId = UINT64_MAX;
+    f64 bestDist = INFINITY;
+    for (u64 pointId = 0; pointId < pairs->count * 2; pointId++) {
+        spatial_considerNearest(pairs, pointId, lat, lng, &bestId, &bestDist);
+    }
+    *out_distKm = bestDist;
+    return bestId;
+}
@@ -0,0 +1,46 @@
+//
+// Created by stevehb on 19-Oct-26.
+//
+
+#ifndef SPATIAL_INDEX_H
+#define SPATIAL_INDEX_H
+
+#include "types.h"
+#include "haversine.h"
+
+// Subtrees this small are scanned linearly rather than split further
+#define SPATIAL_LEAF_POINTS 16
+
+/// Bulk-loaded k-d tree over the pair endpoints as unit-sphere xyz. The tree is implicit: the
+/// node for [lo, hi) splits at mid = (lo + hi) / 2 and its children are [lo, mid) and [mid + 1, hi),
+/// so the points of every subtree are contiguous and there are no child pointers to chase.
+/// Point ids are `pairIdx * 2 + endpoint`, with endpoint 0 for (lng0, lat0) and 1 for (lng1, lat1).
+typedef struct SpatialIndex {
+    f64* x;
+    f64* y;
+    f64* z;
+    u64* pointIds;
+    u8* splitDims;  // Indexed by the node's mid point
+    u64 count;
+} SpatialIndex;
+
+typedef struct SpatialMatches {
+    u64* pointIds;
+    u64 count;
+    u64 capacity;
+} SpatialMatches;
+
+SpatialIndex spatial_build(const PairArrays* pairs);
+void spatial_free(SpatialIndex* index);
+
+/// Appends every endpoint within `radiusKm` (by referenceHaversineDistance) of (lat, lng) to `matches`, in tree order
+void spatial_queryRadius(const SpatialIndex* index, const PairArrays* pairs, f64 lat, f64 lng, f64 radiusKm, SpatialMatches* matches);
+/// Same result by scanning every endpoint, in point id order
+void spatial_bruteRadius(const PairArrays* pairs, f64 lat, f64 lng, f64 radiusKm, SpatialMatches* matches);
+/// Returns the point id of the endpoint closest to (lat, lng), and its distance in `out_distKm`
+u64 spatial_queryNearest(const SpatialIndex* index, const PairArrays* pairs, f64 lat, f64 lng, f64* out_distKm);
+u64 spatial_bruteNearest(const PairArrays* pairs, f64 lat, f64 lng, f64* out_distKm);
+
+void spatialMatches_free(SpatialMatches* matches);
+
+#endif //SPATIAL_INDEX_H
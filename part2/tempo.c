@@ -2,12 +2,29 @@
 #include "common_funcs.h"
 #include "tempo.h"
 #include "types.h"
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 static u64 tempo_getOsTimerFreq(void);
 static u64 tempo_readOsTimer(void);
 static u64 tempo_readCpuTimer(void);
 
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifndef RUSAGE_THREAD
+#define RUSAGE_THREAD 1     // Only declared with _GNU_SOURCE, which clashes with basename in common_funcs.h
+#endif
+#endif
+
 #ifdef _WIN32
 #include <intrin.h>
 #include <windows.h>
@@ -28,9 +45,9 @@ static u64 tempo_getOsTimerFreq(void) {
     return 1000000;  // Known microseconds
 }
 static u64 tempo_readOsTimer(void) {
-    struct timerval value;
+    struct timeval value;
     gettimeofday(&value, 0);
-    u64 result = (getOsTimerFreq() * (u64)value.tv_sec) + (u64)value.tv_usec;
+    u64 result = (tempo_getOsTimerFreq() * (u64)value.tv_sec) + (u64)value.tv_usec;
     return result;
 }
 #endif
@@ -59,102 +76,891 @@ u64 tempo_estimateCpuFreq(u64 testDurationMillis) {
 }
 
 
+u64 tempo_readTicks(void) {
+    return tempo_readCpuTimer();
+}
+
+#if TEMPO_ENABLED
+
+#define TEMPO_LABEL_CACHE_SIZE 2048
+// Empty blocks timed per round when measuring the profiler's own cost, the cheapest round wins
+#define TEMPO_CALIBRATION_ROUNDS 16
+#define TEMPO_CALIBRATION_BLOCKS 1000
+// Largest share of a block's measured time the overhead estimate may take out, above it the block is left as is
+#define TEMPO_MAX_OVERHEAD_SHARE 0.5
+
+/// A thread's counters plus what only this file touches. The counters come first, so tempoThread points at both.
+typedef struct TempoThread {
+    TempoState state;
+    char label[TEMPO_THREAD_LABEL_LEN];
+    // Open blocks of tempo_startBlock, which can't keep their scope on the caller's stack
+    TempoScope stack[TEMPO_MAX_DEPTH];
+    u32 depth;
+    // Label pointer to anchor, so tempo_startBlock finds its anchor without comparing strings
+    struct {
+        const char* label;
+        u32 anchorIdx;
+    } labelCache[TEMPO_LABEL_CACHE_SIZE];
+} TempoThread;
+
+typedef struct {
+    const char* label;
+} TempoAnchorInfo;
+
+TEMPO_THREAD_LOCAL TempoState* tempoThread = NULL;
+
 static struct {
-    u32 currentDepth;
-    TempoBlock blocks[TEMPO_MAX_BLOCKS];
-    u32 currentBlock;
-    u32 nextBlockIdx;
+    atomic_flag lock;       // Registration only, never taken on the hot path
+    TempoAnchorInfo anchors[TEMPO_MAX_ANCHORS];
+    u32 anchorCount;
+    TempoThread* threads[TEMPO_MAX_THREADS];
+    u32 threadCount;
+    TempoThread* mainThread;
+    u32 rootAnchor;
+    TempoStage stages[TEMPO_MAX_STAGES];
+    u32 stageCount;
+    u32 counterCount;       // Leading TEMPO_COUNTERS every thread opens, 0 when not counting
+    bool isTrackingMemory;
+    int statmFd;            // Kept open, one pread per sample of the resident set
+    u64 traceCapacity;      // Ring slots for each thread, 0 when not tracing
+    u64 traceStartTicks;    // Time zero of the trace, when the profile started
+    bool isCalibrated;
+    f64 innerOverhead;      // Ticks an empty block records for itself
+    f64 outerOverhead;      // Ticks an empty block adds to its parent, the inner ones included
     u64 osTimerStart;
     u64 osTimerStop;
     u64 cpuFreq;
-} tempoData;
+} tempoData = { .lock = ATOMIC_FLAG_INIT, .anchorCount = 1 };
+
+static void tempo_lock(void) {
+    while (atomic_flag_test_and_set_explicit(&tempoData.lock, memory_order_acquire)) {
+        thread_yield();
+    }
+}
+static void tempo_unlock(void) {
+    atomic_flag_clear_explicit(&tempoData.lock, memory_order_release);
+}
+
+static void tempo_allocTrace(TempoThread* thread, u64 capacity) {
+    thread->state.traceEvents = calloc(capacity, sizeof(TempoTraceEvent));
+    if (thread->state.traceEvents == NULL) {
+        fprintf(stderr, "ERROR: Memory alloc failed for %llu trace events\n", capacity);
+        exit(1);
+    }
+    thread->state.traceCount = 0;
+    thread->state.traceMask = capacity - 1;
+}
+
+#define STRING_ENTRY(name, str) str,
+static const char* TEMPO_COUNTER_STRS[] = {
+    TEMPO_COUNTERS(STRING_ENTRY)
+};
+#undef STRING_ENTRY
+
+typedef struct {
+    u64 minorFaults;
+    u64 majorFaults;
+    u64 rss;
+    u64 peakRss;
+} TempoMemorySample;
+
+/// A thread's open counters and the readings of its open blocks, which close in the reverse order
+typedef struct TempoCounterSet {
+    u32 count;          // Hardware counters open on this thread
+    bool hasMemory;
+    // Blocks opened since counting started. Keeps counting past TEMPO_MAX_DEPTH, the deeper blocks just go
+    // without, and blocks that were already open close once it is back at 0.
+    u32 depth;
+    struct {
+        // What was read at the open, counting may have been extended since
+        u32 count;
+        bool hasMemory;
+        u64 start[TEMPO_COUNTER_COUNT];
+        u64 old[TEMPO_COUNTER_COUNT];
+        TempoMemorySample memoryStart;
+        u64 oldMinorFaults, oldMajorFaults;
+        s64 oldRssDelta;
+    } stack[TEMPO_MAX_DEPTH];
+#ifdef __linux__
+    int fds[TEMPO_COUNTER_COUNT];
+    struct perf_event_mmap_page* pages[TEMPO_COUNTER_COUNT];
+#endif
+} TempoCounterSet;
+
+#ifdef __linux__
+static const struct {
+    u32 type;
+    u64 config;
+} TEMPO_COUNTER_EVENTS[TEMPO_COUNTER_COUNT] = {
+    [TEMPO_COUNTER_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [TEMPO_COUNTER_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [TEMPO_COUNTER_BRANCHES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+    [TEMPO_COUNTER_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    [TEMPO_COUNTER_L1D_MISSES] = { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+        | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    [TEMPO_COUNTER_LLC_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    [TEMPO_COUNTER_DTLB_MISSES] = { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB
+        | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+};
+
+static void tempo_closeCounterFds(TempoCounterSet* set) {
+    for (u32 c = 0; c < set->count; c++) {
+        if (set->pages[c] != NULL) {
+            munmap(set->pages[c], (size_t) sysconf(_SC_PAGESIZE));
+        }
+        close(set->fds[c]);
+    }
+    set->count = 0;
+}
+
+/// Opens the first `count` counters as one group on the calling thread, so they are scheduled together. The
+/// mapped page of each lets tempo_readCounter use rdpmc instead of a syscall. Returns errno of the first failure.
+static int tempo_openCounterFds(TempoCounterSet* set, u32 count) {
+    set->count = 0;
+    for (u32 c = 0; c < count; c++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = TEMPO_COUNTER_EVENTS[c].type;
+        attr.config = TEMPO_COUNTER_EVENTS[c].config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        int groupFd = (c == 0) ? -1 : set->fds[0];
+        int fd = (int) syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+        if (fd < 0) {
+            int error = errno;
+            tempo_closeCounterFds(set);
+            return error;
+        }
+        set->fds[c] = fd;
+        void* page = mmap(NULL, (size_t) sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+        set->pages[c] = (page == MAP_FAILED) ? NULL : page;
+        set->count++;
+    }
+    return 0;
+}
+
+/// Fallback read, which also says whether the group was on the hardware at all
+static u64 tempo_readCounterFd(int fd, u64* runningTicks) {
+    u64 values[3] = { 0 };  // value, time enabled, time running
+    if (read(fd, values, sizeof(values)) != (ssize_t) sizeof(values)) {
+        values[0] = values[2] = 0;
+    }
+    if (runningTicks != NULL) {
+        *runningTicks = values[2];
+    }
+    return values[0];
+}
+
+static u64 tempo_readCounter(const TempoCounterSet* set, u32 c) {
+    volatile struct perf_event_mmap_page* page = set->pages[c];
+    if (page != NULL && page->cap_user_rdpmc) {
+        // Seqlock against the kernel moving the counter, which bumps `lock` around every update of the page
+        for (;;) {
+            u32 seq = page->lock;
+            atomic_signal_fence(memory_order_seq_cst);
+            u32 idx = page->index;
+            if (idx == 0) {
+                break;  // Not on the hardware right now
+            }
+            s64 count = page->offset;
+            u32 width = page->pmc_width;
+            s64 pmc = (s64) __rdpmc((int) idx - 1);
+            pmc = (s64) ((u64) pmc << (64 - width)) >> (64 - width);
+            atomic_signal_fence(memory_order_seq_cst);
+            if (page->lock == seq) {
+                return (u64) (count + pmc);
+            }
+        }
+    }
+    return tempo_readCounterFd(set->fds[c], NULL);
+}
+
+/// Opens the group on the calling thread, dropping counters from the end until the hardware schedules it
+static u32 tempo_openCounterGroup(TempoCounterSet* set, u32 count, int* error) {
+    *error = 0;
+    for (; count > 0; count--) {
+        *error = tempo_openCounterFds(set, count);
+        if (*error != 0) {
+            continue;
+        }
+        // A group too big for the PMU is accepted but never runs
+        u64 spinStart = tempo_readCpuTimer();
+        while (tempo_readCpuTimer() - spinStart < 1000000) {
+        }
+        u64 runningTicks = 0;
+        tempo_readCounterFd(set->fds[0], &runningTicks);
+        if (runningTicks > 0) {
+            return count;
+        }
+        tempo_closeCounterFds(set);
+    }
+    return 0;
+}
+#endif
+
+static TempoCounterSet* tempo_allocCounters(void) {
+    TempoCounterSet* set = calloc(1, sizeof(TempoCounterSet));
+    if (set == NULL) {
+        fprintf(stderr, "ERROR: Memory alloc failed for %llu bytes of counter state\n", (u64) sizeof(TempoCounterSet));
+        exit(1);
+    }
+    return set;
+}
+
+/// Gives a newly registered thread the counting the main thread settled on. A thread whose hardware counters
+/// fail to open silently goes without them.
+static void tempo_threadCounters(TempoThread* thread) {
+    TempoCounterSet* set = tempo_allocCounters();
+    set->hasMemory = tempoData.isTrackingMemory;
+#ifdef __linux__
+    int error = 0;
+    if (tempoData.counterCount > 0 && tempo_openCounterGroup(set, tempoData.counterCount, &error) != tempoData.counterCount) {
+        tempo_closeCounterFds(set);
+    }
+#endif
+    if (set->count == 0 && !set->hasMemory) {
+        free(set);
+        return;
+    }
+    thread->state.counters = set;
+}
+
+static void tempo_readMemory(TempoMemorySample* sample) {
+#ifdef __linux__
+    struct rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    sample->minorFaults = (u64) usage.ru_minflt;
+    sample->majorFaults = (u64) usage.ru_majflt;
+    sample->peakRss = (u64) usage.ru_maxrss * 1024;   // Process wide, in KB
+    sample->rss = 0;
+    char buff[64];
+    ssize_t len = pread(tempoData.statmFd, buff, sizeof(buff) - 1, 0);
+    if (len > 0) {
+        buff[len] = '\0';
+        u64 sizePages = 0, residentPages = 0;
+        if (sscanf(buff, "%llu %llu", &sizePages, &residentPages) == 2) {
+            sample->rss = residentPages * (u64) sysconf(_SC_PAGESIZE);
+        }
+    }
+#else
+    memset(sample, 0, sizeof(*sample));
+#endif
+}
+
+bool tempo_startMemory(void) {
+    TempoThread* thread = (TempoThread*) tempo_thread();
+    if (tempoData.isTrackingMemory) {
+        return true;
+    }
+#ifdef __linux__
+    int statmFd = open("/proc/self/statm", O_RDONLY);
+    if (statmFd < 0) {
+        printf("NOTE: Cannot read /proc/self/statm (%s), profiling without page faults\n", strerror(errno));
+        return false;
+    }
+    TempoCounterSet* set = thread->state.counters != NULL ? thread->state.counters : tempo_allocCounters();
+    set->hasMemory = true;
+    tempo_lock();
+    tempoData.statmFd = statmFd;
+    tempoData.isTrackingMemory = true;
+    thread->state.counters = set;
+    tempo_unlock();
+    return true;
+#else
+    (void) thread;
+    printf("NOTE: Page fault tracking needs Linux getrusage and /proc, profiling without it\n");
+    return false;
+#endif
+}
+
+bool tempo_startCounters(void) {
+    TempoThread* thread = (TempoThread*) tempo_thread();
+    if (tempoData.counterCount > 0) {
+        return true;
+    }
+#ifdef __linux__
+    TempoCounterSet* set = thread->state.counters != NULL ? thread->state.counters : tempo_allocCounters();
+    int error = 0;
+    u32 count = tempo_openCounterGroup(set, TEMPO_COUNTER_COUNT, &error);
+    if (count == 0) {
+        if (thread->state.counters == NULL) {
+            free(set);
+        }
+        printf("NOTE: Hardware counters not available (%s), profiling ticks only\n",
+            error != 0 ? strerror(error) : "the counter group never ran");
+        if (error == EACCES || error == EPERM) {
+            printf("NOTE: Counting user space needs /proc/sys/kernel/perf_event_paranoid at 2 or below\n");
+        }
+        return false;
+    }
+    if (count < TEMPO_COUNTER_COUNT) {
+        printf("NOTE: Only %u of %d hardware counters fit together, %s and after are not counted\n",
+            count, TEMPO_COUNTER_COUNT, TEMPO_COUNTER_STRS[count]);
+    }
+    tempo_lock();
+    tempoData.counterCount = count;
+    thread->state.counters = set;
+    tempo_unlock();
+    return true;
+#else
+    printf("NOTE: Hardware counters need Linux perf_event_open, profiling ticks only\n");
+    return false;
+#endif
+}
+
+void tempo_openCounters(TempoState* thread) {
+    TempoCounterSet* set = thread->counters;
+    u32 depth = set->depth++;
+    if (depth < TEMPO_MAX_DEPTH) {
+        const TempoAnchor* anchor = &thread->anchors[thread->currentAnchor];
+        set->stack[depth].count = set->count;
+        set->stack[depth].hasMemory = set->hasMemory;
+        if (set->hasMemory) {
+            set->stack[depth].oldMinorFaults = anchor->minorFaults;
+            set->stack[depth].oldMajorFaults = anchor->majorFaults;
+            set->stack[depth].oldRssDelta = anchor->rssDelta;
+            tempo_readMemory(&set->stack[depth].memoryStart);
+        }
+#ifdef __linux__
+        for (u32 c = 0; c < set->count; c++) {
+            set->stack[depth].old[c] = anchor->counters[c];
+            set->stack[depth].start[c] = tempo_readCounter(set, c);
+        }
+#endif
+    }
+}
+
+void tempo_closeCounters(TempoState* thread, u32 anchorIdx) {
+    TempoCounterSet* set = thread->counters;
+    if (set->depth == 0) {
+        return;  // Opened before counting started
+    }
+    u32 depth = --set->depth;
+    if (depth < TEMPO_MAX_DEPTH) {
+        TempoAnchor* anchor = &thread->anchors[anchorIdx];
+        // Same as inclusiveTicks, the outermost call of a recursive block has the final say
+#ifdef __linux__
+        for (u32 c = 0; c < set->stack[depth].count; c++) {
+            anchor->counters[c] = set->stack[depth].old[c] + (tempo_readCounter(set, c) - set->stack[depth].start[c]);
+        }
+#endif
+        if (set->stack[depth].hasMemory) {
+            const TempoMemorySample* start = &set->stack[depth].memoryStart;
+            TempoMemorySample stop;
+            tempo_readMemory(&stop);
+            anchor->minorFaults = set->stack[depth].oldMinorFaults + (stop.minorFaults - start->minorFaults);
+            anchor->majorFaults = set->stack[depth].oldMajorFaults + (stop.majorFaults - start->majorFaults);
+            anchor->rssDelta = set->stack[depth].oldRssDelta + ((s64) stop.rss - (s64) start->rss);
+            // A new high-water mark was set inside the block, otherwise the ends are the best guess
+            u64 peakRss = stop.peakRss > start->peakRss ? stop.peakRss : MAX(start->rss, stop.rss);
+            anchor->peakRss = MAX(anchor->peakRss, peakRss);
+        }
+    }
+}
+
+TempoState* tempo_registerThread(void) {
+    TempoThread* thread = calloc(1, sizeof(TempoThread));
+    if (thread == NULL) {
+        fprintf(stderr, "ERROR: Memory alloc failed for %llu bytes of profiler state\n", (u64) sizeof(TempoThread));
+        exit(1);
+    }
+    tempo_lock();
+    if (tempoData.threadCount >= TEMPO_MAX_THREADS) {
+        tempo_unlock();
+        fprintf(stderr, "ERROR: Cannot profile another thread: more than %d threads!\n", TEMPO_MAX_THREADS);
+        exit(1);
+    }
+    snprintf(thread->label, TEMPO_THREAD_LABEL_LEN, "thread[%u]", tempoData.threadCount);
+    if (tempoData.traceCapacity > 0) {
+        tempo_allocTrace(thread, tempoData.traceCapacity);
+    }
+    // Kept after the thread exits, its totals are reported at the end
+    tempoData.threads[tempoData.threadCount++] = thread;
+    tempo_unlock();
+    if (tempoData.counterCount > 0 || tempoData.isTrackingMemory) {
+        tempo_threadCounters(thread);
+    }
+    tempoThread = &thread->state;
+    return tempoThread;
+}
+
+void tempo_nameThread(const char* label) {
+    TempoThread* thread = (TempoThread*) tempo_thread();
+    snprintf(thread->label, TEMPO_THREAD_LABEL_LEN, "%s", label);
+}
+
+u32 tempo_registerSite(u32* siteIdx, const char* label) {
+    tempo_lock();
+    u32 anchorIdx = 0;
+    for (u32 i = 1; i < tempoData.anchorCount; i++) {
+        if (strcmp(tempoData.anchors[i].label, label) == 0) {
+            anchorIdx = i;
+            break;
+        }
+    }
+    if (anchorIdx == 0) {
+        if (tempoData.anchorCount >= TEMPO_MAX_ANCHORS) {
+            tempo_unlock();
+            fprintf(stderr, "ERROR: Cannot add profiler block '%s': too many distinct blocks!\n", label);
+            exit(1);
+        }
+        anchorIdx = tempoData.anchorCount++;
+        tempoData.anchors[anchorIdx].label = label;
+    }
+    *siteIdx = anchorIdx;
+    tempo_unlock();
+    return anchorIdx;
+}
+
+static u32* tempo_labelSite(TempoThread* thread, const char* label) {
+    u64 hash = ((u64) (uintptr_t) label * 0x9E3779B97F4A7C15ull) >> 32;
+    for (u32 probe = 0; probe < TEMPO_LABEL_CACHE_SIZE; probe++) {
+        u32 slot = (u32) (hash + probe) & (TEMPO_LABEL_CACHE_SIZE - 1);
+        if (thread->labelCache[slot].label == label || thread->labelCache[slot].label == NULL) {
+            thread->labelCache[slot].label = label;
+            return &thread->labelCache[slot].anchorIdx;
+        }
+    }
+    fprintf(stderr, "ERROR: Cannot start profiler block '%s': too many block labels!\n", label);
+    exit(1);
+}
+
+/// Times empty blocks on scratch counters, with the same inline code every real block runs
+static void tempo_calibrate(void) {
+    TempoState* savedThread = tempoThread;
+    TempoState* scratch = calloc(1, sizeof(TempoState));
+    if (scratch == NULL) {
+        fprintf(stderr, "ERROR: Memory alloc failed for %llu bytes of profiler state\n", (u64) sizeof(TempoState));
+        exit(1);
+    }
+    tempoThread = scratch;
+    u32 siteIdx = 1;  // Preset, so the scratch blocks never register an anchor
+    f64 bestInner = 0.0, bestOuter = 0.0;
+    for (u32 round = 0; round < TEMPO_CALIBRATION_ROUNDS; round++) {
+        scratch->anchors[siteIdx].inclusiveTicks = 0;
+        u64 startTicks = tempo_readCpuTimer();
+        for (u32 i = 0; i < TEMPO_CALIBRATION_BLOCKS; i++) {
+            TempoScope scope = tempo_openScope(&siteIdx, "calibration");
+            tempo_closeScope(&scope);
+        }
+        u64 roundTicks = tempo_readCpuTimer() - startTicks;
+        f64 inner = (f64) scratch->anchors[siteIdx].inclusiveTicks / TEMPO_CALIBRATION_BLOCKS;
+        f64 outer = (f64) roundTicks / TEMPO_CALIBRATION_BLOCKS;
+        bestInner = (round == 0) ? inner : MIN(bestInner, inner);
+        bestOuter = (round == 0) ? outer : MIN(bestOuter, outer);
+    }
+    tempoThread = savedThread;
+    free(scratch);
+    tempoData.innerOverhead = bestInner;
+    tempoData.outerOverhead = MAX(bestOuter, bestInner);
+    tempoData.isCalibrated = true;
+}
+
+/// Time a thread spent in top-level blocks, which anchor 0 counts down
+static u64 tempo_threadTicks(const TempoAnchor* anchors) {
+    return (u64) 0 - anchors[0].exclusiveTicks;
+}
 
 void tempo_startProfile(const char* label) {
-    memset(&tempoData, 0, sizeof(tempoData));
-    tempoData.currentDepth = -1;
-    tempoData.currentBlock = 0;
-    tempoData.nextBlockIdx = 0;
+    TempoThread* mainThread = (TempoThread*) tempo_thread();
+    tempo_nameThread("main");
+    if (!tempoData.isCalibrated) {
+        tempo_calibrate();
+    }
+    // Any other threads are expected to be idle between profiles
+    tempo_lock();
+    for (u32 t = 0; t < tempoData.threadCount; t++) {
+        memset(tempoData.threads[t]->state.anchors, 0, sizeof(tempoData.threads[t]->state.anchors));
+        tempoData.threads[t]->state.currentAnchor = 0;
+        tempoData.threads[t]->state.hitTotal = 0;
+        tempoData.threads[t]->state.traceCount = 0;
+        if (tempoData.threads[t]->state.counters != NULL) {
+            tempoData.threads[t]->state.counters->depth = 0;
+        }
+        tempoData.threads[t]->depth = 0;
+    }
+    tempo_unlock();
+    tempoData.mainThread = mainThread;
+    tempoData.stageCount = 0;
     tempoData.osTimerStart = tempo_readOsTimer();
     tempo_startBlock(label);
+    tempoData.rootAnchor = mainThread->stack[0].anchorIdx;
+    tempoData.traceStartTicks = mainThread->stack[0].startTicks;
 }
 void tempo_stopProfile(void) {
-    u64 stopCpuTicks = tempo_readCpuTimer();
-    u64 stopOsTicks = tempo_readOsTimer();
-    if (tempoData.currentBlock != 0) {
-        fprintf(stderr, "WARNING: end of Tempo period with open blocks: currentBlock=%d\n", tempoData.currentBlock);
+    TempoThread* mainThread = tempoData.mainThread;
+    if (mainThread == NULL || (TempoState*) mainThread != tempoThread) {
+        fprintf(stderr, "WARNING: Tempo period stopped on a thread that did not start it\n");
+        return;
+    }
+    if (mainThread->depth > 1) {
+        fprintf(stderr, "WARNING: end of Tempo period with open blocks: %s and %u more\n",
+            tempoData.anchors[mainThread->stack[mainThread->depth - 1].anchorIdx].label, mainThread->depth - 2);
     }
-    tempoData.blocks[0].stopTicks = stopCpuTicks;
-    tempoData.osTimerStop = stopOsTicks;
+    while (mainThread->depth > 0) {
+        tempo_closeScope(&mainThread->stack[--mainThread->depth]);
+    }
+    tempoData.osTimerStop = tempo_readOsTimer();
     u64 osFreq = tempo_getOsTimerFreq();
     u64 osTicks = tempoData.osTimerStop - tempoData.osTimerStart;
-    u64 cpuTicks = tempoData.blocks[0].stopTicks - tempoData.blocks[0].startTicks;
+    u64 cpuTicks = mainThread->state.anchors[tempoData.rootAnchor].inclusiveTicks;
     tempoData.cpuFreq = (u64)(((f64) osFreq * (f64) cpuTicks) / (f64) osTicks);
 }
 
+/// IPC, branch misses and cache/TLB misses of a block, per KB when it counted bytes and per 1k instructions if not
+static void tempo_printCounters(const TempoAnchor* anchor, u32 depth) {
+    const u64* counters = anchor->counters;
+    u32 count = tempoData.counterCount;
+    if (count <= TEMPO_COUNTER_INSTRUCTIONS || counters[TEMPO_COUNTER_CYCLES] == 0) {
+        return;
+    }
+    printf("TEMPO: %*s  IPC %.2f", depth * 2, "",
+        (f64) counters[TEMPO_COUNTER_INSTRUCTIONS] / (f64) counters[TEMPO_COUNTER_CYCLES]);
+    if (count > TEMPO_COUNTER_BRANCH_MISSES && counters[TEMPO_COUNTER_BRANCHES] > 0) {
+        printf(", %.3f%% of %llu branches missed", (f64) counters[TEMPO_COUNTER_BRANCH_MISSES]
+            / (f64) counters[TEMPO_COUNTER_BRANCHES] * 100.0, counters[TEMPO_COUNTER_BRANCHES]);
+    }
+    if (count > TEMPO_COUNTER_L1D_MISSES) {
+        bool perKb = anchor->byteCount > 0;
+        f64 scale = perKb ? (f64) anchor->byteCount / 1024.0 : (f64) MAX(counters[TEMPO_COUNTER_INSTRUCTIONS], 1) / 1000.0;
+        printf(", misses per %s:", perKb ? "KB" : "1k instructions");
+        for (u32 c = TEMPO_COUNTER_L1D_MISSES; c < count; c++) {
+            printf(" %s=%.3f", TEMPO_COUNTER_STRS[c], (f64) counters[c] / scale);
+        }
+    }
+    printf("\n");
+}
+
+/// Page faults of a block, per MB when it counted bytes, and how the resident set moved
+static void tempo_printMemory(const TempoAnchor* anchor, u32 depth) {
+    if (!tempoData.isTrackingMemory || anchor->peakRss == 0) {
+        return;
+    }
+    u64 faultCount = anchor->minorFaults + anchor->majorFaults;
+    printf("TEMPO: %*s  %llu minor + %llu major page faults", depth * 2, "", anchor->minorFaults, anchor->majorFaults);
+    if (anchor->byteCount > 0) {
+        printf(" (%.3f/MB)", (f64) faultCount / ((f64) anchor->byteCount / (1024.0 * 1024.0)));
+    }
+    printf(", RSS %+.3fMB, peak %.3fMB\n", (f64) anchor->rssDelta / (1024.0 * 1024.0),
+        (f64) anchor->peakRss / (1024.0 * 1024.0));
+}
+
+/// Calibration times bare blocks. Counters and memory samples add a slow path to every block that it never saw,
+/// so nothing is taken out while they run.
+static bool tempo_isCorrecting(void) {
+    return tempoData.counterCount == 0 && !tempoData.isTrackingMemory;
+}
+
+/// Ticks the profiler adds to a span holding `ownHits` blocks that time themselves and `nestedHits` blocks that
+/// run inside them. Each block records its inner overhead itself and adds the outer one to everything around it.
+static f64 tempo_overheadTicks(f64 ownHits, f64 nestedHits) {
+    if (!tempo_isCorrecting()) return 0.0;
+    return ownHits * tempoData.innerOverhead + nestedHits * tempoData.outerOverhead;
+}
+
+/// Whether `overheadTicks` is a small enough share of `rawTicks` to take out. Past that the estimate is most of
+/// what was measured and its own error swamps the block, so the block is shown as measured instead.
+static bool tempo_isCorrectable(f64 rawTicks, f64 overheadTicks) {
+    return tempo_isCorrecting() && overheadTicks <= TEMPO_MAX_OVERHEAD_SHARE * rawTicks;
+}
+
+/// Time a thread spent in top-level blocks with the profiler's cost taken out, the basis of its percentages
+static u64 tempo_correctedThreadTicks(const TempoAnchor* anchors, u64 hitTotal) {
+    u64 topHits = anchors[0].childHitCount;
+    f64 rawTicks = (f64) tempo_threadTicks(anchors);
+    f64 overheadTicks = tempo_overheadTicks((f64) topHits, (f64) (hitTotal - topHits));
+    if (!tempo_isCorrectable(rawTicks, overheadTicks)) {
+        return (u64) rawTicks;
+    }
+    return (u64) MAX(rawTicks - overheadTicks, 0.0);
+}
+
+static void tempo_printAnchor(const TempoAnchor* anchors, u32 anchorIdx, u32 depth, u64 parentTicks, u64 totalTicks) {
+    const TempoAnchor* anchor = &anchors[anchorIdx];
+    // Inclusive time only covers the outermost hits of a recursive block, exclusive time covers every hit
+    f64 rawInclusive = (f64) anchor->inclusiveTicks;
+    f64 rawExclusive = (f64) (s64) anchor->exclusiveTicks;
+    f64 inclusiveOverhead = tempo_overheadTicks((f64) anchor->outerHitCount, (f64) anchor->nestedHitCount);
+    bool isCorrected = tempo_isCorrectable(rawInclusive, inclusiveOverhead);
+    f64 inclusive = rawInclusive;
+    f64 exclusive = rawExclusive;
+    if (isCorrected) {
+        inclusive -= inclusiveOverhead;
+        exclusive -= tempo_overheadTicks((f64) anchor->hitCount - (f64) anchor->childHitCount, (f64) anchor->childHitCount);
+    }
+    // Parent and child are corrected with different per-hit costs, the estimate must not put a child past its parent
+    u64 inclusiveTicks = (u64) MIN(MAX(inclusive, 0.0), (f64) parentTicks);
+    u64 exclusiveTicks = (u64) MIN(MAX(exclusive, 0.0), (f64) inclusiveTicks);
+    if (anchor->hitCount > 0) {
+        f64 pctOfParent = ((f64) inclusiveTicks / (f64) parentTicks) * 100.0;
+        f64 blockMs = ((f64) inclusiveTicks / (f64) tempoData.cpuFreq) * 1000.0;
+        f64 selfPct = ((f64) exclusiveTicks / (f64) totalTicks) * 100.0;
+        f64 selfMs = ((f64) exclusiveTicks / (f64) tempoData.cpuFreq) * 1000.0;
+        printf("TEMPO: %*s%s[%llu]: elapsed=%llu (%.3fms, %6.3f%%) self=%llu (%.3fms, %6.3f%% of total)",
+            depth * 2, "", tempoData.anchors[anchorIdx].label, anchor->hitCount, inclusiveTicks, blockMs, pctOfParent,
+            exclusiveTicks, selfMs, selfPct);
+        if (tempo_isCorrecting() && !isCorrected) {
+            printf(" uncorrected, overhead ~%.0f%% of it\n", inclusiveOverhead / MAX(rawInclusive, 1.0) * 100.0);
+        } else {
+            printf("\n");
+        }
+        // Nothing left once the overhead is out means the block was too short to give a rate
+        f64 blockSecs = (f64) inclusiveTicks / (f64) tempoData.cpuFreq;
+        if (anchor->byteCount > 0 && inclusiveTicks > 0) {
+            f64 megabytes = (f64) anchor->byteCount / (1024.0 * 1024.0);
+            printf("TEMPO: %*s  %.3fMB at %.3fMB/s (%.3fGB/s), %.3f cycles/byte\n", depth * 2, "", megabytes,
+                megabytes / blockSecs, megabytes / 1024.0 / blockSecs, (f64) inclusiveTicks / (f64) anchor->byteCount);
+        }
+        if (anchor->itemCount > 0 && inclusiveTicks > 0) {
+            printf("TEMPO: %*s  %llu items at %.3fns/item, %.3f cycles/item\n", depth * 2, "", anchor->itemCount,
+                blockSecs * 1e9 / (f64) anchor->itemCount, (f64) inclusiveTicks / (f64) anchor->itemCount);
+        }
+        tempo_printCounters(anchor, depth);
+        tempo_printMemory(anchor, depth);
+    }
+    // Another thread may have registered a child before this one, so every anchor is a candidate. A block still
+    // open when the profile ended has no hits yet, its children move up in its place.
+    u32 childDepth = anchor->hitCount > 0 ? depth + 1 : depth;
+    u64 childParentTicks = anchor->hitCount > 0 ? MAX(inclusiveTicks, 1) : parentTicks;
+    for (u32 i = 1; i < tempoData.anchorCount; i++) {
+        if (anchors[i].firstParent == anchorIdx + 1) {
+            tempo_printAnchor(anchors, i, childDepth, childParentTicks, totalTicks);
+        }
+    }
+}
+
+static void tempo_printTree(const TempoAnchor* anchors, u64 totalTicks) {
+    for (u32 i = 1; i < tempoData.anchorCount; i++) {
+        if (anchors[i].firstParent == 1) {
+            tempo_printAnchor(anchors, i, 0, MAX(totalTicks, 1), MAX(totalTicks, 1));
+        }
+    }
+}
+
 void tempo_printProfile(void) {
-    if (tempoData.nextBlockIdx == 0) {
+    TempoThread* mainThread = tempoData.mainThread;
+    u64 recordedTicks = mainThread != NULL ? mainThread->state.anchors[tempoData.rootAnchor].inclusiveTicks : 0;
+    if (tempoData.rootAnchor == 0 || recordedTicks == 0) {
         printf("TEMPO: No recorded blocks\n");
         return;
     }
-    u32 maxDepth = 0;
-    u32 maxLabelLen = 0;
-    for (u32 i = 0; i < tempoData.nextBlockIdx; i++) {
-        maxDepth = MAX(tempoData.blocks[i].depth, maxDepth);
-        maxLabelLen = MAX(strlen(tempoData.blocks[i].label), maxLabelLen);
+    printf("TEMPO: Recorded %llu ticks: %.3fms at %.3fGHz\n",
+        recordedTicks, ((f64) recordedTicks / (f64) tempoData.cpuFreq) * 1000.0, (f64)tempoData.cpuFreq / 1000000000.0);
+    u64 blockCount = 0;
+    for (u32 t = 0; t < tempoData.threadCount; t++) {
+        blockCount += tempoData.threads[t]->state.hitTotal;
     }
-    u64 totalTicks = tempoData.blocks[0].stopTicks - tempoData.blocks[0].startTicks;
+    // Every time and percentage below is on the corrected basis, the wall clock included
+    u64 totalTicks = MAX(tempo_correctedThreadTicks(mainThread->state.anchors, mainThread->state.hitTotal), 1);
     f64 totalMs = ((f64) totalTicks / (f64) tempoData.cpuFreq) * 1000.0;
-    printf("TEMPO: Recorded %llu ticks: %.3fms at %.3fGHz\n",
-        totalTicks, totalMs, (f64)tempoData.cpuFreq / 1000000000.0);
-    u64 parentStack[TEMPO_MAX_BLOCKS + 1] = { 0 };
-    parentStack[0] = totalTicks;
-    for (u32 i = 0; i < tempoData.nextBlockIdx; i++) {
-        const char* label = tempoData.blocks[i].label;
-        u32 depth = tempoData.blocks[i].depth;
-        u64 ticks = tempoData.blocks[i].stopTicks - tempoData.blocks[i].startTicks;
-        u64 parentTicks = parentStack[depth];
-        f64 pctOfParent = ((f64)ticks / (f64)parentTicks) * 100.0;
-        f64 blockMs = ((f64) ticks / (f64) tempoData.cpuFreq) * 1000.0;
-        if (depth + 1 <= maxDepth) {
-            parentStack[depth + 1] = ticks;
+    f64 overheadTicks = (f64) blockCount * tempoData.outerOverhead;
+    printf("TEMPO: Overhead of %.1f ticks per block (%.1f inside it), ~%.3fms over %llu blocks (%.3f%% of wall clock)",
+        tempoData.outerOverhead, tempoData.innerOverhead, overheadTicks / (f64) tempoData.cpuFreq * 1000.0, blockCount,
+        overheadTicks / (f64) recordedTicks * 100.0);
+    if (tempo_isCorrecting()) {
+        printf(", taken out below except where it is over %.0f%% of a block: %.3fms wall clock\n",
+            TEMPO_MAX_OVERHEAD_SHARE * 100.0, totalMs);
+    } else {
+        printf("\nTEMPO: Times below still include it, counters and memory samples add per-block cost calibration does not measure\n");
+    }
+
+    u32 activeCount = 0;
+    for (u32 t = 0; t < tempoData.threadCount; t++) {
+        activeCount += tempo_threadTicks(tempoData.threads[t]->state.anchors) > 0;
+    }
+    if (activeCount <= 1) {
+        tempo_printTree(mainThread->state.anchors, totalTicks);
+    } else {
+        // Summed over threads first, then each thread on its own
+        TempoAnchor* merged = calloc(TEMPO_MAX_ANCHORS, sizeof(TempoAnchor));
+        if (merged == NULL) {
+            fprintf(stderr, "ERROR: Memory alloc failed for the merged profile\n");
+            exit(1);
+        }
+        u64 summedTicks = 0;
+        for (u32 t = 0; t < tempoData.threadCount; t++) {
+            const TempoAnchor* anchors = tempoData.threads[t]->state.anchors;
+            summedTicks += tempo_correctedThreadTicks(anchors, tempoData.threads[t]->state.hitTotal);
+            for (u32 i = 0; i < tempoData.anchorCount; i++) {
+                merged[i].hitCount += anchors[i].hitCount;
+                merged[i].outerHitCount += anchors[i].outerHitCount;
+                merged[i].inclusiveTicks += anchors[i].inclusiveTicks;
+                merged[i].exclusiveTicks += anchors[i].exclusiveTicks;
+                merged[i].byteCount += anchors[i].byteCount;
+                merged[i].itemCount += anchors[i].itemCount;
+                merged[i].childHitCount += anchors[i].childHitCount;
+                merged[i].nestedHitCount += anchors[i].nestedHitCount;
+                for (u32 c = 0; c < TEMPO_COUNTER_COUNT; c++) {
+                    merged[i].counters[c] += anchors[i].counters[c];
+                }
+                merged[i].minorFaults += anchors[i].minorFaults;
+                merged[i].majorFaults += anchors[i].majorFaults;
+                merged[i].rssDelta += anchors[i].rssDelta;
+                merged[i].peakRss = MAX(merged[i].peakRss, anchors[i].peakRss);
+                // Under the parent every thread agrees on, a block opened under different ones is summed at the top
+                if (anchors[i].firstParent != 0) {
+                    bool isSameParent = merged[i].firstParent == 0 || merged[i].firstParent == anchors[i].firstParent;
+                    merged[i].firstParent = isSameParent ? anchors[i].firstParent : 1;
+                }
+            }
+        }
+        f64 summedMs = ((f64) summedTicks / (f64) tempoData.cpuFreq) * 1000.0;
+        printf("TEMPO: Merged over %u threads, %.3fms of thread time\n", activeCount, summedMs);
+        tempo_printTree(merged, summedTicks);
+        for (u32 t = 0; t < tempoData.threadCount; t++) {
+            TempoThread* thread = tempoData.threads[t];
+            if (tempo_threadTicks(thread->state.anchors) == 0) continue;
+            u64 threadTicks = tempo_correctedThreadTicks(thread->state.anchors, thread->state.hitTotal);
+            f64 threadMs = ((f64) threadTicks / (f64) tempoData.cpuFreq) * 1000.0;
+            printf("TEMPO: Thread %s: %.3fms in blocks (%6.3f%% of wall clock)\n",
+                thread->label, threadMs, ((f64) threadTicks / (f64) totalTicks) * 100.0);
+            tempo_printTree(thread->state.anchors, threadTicks);
+        }
+        // The main thread's total is the critical path, the rest ran alongside it
+        printf("TEMPO: Wall clock %.3fms on the main thread, %.3fms summed over threads (%.2fx)\n",
+            totalMs, summedMs, (f64) summedTicks / (f64) totalTicks);
+        free(merged);
+    }
+    for (u32 i = 0; i < tempoData.stageCount; i++) {
+        TempoStage* stage = &tempoData.stages[i];
+        u64 stageTicks = stage->busyTicks + stage->stallTicks;
+        f64 busyMs = ((f64) stage->busyTicks / (f64) tempoData.cpuFreq) * 1000.0;
+        f64 stallMs = ((f64) stage->stallTicks / (f64) tempoData.cpuFreq) * 1000.0;
+        f64 stallPct = stageTicks > 0 ? ((f64) stage->stallTicks / (f64) stageTicks) * 100.0 : 0.0;
+        printf("TEMPO: stage %s: busy=%.3fms stall=%.3fms (%6.3f%% stalled), items=%llu\n",
+            stage->label, busyMs, stallMs, stallPct, stage->itemCount);
+    }
+    if (tempoData.isTrackingMemory) {
+        TempoMemorySample sample;
+        tempo_readMemory(&sample);
+        printf("TEMPO: Peak RSS %.3fMB, %.3fMB resident at the end\n",
+            (f64) sample.peakRss / (1024.0 * 1024.0), (f64) sample.rss / (1024.0 * 1024.0));
+    }
+}
+
+void tempo_addStage(const char* label, u64 busyTicks, u64 stallTicks, u64 itemCount) {
+    if (tempoData.stageCount >= TEMPO_MAX_STAGES) {
+        fprintf(stderr, "WARNING: Dropping profiler stage '%s': too many stages\n", label);
+        return;
+    }
+    TempoStage* stage = &tempoData.stages[tempoData.stageCount++];
+    snprintf(stage->label, TEMPO_STAGE_LABEL_LEN, "%s", label);
+    stage->busyTicks = busyTicks;
+    stage->stallTicks = stallTicks;
+    stage->itemCount = itemCount;
+}
+
+void tempo_startTrace(u64 eventsPerThread) {
+    u64 capacity = 1;
+    while (capacity < MAX(eventsPerThread, 1)) {
+        capacity <<= 1;
+    }
+    tempo_lock();
+    tempoData.traceCapacity = capacity;
+    for (u32 t = 0; t < tempoData.threadCount; t++) {
+        free(tempoData.threads[t]->state.traceEvents);
+        tempo_allocTrace(tempoData.threads[t], capacity);
+    }
+    tempo_unlock();
+}
+
+/// Writes `str` as a quoted JSON string, escaping quotes, backslashes and control characters
+static void tempo_writeJsonString(FILE* file, const char* str) {
+    fputc('"', file);
+    for (const char* c = str; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', file);
+            fputc(*c, file);
+        } else if ((unsigned char) *c < 0x20) {
+            fprintf(file, "\\u%04x", (unsigned char) *c);
+        } else {
+            fputc(*c, file);
         }
-        printf("TEMPO: [%3u] %*s%s: elapsed=%llu (%.3fms, %6.3f%%)\n",
-            i, depth * 2, "", label, ticks, blockMs, pctOfParent);
     }
+    fputc('"', file);
+}
+
+void tempo_writeTrace(const char* filename) {
+    if (tempoData.traceCapacity == 0) {
+        fprintf(stderr, "WARNING: No trace to write, tempo_startTrace was never called\n");
+        return;
+    }
+    if (tempoData.cpuFreq == 0) {
+        fprintf(stderr, "WARNING: No trace written, the profile was never stopped\n");
+        return;
+    }
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR: Failed to write trace file %s\n", filename);
+        exit(1);
+    }
+    f64 usPerTick = 1000000.0 / (f64) tempoData.cpuFreq;
+    u64 eventCount = 0, droppedCount = 0;
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":");
+    tempo_writeJsonString(file, tempoData.anchors[tempoData.rootAnchor].label);
+    fprintf(file, "}}");
+    for (u32 t = 0; t < tempoData.threadCount; t++) {
+        const TempoState* state = &tempoData.threads[t]->state;
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", t);
+        tempo_writeJsonString(file, tempoData.threads[t]->label);
+        fprintf(file, "}}");
+        fprintf(file, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"sort_index\":%u}}", t, t);
+        // Oldest kept event first, once the ring has wrapped the earlier ones are gone
+        u64 first = state->traceCount > tempoData.traceCapacity ? state->traceCount - tempoData.traceCapacity : 0;
+        droppedCount += first;
+        for (u64 i = first; i < state->traceCount; i++) {
+            const TempoTraceEvent* event = &state->traceEvents[i & state->traceMask];
+            f64 startUs = (f64) (s64) (event->startTicks - tempoData.traceStartTicks) * usPerTick;
+            fprintf(file, ",\n{\"name\":");
+            tempo_writeJsonString(file, tempoData.anchors[event->anchorIdx].label);
+            fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                t, startUs, (f64) event->elapsedTicks * usPerTick);
+        }
+        eventCount += state->traceCount - first;
+    }
+    fprintf(file, "\n]}\n");
+    if (fclose(file) != 0) {
+        fprintf(stderr, "ERROR: Failed to finish trace file %s\n", filename);
+        exit(1);
+    }
+    printf("TEMPO: Wrote %llu blocks on %u threads to %s", eventCount, tempoData.threadCount, filename);
+    if (droppedCount > 0) {
+        printf(", the %llu oldest were overwritten", droppedCount);
+    }
+    printf("\n");
 }
 
 void tempo_startBlock(const char* label) {
-    u64 startTicks = tempo_readCpuTimer();
-    if (tempoData.nextBlockIdx >= TEMPO_MAX_BLOCKS) {
-        fprintf(stderr, "ERROR: Cannot start profiler block %u: too many profiler blocks!\n", tempoData.nextBlockIdx);
+    TempoThread* thread = (TempoThread*) tempo_thread();
+    if (thread->depth >= TEMPO_MAX_DEPTH) {
+        fprintf(stderr, "ERROR: Cannot start profiler block '%s': blocks nested deeper than %d!\n", label, TEMPO_MAX_DEPTH);
         exit(1);
     }
-    tempoData.currentBlock = tempoData.nextBlockIdx++;
-    tempoData.currentDepth++;
-    tempoData.blocks[tempoData.currentBlock].label = label;
-    tempoData.blocks[tempoData.currentBlock].depth = tempoData.currentDepth;
-    tempoData.blocks[tempoData.currentBlock].startTicks = startTicks;
-    tempoData.blocks[tempoData.currentBlock].stopTicks = 0;
-    // printf("DBG: OPEN [%d:%d] %s\n", tempoData.currentBlock, tempoData.blocks[tempoData.currentBlock].depth, label);
+    u32* siteIdx = tempo_labelSite(thread, label);
+    thread->stack[thread->depth++] = tempo_openScope(siteIdx, label);
 }
 
 void tempo_stopBlock(const char* label) {
-    u64 stopTicks = tempo_readCpuTimer();
-    if (label != NULL) {
-        if (strcmp(label, tempoData.blocks[tempoData.currentBlock].label) != 0) {
-            fprintf(stderr, "WARNING: Unexpected block closure: expected '%s', found '%s'label\n",
-                label, tempoData.blocks[tempoData.currentBlock].label);
-        }
-    }
-    tempoData.blocks[tempoData.currentBlock].stopTicks = stopTicks;
-    // printf("DBG: CLOS [%d:%d] %s\n", tempoData.currentBlock, tempoData.blocks[tempoData.currentBlock].depth,tempoData.blocks[tempoData.currentBlock].label);
-    tempoData.currentDepth = tempoData.blocks[tempoData.currentBlock].depth - 1;
-    for (int idx = tempoData.currentBlock-1; idx >= 0; idx--) {
-        if (tempoData.blocks[idx].depth == tempoData.currentDepth) {
-            tempoData.currentBlock = idx;
-            // printf("DBG:   NEXT [%d:%d] %s\n", tempoData.currentBlock, tempoData.blocks[tempoData.currentBlock].depth, tempoData.blocks[tempoData.currentBlock].label);
-            break;
-        }
+    TempoThread* thread = (TempoThread*) tempo_thread();
+    if (thread->depth == 0) {
+        fprintf(stderr, "WARNING: Unexpected block closure: '%s' with no open blocks\n", label != NULL ? label : "(null)");
+        return;
     }
+    TempoScope* scope = &thread->stack[--thread->depth];
+    const char* openLabel = tempoData.anchors[scope->anchorIdx].label;
+    if (label != NULL && label != openLabel && strcmp(label, openLabel) != 0) {
+        fprintf(stderr, "WARNING: Unexpected block closure: expected '%s', found '%s'\n", label, openLabel);
+    }
+    tempo_closeScope(scope);
+}
+
+#else
+
+void tempo_printProfile(void) {
+    printf("TEMPO: Profiling compiled out (TEMPO_ENABLED=0)\n");
 }
 
+#endif  // TEMPO_ENABLED
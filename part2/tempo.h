@@ -1,23 +1,256 @@
-
 #ifndef TEMPO_H
 #define TEMPO_H
 
+#include <stdbool.h>
+
 #include "types.h"
 
-#define TEMPO_MAX_BLOCKS 256
+// Build with -DTEMPO_ENABLED=0 to compile every block, count and profile call away. Only tempo_readTicks and
+// tempo_estimateCpuFreq stay, they time things outside the profiler too.
+#ifndef TEMPO_ENABLED
+#define TEMPO_ENABLED 1
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TEMPO_THREAD_LOCAL __declspec(thread)
+#define TEMPO_UNUSED
+#else
+#include <x86intrin.h>
+#define TEMPO_THREAD_LOCAL _Thread_local
+#define TEMPO_UNUSED __attribute__((unused))  // For files that include tempo.h without a tempo_scope
+#endif
+
+#define TEMPO_MAX_ANCHORS 1024
+#define TEMPO_MAX_DEPTH 256
+#define TEMPO_MAX_THREADS 256
+#define TEMPO_MAX_STAGES 32
+#define TEMPO_STAGE_LABEL_LEN 32
+#define TEMPO_THREAD_LABEL_LEN 32
+// Ring slots per thread for -trace style timelines, rounded up to a power of two
+#define TEMPO_TRACE_DEFAULT_EVENTS (1 << 16)
+// Scoped blocks per source file, each tempo_scope takes one of its file's slots
+#define TEMPO_SITES_PER_FILE 256
+
+// Hardware counters tempo_startCounters tries to open, in the order they are given up when they don't all fit
+#define TEMPO_COUNTERS(X) \
+    X(TEMPO_COUNTER_CYCLES, "cycles") \
+    X(TEMPO_COUNTER_INSTRUCTIONS, "instructions") \
+    X(TEMPO_COUNTER_BRANCHES, "branches") \
+    X(TEMPO_COUNTER_BRANCH_MISSES, "branch_misses") \
+    X(TEMPO_COUNTER_L1D_MISSES, "l1d_misses") \
+    X(TEMPO_COUNTER_LLC_MISSES, "llc_misses") \
+    X(TEMPO_COUNTER_DTLB_MISSES, "dtlb_misses")
+
+#define ENUM_ENTRY(name, str) name,
+typedef enum {
+    TEMPO_COUNTERS(ENUM_ENTRY)
+    TEMPO_COUNTER_COUNT
+} TempoCounter;
+#undef ENUM_ENTRY
+
+/// One thread's totals for every block sharing a label, however many times it runs. Anchor 0 collects time
+/// outside any block, so its exclusive ticks go negative by the time spent in top-level blocks.
+typedef struct TempoAnchor {
+    u64 hitCount;
+    u64 outerHitCount;      // Hits not inside another hit of the same block, the ones inclusiveTicks times
+    u64 inclusiveTicks;     // Counted once even when the block recurses into itself
+    u64 exclusiveTicks;     // Minus the time spent in child blocks
+    u64 byteCount;          // Work the block reported with tempo_countBytes and tempo_countItems
+    u64 itemCount;
+    // How many blocks ran directly and anywhere inside it, to take the profiler's own cost back out
+    u64 childHitCount;
+    u64 nestedHitCount;
+    u64 counters[TEMPO_COUNTER_COUNT];  // Inclusive, like inclusiveTicks, and 0 unless tempo_startCounters worked
+    // Page faults of its thread and the change in resident set, 0 unless tempo_startMemory worked
+    u64 minorFaults;
+    u64 majorFaults;
+    s64 rssDelta;
+    u64 peakRss;    // Highest resident set seen by the end of the block
+    // One more than the block it was first opened under on this thread, 0 until then. Places it in the
+    // thread's report tree, a block shared between threads can sit under a different parent on each.
+    u32 firstParent;
+} TempoAnchor;
+
+/// One open block, kept by whoever opened it
+typedef struct TempoScope {
+    u32 anchorIdx;
+    u32 parentIdx;
+    u64 startTicks;
+    u64 oldInclusiveTicks;
+    u64 startHitTotal;
+    u64 oldNestedHitCount;
+    u64 oldOuterHitCount;
+} TempoScope;
+
+/// One closed block on a thread's timeline. Kept whole rather than as a begin/end pair, so a wrapped ring never
+/// leaves half a block behind.
+typedef struct TempoTraceEvent {
+    u32 anchorIdx;
+    u64 startTicks;
+    u64 elapsedTicks;
+} TempoTraceEvent;
+
+/// Counters of one thread. Each thread registers its own on first use and only ever writes that one, so the hot
+/// path takes no locks. Labels are shared, an anchor index means the same block on every thread.
+typedef struct TempoState {
+    TempoAnchor anchors[TEMPO_MAX_ANCHORS];
+    u32 currentAnchor;
+    u64 hitTotal;   // Blocks closed on this thread so far
+    // Ring of the latest closed blocks, NULL unless tracing. traceCount keeps going past the ring size.
+    TempoTraceEvent* traceEvents;
+    u64 traceCount;
+    u64 traceMask;
+    struct TempoCounterSet* counters;   // Open hardware counters and fault totals, NULL unless counting either
+} TempoState;
+
+/// Busy/stall totals measured by a pipeline stage on its own thread, reported after the blocks
+typedef struct TempoStage {
+    char label[TEMPO_STAGE_LABEL_LEN];
+    u64 busyTicks, stallTicks;
+    u64 itemCount;
+} TempoStage;
+
+u64 tempo_estimateCpuFreq(u64 testDurationMillis);
+u64 tempo_readTicks(void);
+/// Prints the report, or a note that profiling was compiled out
+void tempo_printProfile(void);
+
+#if TEMPO_ENABLED
 
-typedef struct TempoBlock {
-    u32 depth;
-    const char* label;
-    u64 startTicks, stopTicks;
-} TempoBlock;
+extern TEMPO_THREAD_LOCAL TempoState* tempoThread;
 
 void tempo_startProfile(const char* label);
 void tempo_stopProfile(void);
-void tempo_printProfile(void);
 void tempo_startBlock(const char* label);
 void tempo_stopBlock(const char* label);
-u64 tempo_estimateCpuFreq(u64 testDurationMillis);
+void tempo_addStage(const char* label, u64 busyTicks, u64 stallTicks, u64 itemCount);
+/// Names the calling thread in the per-thread report and the trace
+void tempo_nameThread(const char* label);
+/// Keeps the last `eventsPerThread` blocks of every thread for tempo_writeTrace. Call it while no other thread is
+/// profiling, threads that register later get their ring as they start.
+void tempo_startTrace(u64 eventsPerThread);
+/// Opens the hardware counters on the calling thread and on every thread registering after it, returning false
+/// with a note when none are permitted. Only the first call does anything.
+bool tempo_startCounters(void);
+/// Adds page faults and resident set changes to every block opened after it, on this thread and any registering
+/// later. The resident set is the process's, so its changes are only clear for blocks running on their own.
+bool tempo_startMemory(void);
+/// Slow paths of a block opening and closing while counting
+void tempo_openCounters(TempoState* thread);
+void tempo_closeCounters(TempoState* thread, u32 anchorIdx);
+/// Writes the recorded blocks as Chrome Trace Event JSON, for Perfetto or chrome://tracing. Needs the CPU
+/// frequency measured by tempo_stopProfile.
+void tempo_writeTrace(const char* filename);
+/// Slow path of a thread's first block: allocates its counters and adds them to the global list
+TempoState* tempo_registerThread(void);
+/// Slow path of the first hit at a site: finds or adds the anchor for `label` and caches it in `siteIdx`
+u32 tempo_registerSite(u32* siteIdx, const char* label);
+
+static inline TempoState* tempo_thread(void) {
+    TempoState* thread = tempoThread;
+    if (thread == NULL) {
+        thread = tempo_registerThread();
+    }
+    return thread;
+}
+
+static inline TempoScope tempo_openScope(u32* siteIdx, const char* label) {
+    TempoState* thread = tempo_thread();
+    u32 anchorIdx = *siteIdx;
+    if (anchorIdx == 0) {
+        anchorIdx = tempo_registerSite(siteIdx, label);
+    }
+    if (thread->anchors[anchorIdx].firstParent == 0) {
+        thread->anchors[anchorIdx].firstParent = thread->currentAnchor + 1;
+    }
+    TempoScope scope;
+    scope.anchorIdx = anchorIdx;
+    scope.parentIdx = thread->currentAnchor;
+    scope.oldInclusiveTicks = thread->anchors[anchorIdx].inclusiveTicks;
+    scope.startHitTotal = thread->hitTotal;
+    scope.oldNestedHitCount = thread->anchors[anchorIdx].nestedHitCount;
+    scope.oldOuterHitCount = thread->anchors[anchorIdx].outerHitCount;
+    thread->currentAnchor = anchorIdx;
+    if (thread->counters != NULL) {
+        tempo_openCounters(thread);
+    }
+    scope.startTicks = __rdtsc();
+    return scope;
+}
+
+static inline void tempo_closeScope(TempoScope* scope) {
+    u64 elapsed = __rdtsc() - scope->startTicks;
+    TempoState* thread = tempoThread;  // Registered when the scope opened
+    if (thread->counters != NULL) {
+        tempo_closeCounters(thread, scope->anchorIdx);
+    }
+    TempoAnchor* anchor = &thread->anchors[scope->anchorIdx];
+    thread->anchors[scope->parentIdx].exclusiveTicks -= elapsed;
+    anchor->exclusiveTicks += elapsed;
+    // An outer call of a recursive block closes last and overwrites what its inner calls stored
+    anchor->inclusiveTicks = scope->oldInclusiveTicks + elapsed;
+    anchor->nestedHitCount = scope->oldNestedHitCount + (thread->hitTotal - scope->startHitTotal);
+    anchor->outerHitCount = scope->oldOuterHitCount + 1;
+    anchor->hitCount++;
+    if (thread->traceEvents != NULL) {
+        TempoTraceEvent* event = &thread->traceEvents[thread->traceCount++ & thread->traceMask];
+        event->anchorIdx = scope->anchorIdx;
+        event->startTicks = scope->startTicks;
+        event->elapsedTicks = elapsed;
+    }
+    thread->anchors[scope->parentIdx].childHitCount++;
+    thread->hitTotal++;
+    thread->currentAnchor = scope->parentIdx;
+    scope->anchorIdx = 0;
+}
+
+/// Adds to the bytes the innermost open block processed, reported as bandwidth next to its time
+static inline void tempo_countBytes(u64 byteCount) {
+    TempoState* thread = tempo_thread();
+    thread->anchors[thread->currentAnchor].byteCount += byteCount;
+}
+/// Adds to the items the innermost open block processed, reported as time per item
+static inline void tempo_countItems(u64 itemCount) {
+    TempoState* thread = tempo_thread();
+    thread->anchors[thread->currentAnchor].itemCount += itemCount;
+}
+
+// Every tempo_scope in a file gets a static slot from __COUNTER__, which caches its anchor after the first hit.
+// Only written under the registry lock, and a thread that still reads 0 just takes the slow path to the same anchor.
+static TEMPO_UNUSED u32 tempoSiteIdxs[TEMPO_SITES_PER_FILE];
+// Fails to compile with a negative array size once a file has too many sites
+#define TEMPO_SITE(n) ((n) + 0 * sizeof(char[TEMPO_SITES_PER_FILE - (n)]))
+#define TEMPO_SCOPE_AT(label, site) \
+    for (TempoScope tempoScope_ = tempo_openScope(&tempoSiteIdxs[TEMPO_SITE(site)], label); \
+         tempoScope_.anchorIdx != 0; tempo_closeScope(&tempoScope_))
+
+/// Times the statement or braced block that follows, closing it when the block ends. Leaving with break, goto or
+/// return skips the close, so those blocks should use tempo_startBlock/tempo_stopBlock instead.
+#define tempo_scope(label) TEMPO_SCOPE_AT(label, __COUNTER__)
+#define tempo_scopeFunc tempo_scope(__func__)
+
+#else
+
+static inline void tempo_startProfile(const char* label) { (void) label; }
+static inline void tempo_stopProfile(void) {}
+static inline void tempo_startBlock(const char* label) { (void) label; }
+static inline void tempo_stopBlock(const char* label) { (void) label; }
+static inline void tempo_addStage(const char* label, u64 busyTicks, u64 stallTicks, u64 itemCount) {
+    (void) label, (void) busyTicks, (void) stallTicks, (void) itemCount;
+}
+static inline void tempo_nameThread(const char* label) { (void) label; }
+static inline bool tempo_startCounters(void) { return false; }
+static inline bool tempo_startMemory(void) { return false; }
+static inline void tempo_startTrace(u64 eventsPerThread) { (void) eventsPerThread; }
+static inline void tempo_writeTrace(const char* filename) { (void) filename; }
+static inline void tempo_countBytes(u64 byteCount) { (void) byteCount; }
+static inline void tempo_countItems(u64 itemCount) { (void) itemCount; }
+// Still runs the block that follows, exactly once
+#define tempo_scope(label) for (int tempoOnce_ = 1; tempoOnce_; tempoOnce_ = 0)
+#define tempo_scopeFunc tempo_scope(__func__)
+
+#endif  // TEMPO_ENABLED
 
 #define tempo_startFunc tempo_startBlock(__func__)
 #define tempo_stopFunc tempo_stopBlock(__func__)
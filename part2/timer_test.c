@@ -12,6 +12,28 @@
 const char* INNER_NAMES[5] = { "inner[025]", "inner[050]", "inner[075]", "inner[100]", "inner[125]", };
 const char* J_NAMES[5] = { "j0", "j1", "j2", "j3", "j4" };
 
+#define HOT_LOOP_COUNT 100000000ull
+#define REPEAT_COUNT 1000
+
+u64 recursiveFunc(u32 depth) {
+    u64 result = 1;
+    tempo_scopeFunc {
+        if (depth > 0) {
+            result = recursiveFunc(depth - 1) + recursiveFunc(depth - 1);
+        }
+    }
+    return result;
+}
+
+void threadFunc(void* arg) {
+    u64* result = arg;
+    tempo_nameThread("helper");
+    tempo_scope("helper_work") {
+        sleep_ms(20);
+        *result = recursiveFunc(6);
+    }
+}
+
 void testerFunc(u64 delay) {
     tempo_startFunc;
     tempo_startBlock(INNER_NAMES[(delay / 25) - 1]);
@@ -33,12 +55,41 @@ int main(int argc, char** argv) {
             }
             tempo_startBlock("deepest");
             tempo_stopBlock("deepest");
-            for (int j = 0; j < 5; j++) {
+            for (int j = 4; j >= 0; j--) {
                 tempo_stopBlock(J_NAMES[j]);
             }
         }
         testerFunc(ms);
     }
+
+    // Far more block entries than there are anchors
+    for (int i = 0; i < REPEAT_COUNT; i++) {
+        tempo_startBlock("repeated");
+        tempo_stopBlock("repeated");
+    }
+    printf("Recursion visited %llu calls\n", recursiveFunc(10));
+
+    // Blocks on another thread land in its own counters and show up in the per-thread report
+    u64 helperResult = 0;
+    ThreadHandle helper = thread_start(threadFunc, &helperResult);
+    tempo_scope("wait_helper") {
+        thread_join(&helper);
+    }
+    printf("Helper visited %llu calls\n", helperResult);
+
+    u64 sum = 0;
+    u64 loopStart = tempo_readTicks();
+    tempo_scope("hot_loop") {
+        tempo_countItems(HOT_LOOP_COUNT);
+        tempo_countBytes(HOT_LOOP_COUNT * sizeof(u64));
+        for (u64 i = 0; i < HOT_LOOP_COUNT; i++) {
+            tempo_scope("hot_body") {
+                sum += i ^ (sum >> 3);
+            }
+        }
+    }
+    u64 loopTicks = tempo_readTicks() - loopStart;
+    printf("Hot loop sum %llu: %.1f ticks per instrumented iteration\n", sum, (f64) loopTicks / (f64) HOT_LOOP_COUNT);
     tempo_stopProfile();
 
     tempo_printProfile();
@@ -0,0 +1,216 @@
+//
+// Created by stevehb on 19-Oct-26.
+//
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <emmintrin.h>
+
+#include "types.h"
+#include "common_funcs.h"
+#include "haversine.h"
+#include "validate.h"
+
+static u32 validate_absBucket(u64 absBits) {
+    if (absBits == 0) return 0;
+    s32 exp = (s32) (absBits >> 52) - 1023;
+    if (exp < VALIDATE_ABS_MIN_EXP) return 1;
+    if (exp >= 0) return VALIDATE_ABS_BUCKETS - 1;
+    return (u32) (exp - VALIDATE_ABS_MIN_EXP) + 2;
+}
+static u32 validate_ulpBucket(u64 ulp) {
+    return ulp == 0 ? 0 : 64 - (u32) __builtin_clzll(ulp);
+}
+/// Maps the bits of a double onto an integer line that is monotonic across zero
+static u64 validate_orderedBits(f64 value) {
+    u64 bits = 0;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits >> 63) ? (0x8000000000000000ull - (bits & 0x7FFFFFFFFFFFFFFFull)) : (bits | 0x8000000000000000ull);
+}
+
+/// Keeps `worst` sorted by error descending, earlier pairs first on ties
+static void validate_insertWorst(ValidateReport* report, ValidateWorst candidate) {
+    u32 pos = report->worstCount;
+    while (pos > 0) {
+        ValidateWorst* prev = &report->worst[pos - 1];
+        bool isBetter = candidate.absError > prev->absError
+            || (candidate.absError == prev->absError && candidate.pairIdx < prev->pairIdx);
+        if (!isBetter) break;
+        pos--;
+    }
+    if (pos >= VALIDATE_TOP_N) return;
+    u32 last = MIN(report->worstCount, VALIDATE_TOP_N - 1);
+    for (u32 i = last; i > pos; i--) {
+        report->worst[i] = report->worst[i - 1];
+    }
+    report->worst[pos] = candidate;
+    report->worstCount = MIN(report->worstCount + 1, VALIDATE_TOP_N);
+}
+static void validate_considerWorst(ValidateReport* report, const PairArrays* pairs, const f64* computed, const f64* known,
+                                   u64 i, u64 pairIdxBase) {
+    ValidateWorst candidate = { 0 };
+    candidate.pairIdx = pairIdxBase + i;
+    candidate.computed = computed[i];
+    candidate.known = known[i];
+    candidate.absError = fabs(computed[i] - known[i]);
+    u64 a = validate_orderedBits(computed[i]), b = validate_orderedBits(known[i]);
+    candidate.ulpError = a > b ? a - b : b - a;
+    candidate.lng0 = pairs->lng0[i];
+    candidate.lat0 = pairs->lat0[i];
+    candidate.lng1 = pairs->lng1[i];
+    candidate.lat1 = pairs->lat1[i];
+    validate_insertWorst(report, candidate);
+}
+static f64 validate_worstThreshold(ValidateReport* report) {
+    return report->worstCount < VALIDATE_TOP_N ? -1.0 : report->worst[VALIDATE_TOP_N - 1].absError;
+}
+
+void validate_range(ValidateReport* report, const PairArrays* pairs, const f64* computed, const f64* known,
+                    u64 begin, u64 end, u64 pairIdxBase) {
+    const __m128d signMask = _mm_set1_pd(-0.0);
+    const __m128d epsilon = _mm_set1_pd(DBL_EPSILON);
+    const __m128i lowBits = _mm_set1_epi64x(0x7FFFFFFFFFFFFFFFll);
+    const __m128i highBit = _mm_set1_epi64x((s64) 0x8000000000000000ull);
+    __m128d maxAbs = _mm_set1_pd(report->maxAbsError);
+    __m128d worstThreshold = _mm_set1_pd(validate_worstThreshold(report));
+    u64 overEpsCount = 0, nanCount = 0, maxUlp = report->maxUlpError;
+
+    u64 i = begin;
+    for (; i + 2 <= end; i += 2) {
+        __m128d c = _mm_loadu_pd(computed + i);
+        __m128d k = _mm_loadu_pd(known + i);
+        __m128d absErr = _mm_andnot_pd(signMask, _mm_sub_pd(c, k));
+        maxAbs = _mm_max_pd(absErr, maxAbs);  // NaN in the first operand keeps the running max
+        overEpsCount += __builtin_popcount(_mm_movemask_pd(_mm_cmpge_pd(absErr, epsilon)));
+        nanCount += __builtin_popcount(_mm_movemask_pd(_mm_cmpunord_pd(absErr, absErr)));
+
+        // Ordered integer view: negative values flip below positives, then |a - b| is the ULP distance
+        __m128i ci = _mm_castpd_si128(c);
+        __m128i ki = _mm_castpd_si128(k);
+        __m128i cSign = _mm_shuffle_epi32(_mm_srai_epi32(ci, 31), _MM_SHUFFLE(3, 3, 1, 1));
+        __m128i kSign = _mm_shuffle_epi32(_mm_srai_epi32(ki, 31), _MM_SHUFFLE(3, 3, 1, 1));
+        __m128i cOrd = _mm_or_si128(_mm_andnot_si128(cSign, _mm_or_si128(ci, highBit)),
+                                    _mm_and_si128(cSign, _mm_sub_epi64(highBit, _mm_and_si128(ci, lowBits))));
+        __m128i kOrd = _mm_or_si128(_mm_andnot_si128(kSign, _mm_or_si128(ki, highBit)),
+                                    _mm_and_si128(kSign, _mm_sub_epi64(highBit, _mm_and_si128(ki, lowBits))));
+        __m128i diff = _mm_sub_epi64(cOrd, kOrd);
+        __m128i diffSign = _mm_shuffle_epi32(_mm_srai_epi32(diff, 31), _MM_SHUFFLE(3, 3, 1, 1));
+        __m128i ulp = _mm_sub_epi64(_mm_xor_si128(diff, diffSign), diffSign);
+
+        u64 ulpLanes[2], absLanes[2];
+        _mm_storeu_si128((__m128i*) ulpLanes, ulp);
+        _mm_storeu_si128((__m128i*) absLanes, _mm_castpd_si128(absErr));
+        report->absHistogram[validate_absBucket(absLanes[0])]++;
+        report->absHistogram[validate_absBucket(absLanes[1])]++;
+        report->ulpHistogram[validate_ulpBucket(ulpLanes[0])]++;
+        report->ulpHistogram[validate_ulpBucket(ulpLanes[1])]++;
+        maxUlp = MAX(maxUlp, MAX(ulpLanes[0], ulpLanes[1]));
+
+        int worstMask = _mm_movemask_pd(_mm_cmpgt_pd(absErr, worstThreshold));
+        if (worstMask) {
+            if (worstMask & 1) validate_considerWorst(report, pairs, computed, known, i, pairIdxBase);
+            if (worstMask & 2) validate_considerWorst(report, pairs, computed, known, i + 1, pairIdxBase);
+            worstThreshold = _mm_set1_pd(validate_worstThreshold(report));
+        }
+    }
+
+    f64 maxLanes[2];
+    _mm_storeu_pd(maxLanes, maxAbs);
+    f64 maxAbsError = MAX(maxLanes[0], maxLanes[1]);
+    for (; i < end; i++) {
+        f64 absErr = fabs(computed[i] - known[i]);
+        u64 absBits = 0;
+        memcpy(&absBits, &absErr, sizeof(absBits));
+        u64 a = validate_orderedBits(computed[i]), b = validate_orderedBits(known[i]);
+        u64 ulp = a > b ? a - b : b - a;
+        if (absErr > maxAbsError) maxAbsError = absErr;
+        if (absErr >= DBL_EPSILON) overEpsCount++;
+        if (isnan(absErr)) nanCount++;
+        report->absHistogram[validate_absBucket(absBits)]++;
+        report->ulpHistogram[validate_ulpBucket(ulp)]++;
+        maxUlp = MAX(maxUlp, ulp);
+        if (absErr > validate_worstThreshold(report)) {
+            validate_considerWorst(report, pairs, computed, known, i, pairIdxBase);
+        }
+    }
+
+    report->pairCount += end - begin;
+    report->overEpsCount += overEpsCount;
+    report->nanCount += nanCount;
+    report->maxAbsError = maxAbsError;
+    report->maxUlpError = maxUlp;
+}
+
+void validate_merge(ValidateReport* into, const ValidateReport* from) {
+    into->pairCount += from->pairCount;
+    into->overEpsCount += from->overEpsCount;
+    into->nanCount += from->nanCount;
+    into->maxAbsError = MAX(into->maxAbsError, from->maxAbsError);
+    into->maxUlpError = MAX(into->maxUlpError, from->maxUlpError);
+    for (u32 b = 0; b < VALIDATE_ABS_BUCKETS; b++) {
+        into->absHistogram[b] += from->absHistogram[b];
+    }
+    for (u32 b = 0; b < VALIDATE_ULP_BUCKETS; b++) {
+        into->ulpHistogram[b] += from->ulpHistogram[b];
+    }
+    for (u32 w = 0; w < from->worstCount; w++) {
+        validate_insertWorst(into, from->worst[w]);
+    }
+}
+
+void validate_print(const ValidateReport* report) {
+    if (report->pairCount == 0) return;
+    f64 pctCoef = 100.0 / (f64) report->pairCount;
+    if (report->overEpsCount > 0) {
+        printf("WARNING: Found %llu distance errors greater than DBL_EPSILON (%E): max error %E at pair %llu\n",
+            report->overEpsCount, (f64) DBL_EPSILON, report->maxAbsError, report->worstCount > 0 ? report->worst[0].pairIdx + 1 : 0);
+    }
+    if (report->nanCount > 0) {
+        printf("WARNING: Found %llu NaN distances\n", report->nanCount);
+    }
+    printf("Validated %llu pairs: max abs error %E, max ULP error %llu\n", report->pairCount, report->maxAbsError, report->maxUlpError);
+
+    printf("  Abs error histogram:\n");
+    for (u32 b = 0; b < VALIDATE_ABS_BUCKETS; b++) {
+        u64 count = report->absHistogram[b];
+        if (count == 0) continue;
+        if (b == 0) {
+            printf("    exact          : %10llu (%7.3f%%)\n", count, (f64) count * pctCoef);
+        } else if (b == 1) {
+            printf("    < 2^%-9d : %10llu (%7.3f%%)\n", VALIDATE_ABS_MIN_EXP, count, (f64) count * pctCoef);
+        } else if (b == VALIDATE_ABS_BUCKETS - 1) {
+            printf("    >= 1           : %10llu (%7.3f%%)\n", count, (f64) count * pctCoef);
+        } else {
+            s32 exp = (s32) b - 2 + VALIDATE_ABS_MIN_EXP;
+            printf("    [2^%d, 2^%d)%*s: %10llu (%7.3f%%)  ~%.0E\n", exp, exp + 1, exp > -10 ? 3 : 1, "",
+                count, (f64) count * pctCoef, ldexp(1.0, exp));
+        }
+    }
+
+    printf("  ULP error histogram:\n");
+    for (u32 b = 0; b < VALIDATE_ULP_BUCKETS; b++) {
+        u64 count = report->ulpHistogram[b];
+        if (count == 0) continue;
+        if (b <= 1) {
+            printf("    %-14u : %10llu (%7.3f%%)\n", b, count, (f64) count * pctCoef);
+        } else {
+            char range[32];
+            snprintf(range, sizeof(range), "%llu-%llu", 1ull << (b - 1), (b == 64) ? ~0ull : ((1ull << b) - 1));
+            printf("    %-14s : %10llu (%7.3f%%)\n", range, count, (f64) count * pctCoef);
+        }
+    }
+
+    if (report->worstCount > 0 && report->worst[0].absError > 0.0) {
+        printf("  Worst pairs:\n");
+        for (u32 w = 0; w < report->worstCount; w++) {
+            const ValidateWorst* worst = &report->worst[w];
+            if (worst->absError == 0.0) break;
+            printf("    pair %llu: error %E (%llu ulp), calc=%.16f known=%.16f, (lng0=%f,lat0=%f), (lng1=%f,lat1=%f)\n",
+                worst->pairIdx + 1, worst->absError, worst->ulpError, worst->computed, worst->known,
+                worst->lng0, worst->lat0, worst->lng1, worst->lat1);
+        }
+    }
+}
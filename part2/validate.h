@@ -0,0 +1,45 @@
+//
+// Created by stevehb on 19-Oct-26.
+//
+
+#ifndef VALIDATE_H
+#define VALIDATE_H
+
+#include "types.h"
+#include "haversine.h"
+
+#define VALIDATE_TOP_N 8
+// Absolute errors bucket by binary exponent: [0] exact, [1] below 2^-64, [2 + e + 64] for [2^e, 2^(e+1)), last is >= 1
+#define VALIDATE_ABS_MIN_EXP -64
+#define VALIDATE_ABS_BUCKETS 67
+// ULP errors bucket by bit length: 0, 1, 2-3, 4-7, ...
+#define VALIDATE_ULP_BUCKETS 65
+
+typedef struct ValidateWorst {
+    u64 pairIdx;
+    f64 absError;
+    u64 ulpError;
+    f64 computed, known;
+    f64 lng0, lat0, lng1, lat1;
+} ValidateWorst;
+
+typedef struct ValidateReport {
+    u64 pairCount;
+    u64 overEpsCount;
+    u64 nanCount;
+    f64 maxAbsError;
+    u64 maxUlpError;
+    u64 absHistogram[VALIDATE_ABS_BUCKETS];
+    u64 ulpHistogram[VALIDATE_ULP_BUCKETS];
+    ValidateWorst worst[VALIDATE_TOP_N];
+    u32 worstCount;
+} ValidateReport;
+
+/// Compares `computed[i]` against `known[i]` for i in [begin, end), `pairs` supplies the coordinates
+/// for the worst-pair list. Reported pair indices are `pairIdxBase + i`.
+void validate_range(ValidateReport* report, const PairArrays* pairs, const f64* computed, const f64* known,
+                    u64 begin, u64 end, u64 pairIdxBase);
+void validate_merge(ValidateReport* into, const ValidateReport* from);
+void validate_print(const ValidateReport* report);
+
+#endif //VALIDATE_H
@@ -0,0 +1,72 @@
+//
+// Created by stevehb on 19-Oct-26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "types.h"
+#include "work_queue.h"
+
+void workQueue_init(WorkQueue* queue, u64 minCapacity) {
+    u64 capacity = 2;
+    while (capacity < minCapacity) {
+        capacity *= 2;
+    }
+    queue->cells = malloc(capacity * sizeof(WorkQueueCell));
+    if (queue->cells == NULL) {
+        fprintf(stderr, "ERROR: Memory alloc failed for work queue of %llu cells\n", capacity);
+        exit(1);
+    }
+    for (u64 i = 0; i < capacity; i++) {
+        atomic_store_explicit(&queue->cells[i].sequence, i, memory_order_relaxed);
+        queue->cells[i].item = NULL;
+    }
+    queue->mask = capacity - 1;
+    atomic_store_explicit(&queue->enqueuePos, 0, memory_order_relaxed);
+    atomic_store_explicit(&queue->dequeuePos, 0, memory_order_relaxed);
+}
+void workQueue_free(WorkQueue* queue) {
+    free(queue->cells);
+    queue->cells = NULL;
+    queue->mask = 0;
+}
+
+bool workQueue_tryPush(WorkQueue* queue, void* item) {
+    u64 pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+    for (;;) {
+        WorkQueueCell* cell = &queue->cells[pos & queue->mask];
+        u64 seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        s64 dif = (s64) seq - (s64) pos;
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueuePos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                cell->item = item;
+                atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+                return true;
+            }
+        } else if (dif < 0) {
+            return false;  // Full
+        } else {
+            pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+        }
+    }
+}
+bool workQueue_tryPop(WorkQueue* queue, void** out_item) {
+    u64 pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+    for (;;) {
+        WorkQueueCell* cell = &queue->cells[pos & queue->mask];
+        u64 seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        s64 dif = (s64) seq - (s64) (pos + 1);
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->dequeuePos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                *out_item = cell->item;
+                atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release);
+                return true;
+            }
+        } else if (dif < 0) {
+            return false;  // Empty
+        } else {
+            pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+        }
+    }
+}
@@ -0,0 +1,35 @@
+//
+// Created by stevehb on 19-Oct-26.
+//
+
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "types.h"
+
+#define WORK_QUEUE_CACHE_LINE 64
+
+typedef struct WorkQueueCell {
+    _Atomic u64 sequence;
+    void* item;
+} WorkQueueCell;
+
+/// Bounded lock-free multi-producer/multi-consumer ring of pointers (Vyukov style).
+/// Each cell carries a sequence number that says whose turn it is, so producers and
+/// consumers only contend on their own position counter.
+typedef struct WorkQueue {
+    WorkQueueCell* cells;
+    u64 mask;
+    _Alignas(WORK_QUEUE_CACHE_LINE) _Atomic u64 enqueuePos;
+    _Alignas(WORK_QUEUE_CACHE_LINE) _Atomic u64 dequeuePos;
+} WorkQueue;
+
+void workQueue_init(WorkQueue* queue, u64 minCapacity);
+void workQueue_free(WorkQueue* queue);
+bool workQueue_tryPush(WorkQueue* queue, void* item);
+bool workQueue_tryPop(WorkQueue* queue, void** out_item);
+
+#endif //WORK_QUEUE_H